@@ -313,6 +313,39 @@ msgstr("Use mini contact list")
 msgid(SETTINGS_UI_AUTO_HIDE_SIDEBAR)
 msgstr("Auto hide sidebar")
 
+msgid(SETTINGS_FT_MAX_SENDING)
+msgstr("Large files sent at once")
+
+msgid(SETTINGS_FT_SEND_RATE)
+msgstr("Upload limit")
+
+msgid(SETTINGS_FT_UNLIMITED)
+msgstr("Unlimited")
+
+msgid(SETTINGS_FT_MAX_SENDING_1)
+msgstr("1")
+
+msgid(SETTINGS_FT_MAX_SENDING_2)
+msgstr("2")
+
+msgid(SETTINGS_FT_MAX_SENDING_3)
+msgstr("3")
+
+msgid(SETTINGS_FT_MAX_SENDING_4)
+msgstr("4")
+
+msgid(SETTINGS_FT_SEND_RATE_64K)
+msgstr("64 KiB/s")
+
+msgid(SETTINGS_FT_SEND_RATE_256K)
+msgstr("256 KiB/s")
+
+msgid(SETTINGS_FT_SEND_RATE_1M)
+msgstr("1 MiB/s")
+
+msgid(SETTINGS_FT_SEND_RATE_4M)
+msgstr("4 MiB/s")
+
 msgid(NOT_CONNECTED)
 msgstr("Not Connected")
 
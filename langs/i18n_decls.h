@@ -153,6 +153,17 @@ typedef enum {
     // Settings Strings
     STR_SETTINGS_UI_MINI_ROSTER,
     STR_SETTINGS_UI_AUTO_HIDE_SIDEBAR,
+    STR_SETTINGS_FT_MAX_SENDING,
+    STR_SETTINGS_FT_SEND_RATE,
+    STR_SETTINGS_FT_UNLIMITED,
+    STR_SETTINGS_FT_MAX_SENDING_1,
+    STR_SETTINGS_FT_MAX_SENDING_2,
+    STR_SETTINGS_FT_MAX_SENDING_3,
+    STR_SETTINGS_FT_MAX_SENDING_4,
+    STR_SETTINGS_FT_SEND_RATE_64K,
+    STR_SETTINGS_FT_SEND_RATE_256K,
+    STR_SETTINGS_FT_SEND_RATE_1M,
+    STR_SETTINGS_FT_SEND_RATE_4M,
 
     // Status strings
     STR_NOT_CONNECTED,
@@ -1,5 +1,6 @@
 #include "audio.h"
 
+#include "mixer.h"
 #include "utox_av.h"
 
 #include "../native/audio.h"
@@ -11,6 +12,7 @@
 #include "../groups.h"
 #include "../macros.h"
 #include "../main.h" // utox_audio_thread_init, self, USER_STATUS_*, UTOX_MAX_CALLS
+#include "../queue.h"
 #include "../self.h"
 #include "../settings.h"
 #include "../tox.h"
@@ -362,6 +364,45 @@ static void audio_source_raze(ALuint *source) {
     alDeleteSources((ALuint)1, source);
 }
 
+// Keeps the source of a group call fed with mixed frames, refilling the buffers it's done with.
+static void group_audio_play(GROUPCHAT *g) {
+    ALuint bufids[UTOX_GROUP_AUDIO_BUFFERS];
+
+    ALint processed = 0;
+    alGetSourcei(g->audio_dest, AL_BUFFERS_PROCESSED, &processed);
+    processed = MIN(processed, UTOX_GROUP_AUDIO_BUFFERS - g->audio_buffer_free);
+    if (processed > 0) {
+        alSourceUnqueueBuffers(g->audio_dest, processed, bufids);
+    } else {
+        processed = 0;
+    }
+
+    uint32_t count = processed;
+    while (g->audio_buffer_free) {
+        bufids[count++] = g->audio_buffer[--g->audio_buffer_free];
+    }
+
+    if (!count) {
+        return;
+    }
+
+    int16_t frame[MIXER_FRAME];
+    for (uint32_t i = 0; i < count; ++i) {
+        // Silence is queued too, so the source plays on at a steady pace.
+        pthread_mutex_lock(&group_mixer_lock);
+        mixer_mix(g->mixer, frame);
+        pthread_mutex_unlock(&group_mixer_lock);
+        alBufferData(bufids[i], AL_FORMAT_MONO16, frame, sizeof(frame), MIXER_SAMPLE_RATE);
+    }
+    alSourceQueueBuffers(g->audio_dest, count, bufids);
+
+    ALint state;
+    alGetSourcei(g->audio_dest, AL_SOURCE_STATE, &state);
+    if (state != AL_PLAYING) {
+        alSourcePlay(g->audio_dest);
+    }
+}
+
 enum {
     NOTE_none,
     NOTE_c3_sharp,
@@ -510,21 +551,14 @@ static void generate_tone_friend_new_msg() { generate_melody(friend_new_msg, 1,
 
 static void generate_tone_friend_request() { generate_melody(friend_request, 1, 8, &ToneBuffer); }
 
-void postmessage_audio(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while (audio_thread_msg && utox_audio_thread_init) {
-        yieldcpu(1);
-    }
-
-    audio_msg.msg    = msg;
-    audio_msg.param1 = param1;
-    audio_msg.param2 = param2;
-    audio_msg.data   = data;
+static UTOX_QUEUE audio_queue = UTOX_QUEUE_INIT;
 
-    audio_thread_msg = 1;
+void postmessage_audio(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    queue_post(&audio_queue, msg, param1, param2, data);
 }
 
 // TODO: This function is 300 lines long. Cut it up.
-void utox_audio_thread(void *args) {
+static void utox_audio_thread(void *args) {
     time_t close_device_time = 0;
     ToxAV *av = args;
 
@@ -547,7 +581,8 @@ void utox_audio_thread(void *args) {
 
     utox_audio_thread_init = true;
     while (1) {
-        if (audio_thread_msg) {
+        TOX_MSG audio_msg;
+        if (queue_get(&audio_queue, &audio_msg)) {
             const TOX_MSG *m = &audio_msg;
             if (m->msg == UTOXAUDIO_KILL) {
                 break;
@@ -591,10 +626,17 @@ void utox_audio_thread(void *args) {
                         break;
                     }
 
-                    if (!g->audio_dest) {
-                        audio_source_init(&g->audio_dest);
+                    if (!g->audio_dest && audio_source_init(&g->audio_dest)) {
+                        alSourcei(g->audio_dest, AL_LOOPING, AL_FALSE);
+                        alGenBuffers(UTOX_GROUP_AUDIO_BUFFERS, g->audio_buffer);
+                        g->audio_buffer_free = UTOX_GROUP_AUDIO_BUFFERS;
                     }
 
+                    // Start from what comes in now, not what was left over from before.
+                    pthread_mutex_lock(&group_mixer_lock);
+                    mixer_flush(g->mixer);
+                    pthread_mutex_unlock(&group_mixer_lock);
+
                     audio_out_device_open();
                     audio_in_listen();
                     break;
@@ -606,10 +648,19 @@ void utox_audio_thread(void *args) {
                     }
 
                     if (g->audio_dest) {
+                        alSourceStop(g->audio_dest);
+                        alSourcei(g->audio_dest, AL_BUFFER, 0);
                         audio_source_raze(&g->audio_dest);
                         g->audio_dest = 0;
+
+                        alDeleteBuffers(UTOX_GROUP_AUDIO_BUFFERS, g->audio_buffer);
+                        g->audio_buffer_free = 0;
                     }
 
+                    pthread_mutex_lock(&group_mixer_lock);
+                    mixer_flush(g->mixer);
+                    pthread_mutex_unlock(&group_mixer_lock);
+
                     audio_in_ignore();
                     audio_out_device_close();
                     break;
@@ -693,7 +744,6 @@ void utox_audio_thread(void *args) {
                     audio_out_init();
                 }
             }
-            audio_thread_msg = 0;
 
             if (close_device_time && time(NULL) >= close_device_time) {
                 audio_out_device_close();
@@ -816,8 +866,16 @@ void utox_audio_thread(void *args) {
             }
         }
 
+        for (uint32_t i = 0; i < self.groups_list_size; ++i) {
+            GROUPCHAT *g = get_group(i);
+            if (g && g->audio_dest) {
+                group_audio_play(g);
+            }
+        }
+
         if (sleep) {
-            yieldcpu(50);
+            // With the microphone on, the next frame is due within one frame length.
+            queue_wait(&audio_queue, microphone_on ? UTOX_DEFAULT_FRAME_A : 50);
         }
     }
 
@@ -831,16 +889,23 @@ void utox_audio_thread(void *args) {
     while (audio_in_device_close()) { continue; }
     while (audio_out_device_close()) {continue; }
 
-    audio_thread_msg       = 0;
+    queue_close(&audio_queue);
     utox_audio_thread_init = false;
     free(preview_buffer);
 }
 
+void utox_audio_thread_start(void *av) {
+    // Opened before the thread starts, so nothing posted while the devices are set up is dropped.
+    queue_open(&audio_queue);
+    thread(utox_audio_thread, av);
+}
+
 void callback_av_group_audio(void *UNUSED(tox), int groupnumber, int peernumber, const int16_t *pcm, unsigned int samples,
                              uint8_t channels, unsigned int sample_rate, void *UNUSED(userdata))
 {
     GROUPCHAT *g = get_group(groupnumber);
     if (!g || !g->active_call) {
+        // Dropped, or it'd sit in the jitter buffer and play once the call starts.
         return;
     }
 
@@ -852,36 +917,13 @@ void callback_av_group_audio(void *UNUSED(tox), int groupnumber, int peernumber,
 
     g->last_recv_audio[peernumber] = time;
 
-    if (channels < 1 || channels > 2 || g->muted) {
-        return;
-    }
-
-    ALuint bufid;
-    ALint processed = 0, queued = 16;
-    alGetSourcei(g->source[peernumber], AL_BUFFERS_PROCESSED, &processed);
-    alGetSourcei(g->source[peernumber], AL_BUFFERS_QUEUED, &queued);
-    alSourcei(g->source[peernumber], AL_LOOPING, AL_FALSE);
-
-    if (processed) {
-        ALuint bufids[processed];
-        alSourceUnqueueBuffers(g->source[peernumber], processed, bufids);
-        alDeleteBuffers(processed - 1, bufids + 1);
-        bufid = bufids[0];
-    } else if(queued < 16) {
-        alGenBuffers(1, &bufid);
-    } else {
+    if (g->muted) {
         return;
     }
 
-    alBufferData(bufid, (channels == 1) ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16,
-                 pcm, samples * 2 * channels, sample_rate);
-    alSourceQueueBuffers(g->source[peernumber], 1, &bufid);
-
-    ALint state;
-    alGetSourcei(g->source[peernumber], AL_SOURCE_STATE, &state);
-    if (state != AL_PLAYING) {
-        alSourcePlay(g->source[peernumber]);
-    }
+    pthread_mutex_lock(&group_mixer_lock);
+    mixer_push(g->mixer, peernumber, pcm, samples, channels, sample_rate);
+    pthread_mutex_unlock(&group_mixer_lock);
 }
 
 void group_av_peer_add(GROUPCHAT *g, int peernumber) {
@@ -889,7 +931,10 @@ void group_av_peer_add(GROUPCHAT *g, int peernumber) {
         return;
     }
 
-    alGenSources(1, &g->source[peernumber]);
+    // Whoever had this number before is gone, don't play what's left of them.
+    pthread_mutex_lock(&group_mixer_lock);
+    mixer_peer_remove(g->mixer, peernumber);
+    pthread_mutex_unlock(&group_mixer_lock);
 }
 
 void group_av_peer_remove(GROUPCHAT *g, int peernumber) {
@@ -897,5 +942,7 @@ void group_av_peer_remove(GROUPCHAT *g, int peernumber) {
         return;
     }
 
-    alDeleteSources(1, &g->source[peernumber]);
+    pthread_mutex_lock(&group_mixer_lock);
+    mixer_peer_remove(g->mixer, peernumber);
+    pthread_mutex_unlock(&group_mixer_lock);
 }
@@ -81,6 +81,8 @@ void sourceplaybuffer(unsigned int i, const int16_t *data, int samples, uint8_t
  */
 void postmessage_audio(uint8_t msg, uint32_t param1, uint32_t param2, void *data);
 
-void utox_audio_thread(void *args);
+/* Starts the audio thread with the ToxAV instance av. Messages posted from now on are kept for it,
+ * until it's told to quit. */
+void utox_audio_thread_start(void *av);
 
 #endif
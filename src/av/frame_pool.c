@@ -0,0 +1,123 @@
+#include "video.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/* Video only ever comes at a few resolutions at once: the preview and one per call. A free list
+ * is kept for each of the FRAME_POOL_SIZES used most recently, holding up to FRAME_POOL_KEEP
+ * frames, which covers a frame being drawn, one being decoded and one waiting in between. */
+#define FRAME_POOL_SIZES 8
+#define FRAME_POOL_KEEP 4
+
+typedef struct frame_pool_list {
+    uint16_t w, h;
+    uint64_t used;
+
+    UTOX_FRAME_PKG *free;
+    uint32_t        count;
+} FRAME_POOL_LIST;
+
+// Held for the free lists and the reference counts, frames move between the threads.
+static pthread_mutex_t frame_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FRAME_POOL_LIST frame_pool[FRAME_POOL_SIZES];
+static uint64_t        frame_pool_clock;
+
+/* Returns the free list for w x h, emptying the one used longest ago for it if there's none. Call
+ * with the lock held. */
+static FRAME_POOL_LIST *frame_pool_list(uint16_t w, uint16_t h) {
+    FRAME_POOL_LIST *list = &frame_pool[0];
+
+    for (int i = 0; i < FRAME_POOL_SIZES; ++i) {
+        if (frame_pool[i].w == w && frame_pool[i].h == h) {
+            list = &frame_pool[i];
+            list->used = ++frame_pool_clock;
+            return list;
+        }
+
+        if (frame_pool[i].used < list->used) {
+            list = &frame_pool[i];
+        }
+    }
+
+    while (list->free) {
+        UTOX_FRAME_PKG *next = list->free->next;
+        free(list->free);
+        list->free = next;
+    }
+
+    list->w     = w;
+    list->h     = h;
+    list->used  = ++frame_pool_clock;
+    list->count = 0;
+    return list;
+}
+
+UTOX_FRAME_PKG *frame_get(uint16_t w, uint16_t h) {
+    if (!w || !h) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&frame_pool_lock);
+
+    FRAME_POOL_LIST *list  = frame_pool_list(w, h);
+    UTOX_FRAME_PKG  *frame = list->free;
+    if (frame) {
+        list->free = frame->next;
+        list->count--;
+    }
+
+    pthread_mutex_unlock(&frame_pool_lock);
+
+    if (!frame) {
+        // The image goes right after the frame, one allocation for both.
+        const size_t size = (size_t)w * h * 4;
+
+        frame = malloc(sizeof(UTOX_FRAME_PKG) + size);
+        if (!frame) {
+            return NULL;
+        }
+
+        frame->w    = w;
+        frame->h    = h;
+        frame->size = size;
+        frame->img  = frame + 1;
+    }
+
+    frame->refs = 1;
+    frame->next = NULL;
+    return frame;
+}
+
+UTOX_FRAME_PKG *frame_ref(UTOX_FRAME_PKG *frame) {
+    pthread_mutex_lock(&frame_pool_lock);
+    frame->refs++;
+    pthread_mutex_unlock(&frame_pool_lock);
+
+    return frame;
+}
+
+void frame_unref(UTOX_FRAME_PKG *frame) {
+    if (!frame) {
+        return;
+    }
+
+    pthread_mutex_lock(&frame_pool_lock);
+
+    if (--frame->refs) {
+        pthread_mutex_unlock(&frame_pool_lock);
+        return;
+    }
+
+    FRAME_POOL_LIST *list = frame_pool_list(frame->w, frame->h);
+    if (list->count < FRAME_POOL_KEEP) {
+        frame->next = list->free;
+        list->free  = frame;
+        list->count++;
+        frame = NULL;
+    }
+
+    pthread_mutex_unlock(&frame_pool_lock);
+
+    free(frame);
+}
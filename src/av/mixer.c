@@ -0,0 +1,284 @@
+#include "mixer.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Gains are 8.8 fixed point.
+#define MIXER_GAIN_ONE 256
+#define MIXER_GAIN_MAX (MIXER_GAIN_ONE * 16)
+
+typedef struct mixer_peer {
+    // Ring buffer of samples, count of them starting at read.
+    int16_t  samples[MIXER_JITTER_SIZE];
+    uint32_t read, count;
+
+    int32_t gain;
+    bool    playing;
+
+    // Samples mixer_mix() takes for the frame it's mixing.
+    uint32_t frame_samples;
+} MIXER_PEER;
+
+struct mixer {
+    // Held by mixer_push() on the toxcore thread and mixer_mix() on the audio thread.
+    pthread_mutex_t lock;
+
+    uint32_t     max_peers;
+    MIXER_PEER **peer;
+};
+
+MIXER *mixer_new(uint32_t max_peers) {
+    MIXER *mixer = calloc(1, sizeof(MIXER));
+    if (!mixer) {
+        return NULL;
+    }
+
+    mixer->peer = calloc(max_peers, sizeof(MIXER_PEER *));
+    if (!mixer->peer) {
+        free(mixer);
+        return NULL;
+    }
+
+    mixer->max_peers = max_peers;
+    pthread_mutex_init(&mixer->lock, NULL);
+    return mixer;
+}
+
+void mixer_free(MIXER *mixer) {
+    if (!mixer) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < mixer->max_peers; ++i) {
+        free(mixer->peer[i]);
+    }
+    free(mixer->peer);
+
+    pthread_mutex_destroy(&mixer->lock);
+    free(mixer);
+}
+
+// Returns the peer, making it if it's new. Call with the lock held.
+static MIXER_PEER *mixer_peer(MIXER *mixer, uint32_t peer) {
+    if (peer >= mixer->max_peers) {
+        return NULL;
+    }
+
+    if (!mixer->peer[peer]) {
+        mixer->peer[peer] = calloc(1, sizeof(MIXER_PEER));
+        if (!mixer->peer[peer]) {
+            return NULL;
+        }
+        mixer->peer[peer]->gain = MIXER_GAIN_ONE;
+    }
+
+    return mixer->peer[peer];
+}
+
+static int16_t mixer_sample(const MIXER_PEER *p, uint32_t i) {
+    return p->samples[(p->read + i) % MIXER_JITTER_SIZE];
+}
+
+static void mixer_append(MIXER_PEER *p, int16_t sample) {
+    if (p->count == MIXER_JITTER_SIZE) {
+        // Too far behind, skip the oldest audio rather than fall further behind.
+        p->read = (p->read + 1) % MIXER_JITTER_SIZE;
+        p->count--;
+    }
+
+    p->samples[(p->read + p->count++) % MIXER_JITTER_SIZE] = sample;
+}
+
+// Returns sample i of pcm as mono.
+static int32_t mixer_mono(const int16_t *pcm, uint32_t i, uint8_t channels) {
+    return channels == 2 ? (pcm[i * 2] + pcm[i * 2 + 1]) / 2 : pcm[i];
+}
+
+bool mixer_push(MIXER *mixer, uint32_t peer, const int16_t *pcm, unsigned int samples, uint8_t channels,
+                unsigned int sample_rate)
+{
+    if (!mixer || !pcm || !samples || channels < 1 || channels > 2 || !sample_rate) {
+        return false;
+    }
+
+    pthread_mutex_lock(&mixer->lock);
+
+    MIXER_PEER *p = mixer_peer(mixer, peer);
+    if (!p) {
+        pthread_mutex_unlock(&mixer->lock);
+        return false;
+    }
+
+    if (sample_rate == MIXER_SAMPLE_RATE) {
+        for (uint32_t i = 0; i < samples; ++i) {
+            mixer_append(p, mixer_mono(pcm, i, channels));
+        }
+    } else {
+        // Linear interpolation between the input samples, positions in 16.16 fixed point.
+        const uint64_t step  = ((uint64_t)sample_rate << 16) / MIXER_SAMPLE_RATE;
+        const uint64_t count = ((uint64_t)samples * MIXER_SAMPLE_RATE) / sample_rate;
+
+        for (uint64_t i = 0; i < count; ++i) {
+            const uint64_t position = i * step;
+            const uint32_t index    = position >> 16;
+            const int32_t  fraction = position & 0xFFFF;
+
+            const int32_t a = mixer_mono(pcm, index, channels);
+            const int32_t b = index + 1 < samples ? mixer_mono(pcm, index + 1, channels) : a;
+
+            mixer_append(p, a + (((b - a) * fraction) >> 16));
+        }
+    }
+
+    pthread_mutex_unlock(&mixer->lock);
+    return true;
+}
+
+void mixer_set_gain(MIXER *mixer, uint32_t peer, float gain) {
+    if (!mixer) {
+        return;
+    }
+
+    pthread_mutex_lock(&mixer->lock);
+
+    MIXER_PEER *p = mixer_peer(mixer, peer);
+    if (p) {
+        const float fixed = gain * MIXER_GAIN_ONE;
+        p->gain = fixed < 0 ? 0 : fixed > MIXER_GAIN_MAX ? MIXER_GAIN_MAX : (int32_t)fixed;
+    }
+
+    pthread_mutex_unlock(&mixer->lock);
+}
+
+void mixer_peer_remove(MIXER *mixer, uint32_t peer) {
+    if (!mixer || peer >= mixer->max_peers) {
+        return;
+    }
+
+    pthread_mutex_lock(&mixer->lock);
+    free(mixer->peer[peer]);
+    mixer->peer[peer] = NULL;
+    pthread_mutex_unlock(&mixer->lock);
+}
+
+void mixer_flush(MIXER *mixer) {
+    if (!mixer) {
+        return;
+    }
+
+    pthread_mutex_lock(&mixer->lock);
+    for (uint32_t i = 0; i < mixer->max_peers; ++i) {
+        MIXER_PEER *p = mixer->peer[i];
+        if (p) {
+            p->read    = 0;
+            p->count   = 0;
+            p->playing = false;
+        }
+    }
+    pthread_mutex_unlock(&mixer->lock);
+}
+
+void mixer_peer_move(MIXER *mixer, uint32_t from, uint32_t to) {
+    if (!mixer || from >= mixer->max_peers || to >= mixer->max_peers || from == to) {
+        return;
+    }
+
+    pthread_mutex_lock(&mixer->lock);
+    free(mixer->peer[to]);
+    mixer->peer[to]   = mixer->peer[from];
+    mixer->peer[from] = NULL;
+    pthread_mutex_unlock(&mixer->lock);
+}
+
+bool mixer_mix(MIXER *mixer, int16_t *out) {
+    memset(out, 0, MIXER_FRAME * sizeof(int16_t));
+
+    if (!mixer) {
+        return false;
+    }
+
+    pthread_mutex_lock(&mixer->lock);
+
+    // Find the loudest peers with audio for this frame, loudest first.
+    MIXER_PEER *speaker[MIXER_MAX_SPEAKERS];
+    uint64_t    speaker_energy[MIXER_MAX_SPEAKERS];
+    uint32_t    speakers = 0;
+
+    for (uint32_t i = 0; i < mixer->max_peers; ++i) {
+        MIXER_PEER *p = mixer->peer[i];
+        if (!p) {
+            continue;
+        }
+
+        p->frame_samples = 0;
+
+        if (!p->playing) {
+            if (p->count < MIXER_JITTER_TARGET) {
+                continue;
+            }
+            p->playing = true;
+        }
+
+        p->frame_samples = p->count < MIXER_FRAME ? p->count : MIXER_FRAME;
+
+        uint64_t energy = 0;
+        for (uint32_t j = 0; j < p->frame_samples; ++j) {
+            energy += abs(mixer_sample(p, j));
+        }
+        energy *= p->gain;
+
+        uint32_t place = speakers;
+        while (place && speaker_energy[place - 1] < energy) {
+            --place;
+        }
+
+        if (place == MIXER_MAX_SPEAKERS) {
+            continue;
+        }
+
+        const uint32_t moved = (speakers < MIXER_MAX_SPEAKERS ? speakers : MIXER_MAX_SPEAKERS - 1) - place;
+        memmove(&speaker[place + 1], &speaker[place], moved * sizeof(*speaker));
+        memmove(&speaker_energy[place + 1], &speaker_energy[place], moved * sizeof(*speaker_energy));
+
+        speaker[place]        = p;
+        speaker_energy[place] = energy;
+        if (speakers < MIXER_MAX_SPEAKERS) {
+            speakers++;
+        }
+    }
+
+    int32_t mix[MIXER_FRAME] = { 0 };
+    for (uint32_t i = 0; i < speakers; ++i) {
+        const MIXER_PEER *p = speaker[i];
+        for (uint32_t j = 0; j < p->frame_samples; ++j) {
+            mix[j] += (mixer_sample(p, j) * p->gain) / MIXER_GAIN_ONE;
+        }
+    }
+
+    /* Everyone playing moves on by a frame, mixed or not, so they stay in step. A peer that ran dry
+     * goes back to buffering. */
+    bool playing = false;
+    for (uint32_t i = 0; i < mixer->max_peers; ++i) {
+        MIXER_PEER *p = mixer->peer[i];
+        if (!p || !p->playing) {
+            continue;
+        }
+
+        playing |= p->frame_samples > 0;
+
+        p->read = (p->read + p->frame_samples) % MIXER_JITTER_SIZE;
+        p->count -= p->frame_samples;
+        if (p->frame_samples < MIXER_FRAME) {
+            p->playing = false;
+        }
+    }
+
+    pthread_mutex_unlock(&mixer->lock);
+
+    for (uint32_t i = 0; i < MIXER_FRAME; ++i) {
+        out[i] = mix[i] > INT16_MAX ? INT16_MAX : mix[i] < INT16_MIN ? INT16_MIN : mix[i];
+    }
+
+    return playing;
+}
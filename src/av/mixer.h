@@ -0,0 +1,59 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+#include "audio.h" // UTOX_DEFAULT_*_A
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Mixes the audio of the peers in a group call into one stream, so the whole call plays through a
+ * single OpenAL source.
+ *
+ * Every peer gets a jitter buffer that mixer_push() fills from the toxcore thread and mixer_mix()
+ * drains a frame at a time from the audio thread. A peer only starts playing once it has
+ * MIXER_JITTER_TARGET samples buffered, and goes back to buffering when it runs dry. Of the peers
+ * playing, only the MIXER_MAX_SPEAKERS loudest are mixed into each frame. */
+
+// Mixed frames are mono, at the rate and frame length we send at.
+#define MIXER_SAMPLE_RATE UTOX_DEFAULT_SAMPLE_RATE_A
+#define MIXER_FRAME ((UTOX_DEFAULT_FRAME_A * UTOX_DEFAULT_SAMPLE_RATE_A) / 1000)
+
+// Samples a peer can have buffered, the oldest are dropped past that.
+#define MIXER_JITTER_SIZE (MIXER_FRAME * 16)
+// Samples a peer needs buffered before it starts playing.
+#define MIXER_JITTER_TARGET (MIXER_FRAME * 3)
+
+#define MIXER_MAX_SPEAKERS 4
+
+typedef struct mixer MIXER;
+
+// Returns NULL on failure.
+MIXER *mixer_new(uint32_t max_peers);
+
+void mixer_free(MIXER *mixer);
+
+/* Adds samples of audio from peer to its jitter buffer, downmixing stereo and resampling to
+ * MIXER_SAMPLE_RATE as needed.
+ *
+ * Returns false if peer is out of range or there's no memory for it. */
+bool mixer_push(MIXER *mixer, uint32_t peer, const int16_t *pcm, unsigned int samples, uint8_t channels,
+                unsigned int sample_rate);
+
+/* Scales the audio of peer by gain, 1.0 being unchanged. */
+void mixer_set_gain(MIXER *mixer, uint32_t peer, float gain);
+
+/* Drops everything buffered for peer, and its gain. */
+void mixer_peer_remove(MIXER *mixer, uint32_t peer);
+
+/* Drops everything buffered for every peer, their gains are kept. */
+void mixer_flush(MIXER *mixer);
+
+/* Renumbers peer from to to, replacing whatever was there. */
+void mixer_peer_move(MIXER *mixer, uint32_t from, uint32_t to);
+
+/* Mixes the next MIXER_FRAME samples into out.
+ *
+ * Returns false if no one was playing, in which case out is silence. */
+bool mixer_mix(MIXER *mixer, int16_t *out);
+
+#endif
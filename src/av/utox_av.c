@@ -8,6 +8,7 @@
 #include "../groups.h"
 #include "../inline_video.h"
 #include "../macros.h"
+#include "../queue.h"
 #include "../tox.h"
 #include "../utox.h"
 
@@ -18,22 +19,13 @@
 
 bool utox_av_ctrl_init = false;
 
-static bool toxav_thread_msg = 0;
+static UTOX_QUEUE toxav_queue = UTOX_QUEUE_INIT;
 
 void postmessage_utoxav(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while (toxav_thread_msg && utox_av_ctrl_init) { /* I'm not convinced this is the best way */
-        yieldcpu(1);
-    }
-
-    toxav_msg.msg    = msg;
-    toxav_msg.param1 = param1;
-    toxav_msg.param2 = param2;
-    toxav_msg.data   = data;
-
-    toxav_thread_msg = 1;
+    queue_post(&toxav_queue, msg, param1, param2, data);
 }
 
-void utox_av_ctrl_thread(void *UNUSED(args)) {
+static void utox_av_ctrl_thread(void *UNUSED(args)) {
     ToxAV *av = NULL;
 
     utox_av_ctrl_init = 1;
@@ -43,7 +35,8 @@ void utox_av_ctrl_thread(void *UNUSED(args)) {
     // volatile bool video_on  = 0;
 
     while (1) {
-        if (toxav_thread_msg) {
+        TOX_MSG toxav_msg;
+        if (queue_get(&toxav_queue, &toxav_msg)) {
             TOX_MSG *msg = &toxav_msg;
             if (msg->msg == UTOXAV_KILL) {
                 break;
@@ -53,8 +46,8 @@ void utox_av_ctrl_thread(void *UNUSED(args)) {
                     postmessage_audio(UTOXAUDIO_NEW_AV_INSTANCE, 0, 0, msg->data);
                     postmessage_video(UTOXVIDEO_NEW_AV_INSTANCE, 0, 0, msg->data);
                 } else {
-                    thread(utox_audio_thread, msg->data);
-                    thread(utox_video_thread, msg->data);
+                    utox_audio_thread_start(msg->data);
+                    utox_video_thread_start(msg->data);
                 }
 
                 av = msg->data;
@@ -222,13 +215,11 @@ void utox_av_ctrl_thread(void *UNUSED(args)) {
             }
         }
 
-        toxav_thread_msg = false;
-
         if (av) {
             toxav_iterate(av);
-            yieldcpu(toxav_iteration_interval(av));
+            queue_wait(&toxav_queue, toxav_iteration_interval(av));
         } else {
-            yieldcpu(10);
+            queue_wait(&toxav_queue, UTOX_QUEUE_FOREVER);
         }
     }
 
@@ -241,12 +232,17 @@ void utox_av_ctrl_thread(void *UNUSED(args)) {
         yieldcpu(1);
     }
 
-    toxav_thread_msg  = false;
+    queue_close(&toxav_queue);
     utox_av_ctrl_init = false;
 
     toxav_kill(av);
 }
 
+void utox_av_ctrl_thread_start(void) {
+    queue_open(&toxav_queue);
+    thread(utox_av_ctrl_thread, NULL);
+}
+
 static void utox_av_incoming_call(ToxAV *UNUSED(av), uint32_t friend_number,
                                   bool audio, bool video, void *UNUSED(userdata))
 {
@@ -350,21 +346,18 @@ static void utox_av_incoming_frame_v(ToxAV *UNUSED(toxAV), uint32_t friend_numbe
     }
     f->video_width  = width;
     f->video_height = height;
-    size_t size     = width * height * 4;
 
-    UTOX_FRAME_PKG *frame = calloc(1, sizeof(UTOX_FRAME_PKG));
-    frame->w    = width;
-    frame->h    = height;
-    frame->size = size;
-    frame->img  = malloc(size);
+    UTOX_FRAME_PKG *frame = frame_get(width, height);
+    if (!frame) {
+        return;
+    }
 
     yuv420tobgr(width, height, y, u, v, ystride, ustride, vstride, frame->img);
     if (f->video_inline) {
-        inline_set_frame(width, height, size, frame->img);
+        inline_set_frame(frame);
+        frame_unref(frame);
 
         postmessage_utox(AV_INLINE_FRAME, friend_number, 0, NULL);
-        free(frame->img);
-        free(frame);
     } else {
         postmessage_utox(AV_VIDEO_FRAME, friend_number, 0, (void *)frame);
     }
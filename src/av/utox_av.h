@@ -61,7 +61,8 @@ typedef struct groupchat GROUPCHAT;
  */
 void postmessage_utoxav(uint8_t msg, uint32_t param1, uint32_t param2, void *data);
 
-void utox_av_ctrl_thread(void *args);
+/* Starts the toxav thread. Messages posted from now on are kept for it, until it's told to quit. */
+void utox_av_ctrl_thread_start(void);
 
 void utox_av_local_disconnect(ToxAV *av, int32_t friend_number);
 
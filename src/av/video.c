@@ -4,6 +4,7 @@
 
 #include "../friend.h"
 #include "../macros.h"
+#include "../queue.h"
 #include "../self.h"
 #include "../settings.h"
 #include "../tox.h"
@@ -196,18 +197,10 @@ bool utox_video_stop(bool UNUSED(preview)) {
     return true;
 }
 
-static TOX_MSG video_msg;
-void postmessage_video(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while (video_thread_msg) {
-        yieldcpu(1);
-    }
-
-    video_msg.msg    = msg;
-    video_msg.param1 = param1;
-    video_msg.param2 = param2;
-    video_msg.data   = data;
+static UTOX_QUEUE video_queue = UTOX_QUEUE_INIT;
 
-    video_thread_msg = true;
+void postmessage_video(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    queue_post(&video_queue, msg, param1, param2, data);
 }
 
 // Populates the video device dropdown.
@@ -227,7 +220,7 @@ static void init_video_devices(void) {
     }
 }
 
-void utox_video_thread(void *args) {
+static void utox_video_thread(void *args) {
     ToxAV *av = args;
 
     pthread_mutex_init(&video_thread_lock, NULL);
@@ -237,7 +230,8 @@ void utox_video_thread(void *args) {
     utox_video_thread_init = 1;
 
     while (1) {
-        if (video_thread_msg) {
+        TOX_MSG video_msg;
+        if (queue_get(&video_queue, &video_msg)) {
             if (!video_msg.msg || video_msg.msg == UTOXVIDEO_KILL) {
                 break;
             }
@@ -249,7 +243,6 @@ void utox_video_thread(void *args) {
                     break;
                 }
             }
-            video_thread_msg = false;
         }
 
         if (video_active) {
@@ -260,16 +253,14 @@ void utox_video_thread(void *args) {
             if (r == 1) {
                 if (settings.video_preview) {
                     /* Make a copy of the video frame for uTox to display */
-                    UTOX_FRAME_PKG *frame = malloc(sizeof(UTOX_FRAME_PKG));
-                    frame->w              = utox_video_frame.w;
-                    frame->h              = utox_video_frame.h;
-                    frame->img            = malloc(utox_video_frame.w * utox_video_frame.h * 4);
-
-                    yuv420tobgr(utox_video_frame.w, utox_video_frame.h, utox_video_frame.y, utox_video_frame.u,
-                                utox_video_frame.v, utox_video_frame.w, (utox_video_frame.w / 2),
-                                (utox_video_frame.w / 2), frame->img);
+                    UTOX_FRAME_PKG *frame = frame_get(utox_video_frame.w, utox_video_frame.h);
+                    if (frame) {
+                        yuv420tobgr(utox_video_frame.w, utox_video_frame.h, utox_video_frame.y,
+                                    utox_video_frame.u, utox_video_frame.v, utox_video_frame.w,
+                                    (utox_video_frame.w / 2), (utox_video_frame.w / 2), frame->img);
 
-                    postmessage_utox(AV_VIDEO_FRAME, UINT16_MAX, 1, (void *)frame);
+                        postmessage_utox(AV_VIDEO_FRAME, UINT16_MAX, 1, (void *)frame);
+                    }
                 }
 
                 size_t active_video_count = 0;
@@ -293,11 +284,11 @@ void utox_video_thread(void *args) {
             }
 
             pthread_mutex_unlock(&video_thread_lock);
-            yieldcpu(40); /* 60fps = 16.666ms || 25 fps = 40ms || the data quality is SO much better at 25... */
-            continue;     /* We're running video, so don't sleep for an extra 100 ms */
+            queue_wait(&video_queue, 40); /* 60fps = 16.666ms || 25 fps = 40ms || the data quality is SO much better at 25... */
+            continue;                     /* We're running video, so don't sleep for an extra 100 ms */
         }
 
-        yieldcpu(100);
+        queue_wait(&video_queue, 100);
     }
 
     video_device_count   = 0;
@@ -308,152 +299,14 @@ void utox_video_thread(void *args) {
         video_device[i] = NULL;
     }
 
-    video_thread_msg       = 0;
+    queue_close(&video_queue);
     utox_video_thread_init = 0;
 }
 
-void yuv420tobgr(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u, const uint8_t *v,
-                 unsigned int ystride, unsigned int ustride, unsigned int vstride, uint8_t *out)
-{
-    for (unsigned long int i = 0; i < height; ++i) {
-        for (unsigned long int j = 0; j < width; ++j) {
-            uint8_t *point = out + 4 * ((i * width) + j);
-            int       t_y   = y[((i * ystride) + j)];
-            const int t_u   = u[(((i / 2) * ustride) + (j / 2))];
-            const int t_v   = v[(((i / 2) * vstride) + (j / 2))];
-            t_y            = t_y < 16 ? 16 : t_y;
-
-            const int r = (298 * (t_y - 16) + 409 * (t_v - 128) + 128) >> 8;
-            const int g = (298 * (t_y - 16) - 100 * (t_u - 128) - 208 * (t_v - 128) + 128) >> 8;
-            const int b = (298 * (t_y - 16) + 516 * (t_u - 128) + 128) >> 8;
-
-            point[2] = r > 255 ? 255 : r < 0 ? 0 : r;
-            point[1] = g > 255 ? 255 : g < 0 ? 0 : g;
-            point[0] = b > 255 ? 255 : b < 0 ? 0 : b;
-            point[3] = ~0;
-        }
-    }
-}
-
-void yuv422to420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *input, uint16_t width, uint16_t height) {
-    const uint8_t *end = input + width * height * 2;
-    while (input != end) {
-        uint8_t *line_end = input + width * 2;
-        while (input != line_end) {
-            *plane_y++ = *input++;
-            *plane_v++ = *input++;
-            *plane_y++ = *input++;
-            *plane_u++ = *input++;
-        }
-
-        line_end = input + width * 2;
-        while (input != line_end) {
-            *plane_y++ = *input++;
-            input++; // u
-            *plane_y++ = *input++;
-            input++; // v
-        }
-    }
-}
-
-static uint8_t rgb_to_y(int r, int g, int b) {
-    const int y = ((9798 * r + 19235 * g + 3736 * b) >> 15);
-    return y > 255 ? 255 : y < 0 ? 0 : y;
-}
-
-static uint8_t rgb_to_u(int r, int g, int b) {
-    const int u = ((-5538 * r + -10846 * g + 16351 * b) >> 15) + 128;
-    return u > 255 ? 255 : u < 0 ? 0 : u;
-}
-
-static uint8_t rgb_to_v(int r, int g, int b) {
-    const int v = ((16351 * r + -13697 * g + -2664 * b) >> 15) + 128;
-    return v > 255 ? 255 : v < 0 ? 0 : v;
-}
-
-void bgrtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height) {
-    uint8_t *p;
-    uint8_t  r, g, b;
-
-    for (uint16_t y = 0; y != height; y += 2) {
-        p = rgb;
-        for (uint16_t x = 0; x != width; x++) {
-            b          = *rgb++;
-            g          = *rgb++;
-            r          = *rgb++;
-            *plane_y++ = rgb_to_y(r, g, b);
-        }
-
-        for (uint16_t x = 0; x != width / 2; x++) {
-            b          = *rgb++;
-            g          = *rgb++;
-            r          = *rgb++;
-            *plane_y++ = rgb_to_y(r, g, b);
-
-            b          = *rgb++;
-            g          = *rgb++;
-            r          = *rgb++;
-            *plane_y++ = rgb_to_y(r, g, b);
-
-            b = ((int)b + (int)*(rgb - 6) + (int)*p + (int)*(p + 3) + 2) / 4;
-            p++;
-            g = ((int)g + (int)*(rgb - 5) + (int)*p + (int)*(p + 3) + 2) / 4;
-            p++;
-            r = ((int)r + (int)*(rgb - 4) + (int)*p + (int)*(p + 3) + 2) / 4;
-            p++;
-
-            *plane_u++ = rgb_to_u(r, g, b);
-            *plane_v++ = rgb_to_v(r, g, b);
-
-            p += 3;
-        }
-    }
-}
-
-void bgrxtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height) {
-    uint8_t *p;
-    uint8_t  r, g, b;
-
-    for (uint16_t y = 0; y != height; y += 2) {
-        p = rgb;
-        for (uint16_t x = 0; x != width; x++) {
-            b = *rgb++;
-            g = *rgb++;
-            r = *rgb++;
-            rgb++;
-
-            *plane_y++ = rgb_to_y(r, g, b);
-        }
-
-        for (uint16_t x = 0; x != width / 2; x++) {
-            b = *rgb++;
-            g = *rgb++;
-            r = *rgb++;
-            rgb++;
-
-            *plane_y++ = rgb_to_y(r, g, b);
-
-            b = *rgb++;
-            g = *rgb++;
-            r = *rgb++;
-            rgb++;
-
-            *plane_y++ = rgb_to_y(r, g, b);
-
-            b = ((int)b + (int)*(rgb - 8) + (int)*p + (int)*(p + 4) + 2) / 4;
-            p++;
-            g = ((int)g + (int)*(rgb - 7) + (int)*p + (int)*(p + 4) + 2) / 4;
-            p++;
-            r = ((int)r + (int)*(rgb - 6) + (int)*p + (int)*(p + 4) + 2) / 4;
-            p++;
-            p++;
-
-            *plane_u++ = rgb_to_u(r, g, b);
-            *plane_v++ = rgb_to_v(r, g, b);
-
-            p += 4;
-        }
-    }
+void utox_video_thread_start(void *av) {
+    // Opened before the thread starts, so nothing posted while the devices are set up is dropped.
+    queue_open(&video_queue);
+    thread(utox_video_thread, av);
 }
 
 void scale_rgbx_image(uint8_t *old_rgbx, uint16_t old_width, uint16_t old_height, uint8_t *new_rgbx, uint16_t new_width,
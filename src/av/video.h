@@ -35,8 +35,25 @@ typedef struct utox_frame_pkg {
     size_t size;
 
     void *img;
+
+    // Owned by the frame pool, see frame_get().
+    uint32_t refs;
+    struct utox_frame_pkg *next;
 } UTOX_FRAME_PKG;
 
+/* Returns a w x h BGRX frame holding one reference, NULL on failure.
+ *
+ * Frames come from a free list for their resolution and go back to it when the last reference is
+ * dropped, so once video is playing no more memory gets allocated for it. The image is
+ * uninitialized. */
+UTOX_FRAME_PKG *frame_get(uint16_t w, uint16_t h);
+
+/* Takes another reference to frame, returning it. */
+UTOX_FRAME_PKG *frame_ref(UTOX_FRAME_PKG *frame);
+
+/* Drops a reference to frame, handing it back to the pool after the last one. Accepts NULL. */
+void frame_unref(UTOX_FRAME_PKG *frame);
+
 void utox_video_append_device(void *device, bool localized, void *name, bool default_);
 
 bool utox_video_change_device(uint16_t i);
@@ -44,7 +61,9 @@ bool utox_video_change_device(uint16_t i);
 bool utox_video_start(bool preview);
 bool utox_video_stop(bool preview);
 
-void utox_video_thread(void *args);
+/* Starts the video thread with the ToxAV instance av. Messages posted from now on are kept for it,
+ * until it's told to quit. */
+void utox_video_thread_start(void *av);
 
 void postmessage_video(uint8_t msg, uint32_t param1, uint32_t param2, void *data);
 
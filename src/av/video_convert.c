@@ -0,0 +1,619 @@
+#include "video.h"
+
+#include <string.h>
+
+/* Colour conversion kernels for video frames.
+ *
+ * Every kernel has a plain C version and, on x86, SSE2 and (where it helps) AVX2 versions picked at
+ * runtime from what the CPU supports. They all give exactly the same output. Frames going to the
+ * encoder have even widths and heights. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VIDEO_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+/* Converts width pixels of two rows of YUV420 that share the chroma row u, v into BGRX.
+ * y1 and out1 are NULL for the last row of a frame with an odd height. */
+typedef void YUV420_ROWS(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+                         uint8_t *out0, uint8_t *out1, unsigned int width);
+
+static uint8_t clamp_u8(int x) {
+    return x > 255 ? 255 : x < 0 ? 0 : x;
+}
+
+static void yuv420_pixel(uint8_t *out, int y, int r, int g, int b) {
+    y = 298 * ((y < 16 ? 16 : y) - 16) + 128;
+
+    out[0] = clamp_u8((y + b) >> 8);
+    out[1] = clamp_u8((y + g) >> 8);
+    out[2] = clamp_u8((y + r) >> 8);
+    out[3] = ~0;
+}
+
+// Converts pixels from x up to width, the ones left over by the SIMD kernels.
+static void yuv420_rows_c_from(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+                               uint8_t *out0, uint8_t *out1, unsigned int x, unsigned int width)
+{
+    for (; x < width; ++x) {
+        const int t_u = u[x / 2] - 128;
+        const int t_v = v[x / 2] - 128;
+
+        const int r = 409 * t_v;
+        const int g = -100 * t_u - 208 * t_v;
+        const int b = 516 * t_u;
+
+        yuv420_pixel(out0 + x * 4, y0[x], r, g, b);
+        if (y1) {
+            yuv420_pixel(out1 + x * 4, y1[x], r, g, b);
+        }
+    }
+}
+
+static void yuv420_rows_c(const uint8_t *y0, const uint8_t *y1, const uint8_t *u, const uint8_t *v,
+                          uint8_t *out0, uint8_t *out1, unsigned int width)
+{
+    yuv420_rows_c_from(y0, y1, u, v, out0, out1, 0, width);
+}
+
+#ifdef VIDEO_CONVERT_X86
+/* The SIMD kernels work in 32 bits with pmaddwd on pairs of 16 bit values: luma is paired with 1 to
+ * get 298 * (y - 16) + 128 in one go, and u with v for each chroma term. */
+#define PAIR16(lo, hi) ((int32_t)((uint32_t)(uint16_t)(hi) << 16 | (uint16_t)(lo)))
+
+// Packs 8 pixels worth of 16 bit b, g and r into BGRX at out.
+static inline __attribute__((target("sse2"))) void yuv420_store_sse2(uint8_t *out, __m128i b, __m128i g, __m128i r) {
+    const __m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_packus_epi16(g, g));
+    const __m128i rx = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_set1_epi8(-1));
+
+    _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(bg, rx));
+    _mm_storeu_si128((__m128i *)(out + 16), _mm_unpackhi_epi16(bg, rx));
+}
+
+// Converts 8 pixels of one luma row, given the chroma terms for pixels 0-3 and 4-7.
+static inline __attribute__((target("sse2"))) void yuv420_row8_sse2(const uint8_t *y, uint8_t *out,
+                                                                    const __m128i c[6])
+{
+    const __m128i zero    = _mm_setzero_si128();
+    const __m128i ymul    = _mm_set1_epi32(PAIR16(298, 128));
+    const __m128i sixteen = _mm_set1_epi16(16);
+    const __m128i one     = _mm_set1_epi16(1);
+
+    __m128i luma = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)y), zero);
+    luma         = _mm_sub_epi16(_mm_max_epi16(luma, sixteen), sixteen);
+
+    const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(luma, one), ymul);
+    const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(luma, one), ymul);
+
+    const __m128i b = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, c[0]), 8),
+                                      _mm_srai_epi32(_mm_add_epi32(hi, c[1]), 8));
+    const __m128i g = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, c[2]), 8),
+                                      _mm_srai_epi32(_mm_add_epi32(hi, c[3]), 8));
+    const __m128i r = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, c[4]), 8),
+                                      _mm_srai_epi32(_mm_add_epi32(hi, c[5]), 8));
+
+    yuv420_store_sse2(out, b, g, r);
+}
+
+static __attribute__((target("sse2"))) void yuv420_rows_sse2(const uint8_t *y0, const uint8_t *y1,
+                                                             const uint8_t *u, const uint8_t *v, uint8_t *out0,
+                                                             uint8_t *out1, unsigned int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(128);
+    const __m128i bmul = _mm_set1_epi32(PAIR16(516, 0));
+    const __m128i gmul = _mm_set1_epi32(PAIR16(-100, -208));
+    const __m128i rmul = _mm_set1_epi32(PAIR16(0, 409));
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        int32_t u4, v4;
+        memcpy(&u4, u + x / 2, 4);
+        memcpy(&v4, v + x / 2, 4);
+
+        const __m128i cu = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(u4), zero), half);
+        const __m128i cv = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v4), zero), half);
+        const __m128i uv = _mm_unpacklo_epi16(cu, cv);
+
+        // One term per chroma sample, each used by two pixels side by side.
+        const __m128i b = _mm_madd_epi16(uv, bmul);
+        const __m128i g = _mm_madd_epi16(uv, gmul);
+        const __m128i r = _mm_madd_epi16(uv, rmul);
+
+        const __m128i c[6] = {
+            _mm_unpacklo_epi32(b, b), _mm_unpackhi_epi32(b, b),
+            _mm_unpacklo_epi32(g, g), _mm_unpackhi_epi32(g, g),
+            _mm_unpacklo_epi32(r, r), _mm_unpackhi_epi32(r, r),
+        };
+
+        yuv420_row8_sse2(y0 + x, out0 + x * 4, c);
+        if (y1) {
+            yuv420_row8_sse2(y1 + x, out1 + x * 4, c);
+        }
+    }
+
+    yuv420_rows_c_from(y0, y1, u, v, out0, out1, x, width);
+}
+
+/* AVX2 works on two 128 bit lanes, so unpacking the pixels 0-15 gives 0-3 and 8-11 in the low
+ * halves and 4-7 and 12-15 in the high ones. Packing undoes that, and the stores put the lanes back
+ * in order. */
+static inline __attribute__((target("avx2"))) void yuv420_row16_avx2(const uint8_t *y, uint8_t *out,
+                                                                     const __m256i c[6])
+{
+    const __m256i ymul    = _mm256_set1_epi32(PAIR16(298, 128));
+    const __m256i sixteen = _mm256_set1_epi16(16);
+    const __m256i one     = _mm256_set1_epi16(1);
+
+    __m256i luma = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)y));
+    luma         = _mm256_sub_epi16(_mm256_max_epi16(luma, sixteen), sixteen);
+
+    const __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(luma, one), ymul);
+    const __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(luma, one), ymul);
+
+    const __m256i b = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(lo, c[0]), 8),
+                                         _mm256_srai_epi32(_mm256_add_epi32(hi, c[1]), 8));
+    const __m256i g = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(lo, c[2]), 8),
+                                         _mm256_srai_epi32(_mm256_add_epi32(hi, c[3]), 8));
+    const __m256i r = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(lo, c[4]), 8),
+                                         _mm256_srai_epi32(_mm256_add_epi32(hi, c[5]), 8));
+
+    const __m256i bg = _mm256_unpacklo_epi8(_mm256_packus_epi16(b, b), _mm256_packus_epi16(g, g));
+    const __m256i rx = _mm256_unpacklo_epi8(_mm256_packus_epi16(r, r), _mm256_set1_epi8(-1));
+
+    const __m256i px_lo = _mm256_unpacklo_epi16(bg, rx);
+    const __m256i px_hi = _mm256_unpackhi_epi16(bg, rx);
+
+    _mm256_storeu_si256((__m256i *)out, _mm256_permute2x128_si256(px_lo, px_hi, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + 32), _mm256_permute2x128_si256(px_lo, px_hi, 0x31));
+}
+
+static __attribute__((target("avx2"))) void yuv420_rows_avx2(const uint8_t *y0, const uint8_t *y1,
+                                                             const uint8_t *u, const uint8_t *v, uint8_t *out0,
+                                                             uint8_t *out1, unsigned int width)
+{
+    const __m256i half = _mm256_set1_epi16(128);
+    const __m256i bmul = _mm256_set1_epi32(PAIR16(516, 0));
+    const __m256i gmul = _mm256_set1_epi32(PAIR16(-100, -208));
+    const __m256i rmul = _mm256_set1_epi32(PAIR16(0, 409));
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // Every chroma sample twice over, lined up with the pixels it's for.
+        const __m128i u8 = _mm_loadl_epi64((const __m128i *)(u + x / 2));
+        const __m128i v8 = _mm_loadl_epi64((const __m128i *)(v + x / 2));
+
+        const __m256i cu = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(u8, u8)), half);
+        const __m256i cv = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(v8, v8)), half);
+
+        const __m256i uv_lo = _mm256_unpacklo_epi16(cu, cv);
+        const __m256i uv_hi = _mm256_unpackhi_epi16(cu, cv);
+
+        const __m256i c[6] = {
+            _mm256_madd_epi16(uv_lo, bmul), _mm256_madd_epi16(uv_hi, bmul),
+            _mm256_madd_epi16(uv_lo, gmul), _mm256_madd_epi16(uv_hi, gmul),
+            _mm256_madd_epi16(uv_lo, rmul), _mm256_madd_epi16(uv_hi, rmul),
+        };
+
+        yuv420_row16_avx2(y0 + x, out0 + x * 4, c);
+        if (y1) {
+            yuv420_row16_avx2(y1 + x, out1 + x * 4, c);
+        }
+    }
+
+    if (x + 8 <= width) {
+        yuv420_rows_sse2(y0 + x, y1 ? y1 + x : NULL, u + x / 2, v + x / 2, out0 + x * 4,
+                         out1 ? out1 + x * 4 : NULL, width - x);
+        return;
+    }
+
+    yuv420_rows_c_from(y0, y1, u, v, out0, out1, x, width);
+}
+#endif
+
+static YUV420_ROWS *yuv420_rows_best(void) {
+#ifdef VIDEO_CONVERT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return yuv420_rows_avx2;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return yuv420_rows_sse2;
+    }
+#endif
+
+    return yuv420_rows_c;
+}
+
+static void yuv420tobgr_rows(YUV420_ROWS *rows, uint16_t width, uint16_t height, const uint8_t *y,
+                             const uint8_t *u, const uint8_t *v, unsigned int ystride, unsigned int ustride,
+                             unsigned int vstride, uint8_t *out)
+{
+    for (unsigned int i = 0; i < height; i += 2) {
+        uint8_t *out0 = out + (size_t)i * width * 4;
+
+        if (i + 1 < height) {
+            rows(y + (size_t)i * ystride, y + (size_t)(i + 1) * ystride, u + (size_t)(i / 2) * ustride,
+                 v + (size_t)(i / 2) * vstride, out0, out0 + (size_t)width * 4, width);
+        } else {
+            rows(y + (size_t)i * ystride, NULL, u + (size_t)(i / 2) * ustride, v + (size_t)(i / 2) * vstride,
+                 out0, NULL, width);
+        }
+    }
+}
+
+void yuv420tobgr(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                 unsigned int ystride, unsigned int ustride, unsigned int vstride, uint8_t *out)
+{
+    // Worked out by every thread that gets here first, they'll all get the same answer.
+    static YUV420_ROWS *rows = NULL;
+    if (!rows) {
+        rows = yuv420_rows_best();
+    }
+
+    yuv420tobgr_rows(rows, width, height, y, u, v, ystride, ustride, vstride, out);
+}
+
+/* Converts two rows of width BGRX pixels into two rows of luma and one of chroma, each chroma
+ * sample from the rounded average of a 2x2 block of pixels. width is even. */
+typedef void BGRX_ROWS(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                       unsigned int width);
+
+static uint8_t rgb_to_y(int r, int g, int b) {
+    const int y = ((9798 * r + 19235 * g + 3736 * b) >> 15);
+    return y > 255 ? 255 : y < 0 ? 0 : y;
+}
+
+static uint8_t rgb_to_u(int r, int g, int b) {
+    const int u = ((-5538 * r + -10846 * g + 16351 * b) >> 15) + 128;
+    return u > 255 ? 255 : u < 0 ? 0 : u;
+}
+
+static uint8_t rgb_to_v(int r, int g, int b) {
+    const int v = ((16351 * r + -13697 * g + -2664 * b) >> 15) + 128;
+    return v > 255 ? 255 : v < 0 ? 0 : v;
+}
+
+// Converts pixels from x up to width, the ones left over by the SIMD kernels.
+static void bgrx_rows_c_from(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0, uint8_t *y1, uint8_t *u,
+                             uint8_t *v, unsigned int x, unsigned int width)
+{
+    for (; x < width; x += 2) {
+        const uint8_t *a = rgb0 + x * 4, *b = a + 4;
+        const uint8_t *c = rgb1 + x * 4, *d = c + 4;
+
+        y0[x]     = rgb_to_y(a[2], a[1], a[0]);
+        y0[x + 1] = rgb_to_y(b[2], b[1], b[0]);
+        y1[x]     = rgb_to_y(c[2], c[1], c[0]);
+        y1[x + 1] = rgb_to_y(d[2], d[1], d[0]);
+
+        const int blue  = (a[0] + b[0] + c[0] + d[0] + 2) / 4;
+        const int green = (a[1] + b[1] + c[1] + d[1] + 2) / 4;
+        const int red   = (a[2] + b[2] + c[2] + d[2] + 2) / 4;
+
+        u[x / 2] = rgb_to_u(red, green, blue);
+        v[x / 2] = rgb_to_v(red, green, blue);
+    }
+}
+
+static void bgrx_rows_c(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                        unsigned int width)
+{
+    bgrx_rows_c_from(rgb0, rgb1, y0, y1, u, v, 0, width);
+}
+
+/* Splits two rows of width YVYU pixels into two rows of luma and one of chroma, the chroma coming
+ * from the first row only. width is even. */
+typedef void YUV422_ROWS(const uint8_t *in0, const uint8_t *in1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                         unsigned int width);
+
+static void yuv422_rows_c_from(const uint8_t *in0, const uint8_t *in1, uint8_t *y0, uint8_t *y1, uint8_t *u,
+                               uint8_t *v, unsigned int x, unsigned int width)
+{
+    for (; x < width; x += 2) {
+        y0[x]     = in0[x * 2];
+        v[x / 2]  = in0[x * 2 + 1];
+        y0[x + 1] = in0[x * 2 + 2];
+        u[x / 2]  = in0[x * 2 + 3];
+
+        y1[x]     = in1[x * 2];
+        y1[x + 1] = in1[x * 2 + 2];
+    }
+}
+
+static void yuv422_rows_c(const uint8_t *in0, const uint8_t *in1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                          unsigned int width)
+{
+    yuv422_rows_c_from(in0, in1, y0, y1, u, v, 0, width);
+}
+
+#ifdef VIDEO_CONVERT_X86
+/* pmaddwd on BGRX widened to 16 bits gives two sums a pixel, b and g, then r and x; these add them
+ * up. The coefficients for x are 0. */
+#define BGRX16(b, g, r) (int16_t)(b), (int16_t)(g), (int16_t)(r), 0, (int16_t)(b), (int16_t)(g), (int16_t)(r), 0
+
+// Adds up the pairs from pmaddwd, lo for pixels 0 and 1 and hi for 2 and 3, into one value a pixel.
+static inline __attribute__((target("sse2"))) __m128i bgrx_sum_sse2(__m128i lo, __m128i hi) {
+    const __m128 a = _mm_castsi128_ps(lo), b = _mm_castsi128_ps(hi);
+    return _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))),
+                         _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))));
+}
+
+// Luma of 4 BGRX pixels, 32 bits each.
+static inline __attribute__((target("sse2"))) __m128i bgrx_luma4_sse2(__m128i px) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ymul = _mm_setr_epi16(BGRX16(3736, 19235, 9798));
+
+    const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), ymul);
+    const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), ymul);
+    return _mm_srai_epi32(bgrx_sum_sse2(lo, hi), 15);
+}
+
+// Chroma of 2 averaged pixels, widened to 16 bits, given the coefficients.
+static inline __attribute__((target("sse2"))) __m128i bgrx_chroma_sse2(__m128i lo, __m128i hi, __m128i mul) {
+    const __m128i sum = bgrx_sum_sse2(_mm_madd_epi16(lo, mul), _mm_madd_epi16(hi, mul));
+    return _mm_add_epi32(_mm_srai_epi32(sum, 15), _mm_set1_epi32(128));
+}
+
+static __attribute__((target("sse2"))) void bgrx_rows_sse2(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0,
+                                                           uint8_t *y1, uint8_t *u, uint8_t *v, unsigned int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two  = _mm_set1_epi16(2);
+    const __m128i umul = _mm_setr_epi16(BGRX16(16351, -10846, -5538));
+    const __m128i vmul = _mm_setr_epi16(BGRX16(-2664, -13697, 16351));
+
+    unsigned int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const __m128i a0 = _mm_loadu_si128((const __m128i *)(rgb0 + x * 4));
+        const __m128i b0 = _mm_loadu_si128((const __m128i *)(rgb0 + x * 4 + 16));
+        const __m128i a1 = _mm_loadu_si128((const __m128i *)(rgb1 + x * 4));
+        const __m128i b1 = _mm_loadu_si128((const __m128i *)(rgb1 + x * 4 + 16));
+
+        const __m128i luma0 = _mm_packs_epi32(bgrx_luma4_sse2(a0), bgrx_luma4_sse2(b0));
+        const __m128i luma1 = _mm_packs_epi32(bgrx_luma4_sse2(a1), bgrx_luma4_sse2(b1));
+        _mm_storel_epi64((__m128i *)(y0 + x), _mm_packus_epi16(luma0, luma0));
+        _mm_storel_epi64((__m128i *)(y1 + x), _mm_packus_epi16(luma1, luma1));
+
+        // Pixels 0, 2, 4, 6 and 1, 3, 5, 7 of both rows, added up they're the 2x2 blocks.
+        const __m128 fa0 = _mm_castsi128_ps(a0), fb0 = _mm_castsi128_ps(b0);
+        const __m128 fa1 = _mm_castsi128_ps(a1), fb1 = _mm_castsi128_ps(b1);
+
+        const __m128i even0 = _mm_castps_si128(_mm_shuffle_ps(fa0, fb0, _MM_SHUFFLE(2, 0, 2, 0)));
+        const __m128i odd0  = _mm_castps_si128(_mm_shuffle_ps(fa0, fb0, _MM_SHUFFLE(3, 1, 3, 1)));
+        const __m128i even1 = _mm_castps_si128(_mm_shuffle_ps(fa1, fb1, _MM_SHUFFLE(2, 0, 2, 0)));
+        const __m128i odd1  = _mm_castps_si128(_mm_shuffle_ps(fa1, fb1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(even0, zero), _mm_unpacklo_epi8(odd0, zero));
+        lo         = _mm_add_epi16(lo, _mm_add_epi16(_mm_unpacklo_epi8(even1, zero), _mm_unpacklo_epi8(odd1, zero)));
+        lo         = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(even0, zero), _mm_unpackhi_epi8(odd0, zero));
+        hi         = _mm_add_epi16(hi, _mm_add_epi16(_mm_unpackhi_epi8(even1, zero), _mm_unpackhi_epi8(odd1, zero)));
+        hi         = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+
+        const __m128i uv16 = _mm_packs_epi32(bgrx_chroma_sse2(lo, hi, umul), bgrx_chroma_sse2(lo, hi, vmul));
+        const __m128i uv   = _mm_packus_epi16(uv16, uv16);
+
+        const int32_t u4 = _mm_cvtsi128_si32(uv);
+        const int32_t v4 = _mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+        memcpy(u + x / 2, &u4, 4);
+        memcpy(v + x / 2, &v4, 4);
+    }
+
+    bgrx_rows_c_from(rgb0, rgb1, y0, y1, u, v, x, width);
+}
+
+/* The AVX2 kernel works like the SSE2 one on each 128 bit lane, and the lanes hold pixels 0-3 and
+ * 4-7 of every 8. phaddd adds up the pmaddwd pairs in order within the lanes, and vpermq puts the
+ * packed results back in order across them. */
+static inline __attribute__((target("avx2"))) __m256i bgrx_luma8_avx2(__m256i px) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ymul = _mm256_setr_epi16(BGRX16(3736, 19235, 9798), BGRX16(3736, 19235, 9798));
+
+    const __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), ymul);
+    const __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), ymul);
+    return _mm256_srai_epi32(_mm256_hadd_epi32(lo, hi), 15);
+}
+
+static inline __attribute__((target("avx2"))) __m256i bgrx_chroma_avx2(__m256i lo, __m256i hi, __m256i mul) {
+    const __m256i sum = _mm256_hadd_epi32(_mm256_madd_epi16(lo, mul), _mm256_madd_epi16(hi, mul));
+    return _mm256_add_epi32(_mm256_srai_epi32(sum, 15), _mm256_set1_epi32(128));
+}
+
+// Packs the 16 bit values in x, lanes in the order vpackssdw left them, into bytes in order.
+static inline __attribute__((target("avx2"))) __m128i bgrx_pack_avx2(__m256i x) {
+    x = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 1, 2, 0));
+    return _mm_packus_epi16(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+}
+
+static __attribute__((target("avx2"))) void bgrx_rows_avx2(const uint8_t *rgb0, const uint8_t *rgb1, uint8_t *y0,
+                                                           uint8_t *y1, uint8_t *u, uint8_t *v, unsigned int width)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i two  = _mm256_set1_epi16(2);
+    const __m256i umul = _mm256_setr_epi16(BGRX16(16351, -10846, -5538), BGRX16(16351, -10846, -5538));
+    const __m256i vmul = _mm256_setr_epi16(BGRX16(-2664, -13697, 16351), BGRX16(-2664, -13697, 16351));
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m256i a0 = _mm256_loadu_si256((const __m256i *)(rgb0 + x * 4));
+        const __m256i b0 = _mm256_loadu_si256((const __m256i *)(rgb0 + x * 4 + 32));
+        const __m256i a1 = _mm256_loadu_si256((const __m256i *)(rgb1 + x * 4));
+        const __m256i b1 = _mm256_loadu_si256((const __m256i *)(rgb1 + x * 4 + 32));
+
+        _mm_storeu_si128((__m128i *)(y0 + x),
+                         bgrx_pack_avx2(_mm256_packs_epi32(bgrx_luma8_avx2(a0), bgrx_luma8_avx2(b0))));
+        _mm_storeu_si128((__m128i *)(y1 + x),
+                         bgrx_pack_avx2(_mm256_packs_epi32(bgrx_luma8_avx2(a1), bgrx_luma8_avx2(b1))));
+
+        /* Even and odd pixels as in the SSE2 kernel, which leaves the 2x2 blocks 0, 1, 4, 5 in the low
+         * lane and 2, 3, 6, 7 in the high one. */
+        const __m256 fa0 = _mm256_castsi256_ps(a0), fb0 = _mm256_castsi256_ps(b0);
+        const __m256 fa1 = _mm256_castsi256_ps(a1), fb1 = _mm256_castsi256_ps(b1);
+
+        const __m256i even0 = _mm256_castps_si256(_mm256_shuffle_ps(fa0, fb0, _MM_SHUFFLE(2, 0, 2, 0)));
+        const __m256i odd0  = _mm256_castps_si256(_mm256_shuffle_ps(fa0, fb0, _MM_SHUFFLE(3, 1, 3, 1)));
+        const __m256i even1 = _mm256_castps_si256(_mm256_shuffle_ps(fa1, fb1, _MM_SHUFFLE(2, 0, 2, 0)));
+        const __m256i odd1  = _mm256_castps_si256(_mm256_shuffle_ps(fa1, fb1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(even0, zero), _mm256_unpacklo_epi8(odd0, zero));
+        lo = _mm256_add_epi16(lo, _mm256_add_epi16(_mm256_unpacklo_epi8(even1, zero), _mm256_unpacklo_epi8(odd1, zero)));
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+
+        __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(even0, zero), _mm256_unpackhi_epi8(odd0, zero));
+        hi = _mm256_add_epi16(hi, _mm256_add_epi16(_mm256_unpackhi_epi8(even1, zero), _mm256_unpackhi_epi8(odd1, zero)));
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+
+        // Blocks 0, 1, 4, 5 | 2, 3, 6, 7, which vpermq puts in order.
+        const __m256i cu = _mm256_permute4x64_epi64(bgrx_chroma_avx2(lo, hi, umul), _MM_SHUFFLE(3, 1, 2, 0));
+        const __m256i cv = _mm256_permute4x64_epi64(bgrx_chroma_avx2(lo, hi, vmul), _MM_SHUFFLE(3, 1, 2, 0));
+
+        const __m128i uv = bgrx_pack_avx2(_mm256_packs_epi32(cu, cv));
+        _mm_storel_epi64((__m128i *)(u + x / 2), uv);
+        _mm_storel_epi64((__m128i *)(v + x / 2), _mm_srli_si128(uv, 8));
+    }
+
+    if (x + 8 <= width) {
+        bgrx_rows_sse2(rgb0 + x * 4, rgb1 + x * 4, y0 + x, y1 + x, u + x / 2, v + x / 2, width - x);
+        return;
+    }
+
+    bgrx_rows_c_from(rgb0, rgb1, y0, y1, u, v, x, width);
+}
+
+static __attribute__((target("sse2"))) void yuv422_rows_sse2(const uint8_t *in0, const uint8_t *in1, uint8_t *y0,
+                                                             uint8_t *y1, uint8_t *u, uint8_t *v, unsigned int width)
+{
+    // Every 16 bits is luma in the low byte and chroma, v then u, in the high one.
+    const __m128i low = _mm_set1_epi16(0xFF);
+
+    unsigned int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const __m128i a0 = _mm_loadu_si128((const __m128i *)(in0 + x * 2));
+        const __m128i b0 = _mm_loadu_si128((const __m128i *)(in0 + x * 2 + 16));
+        const __m128i a1 = _mm_loadu_si128((const __m128i *)(in1 + x * 2));
+        const __m128i b1 = _mm_loadu_si128((const __m128i *)(in1 + x * 2 + 16));
+
+        _mm_storeu_si128((__m128i *)(y0 + x), _mm_packus_epi16(_mm_and_si128(a0, low), _mm_and_si128(b0, low)));
+        _mm_storeu_si128((__m128i *)(y1 + x), _mm_packus_epi16(_mm_and_si128(a1, low), _mm_and_si128(b1, low)));
+
+        const __m128i vu = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(b0, 8));
+        const __m128i cv = _mm_packus_epi16(_mm_and_si128(vu, low), _mm_srli_epi16(vu, 8));
+        _mm_storel_epi64((__m128i *)(v + x / 2), cv);
+        _mm_storel_epi64((__m128i *)(u + x / 2), _mm_srli_si128(cv, 8));
+    }
+
+    yuv422_rows_c_from(in0, in1, y0, y1, u, v, x, width);
+}
+#endif
+
+static BGRX_ROWS *bgrx_rows_best(void) {
+#ifdef VIDEO_CONVERT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return bgrx_rows_avx2;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return bgrx_rows_sse2;
+    }
+#endif
+
+    return bgrx_rows_c;
+}
+
+static YUV422_ROWS *yuv422_rows_best(void) {
+#ifdef VIDEO_CONVERT_X86
+    __builtin_cpu_init();
+
+    // Splitting the planes is all loads and stores, AVX2 doesn't make it any faster.
+    if (__builtin_cpu_supports("sse2")) {
+        return yuv422_rows_sse2;
+    }
+#endif
+
+    return yuv422_rows_c;
+}
+
+static void bgrxtoyuv420_rows(BGRX_ROWS *rows, uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v,
+                              const uint8_t *rgb, uint16_t width, uint16_t height)
+{
+    for (unsigned int i = 0; i + 1 < height; i += 2) {
+        const uint8_t *rgb0 = rgb + (size_t)i * width * 4;
+        uint8_t *      y0   = plane_y + (size_t)i * width;
+
+        rows(rgb0, rgb0 + (size_t)width * 4, y0, y0 + width, plane_u + (size_t)(i / 2) * (width / 2),
+             plane_v + (size_t)(i / 2) * (width / 2), width);
+    }
+}
+
+// Pixels of BGR converted at a time, padded out to BGRX for the BGRX kernels.
+#define BGR_CHUNK 64
+
+static void bgrtoyuv420_rows(BGRX_ROWS *rows, uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v,
+                             const uint8_t *rgb, uint16_t width, uint16_t height)
+{
+    uint8_t chunk[2][BGR_CHUNK * 4] = { { 0 } };
+
+    for (unsigned int i = 0; i + 1 < height; i += 2) {
+        const uint8_t *rgb0 = rgb + (size_t)i * width * 3;
+        const uint8_t *rgb1 = rgb0 + (size_t)width * 3;
+        uint8_t *      y0   = plane_y + (size_t)i * width;
+        uint8_t *      u    = plane_u + (size_t)(i / 2) * (width / 2);
+        uint8_t *      v    = plane_v + (size_t)(i / 2) * (width / 2);
+
+        for (unsigned int x = 0; x < width; x += BGR_CHUNK) {
+            const unsigned int count = width - x < BGR_CHUNK ? width - x : BGR_CHUNK;
+
+            for (unsigned int j = 0; j < count; ++j) {
+                memcpy(chunk[0] + j * 4, rgb0 + (x + j) * 3, 3);
+                memcpy(chunk[1] + j * 4, rgb1 + (x + j) * 3, 3);
+            }
+
+            rows(chunk[0], chunk[1], y0 + x, y0 + width + x, u + x / 2, v + x / 2, count);
+        }
+    }
+}
+
+static void yuv422to420_rows(YUV422_ROWS *rows, uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v,
+                             const uint8_t *input, uint16_t width, uint16_t height)
+{
+    for (unsigned int i = 0; i + 1 < height; i += 2) {
+        const uint8_t *in0 = input + (size_t)i * width * 2;
+        uint8_t *      y0  = plane_y + (size_t)i * width;
+
+        rows(in0, in0 + (size_t)width * 2, y0, y0 + width, plane_u + (size_t)(i / 2) * (width / 2),
+             plane_v + (size_t)(i / 2) * (width / 2), width);
+    }
+}
+
+void bgrxtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height) {
+    static BGRX_ROWS *rows = NULL;
+    if (!rows) {
+        rows = bgrx_rows_best();
+    }
+
+    bgrxtoyuv420_rows(rows, plane_y, plane_u, plane_v, rgb, width, height);
+}
+
+void bgrtoyuv420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *rgb, uint16_t width, uint16_t height) {
+    static BGRX_ROWS *rows = NULL;
+    if (!rows) {
+        rows = bgrx_rows_best();
+    }
+
+    bgrtoyuv420_rows(rows, plane_y, plane_u, plane_v, rgb, width, height);
+}
+
+void yuv422to420(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, uint8_t *input, uint16_t width, uint16_t height) {
+    static YUV422_ROWS *rows = NULL;
+    if (!rows) {
+        rows = yuv422_rows_best();
+    }
+
+    yuv422to420_rows(rows, plane_y, plane_u, plane_v, input, width, height);
+}
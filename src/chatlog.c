@@ -2,12 +2,24 @@
 
 #include "filesys.h"
 #include "messages.h"
+#include "macros.h"
 #include "text.h"
 
 #include "native/filesys.h"
+#include "native/thread.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct chatlog_slab {
+    size_t refs;
+    // Followed by the text of every message.
+    MSG_HEADER msg[];
+};
 
 static FILE* chatlog_get_file(char hex[TOX_PUBLIC_KEY_SIZE * 2], bool append) {
     char name[TOX_PUBLIC_KEY_SIZE * 2 + sizeof(".new.txt")];
@@ -30,20 +42,632 @@ static FILE* chatlog_get_file(char hex[TOX_PUBLIC_KEY_SIZE * 2], bool append) {
     return file;
 }
 
+static const uint8_t chatlog_index_magic[4] = { 'u', 'L', 'I', 'X' };
+
+static FILE *chatlog_get_index_file(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t *size, UTOX_FILE_OPTS opts) {
+    char name[TOX_PUBLIC_KEY_SIZE * 2 + sizeof(".new.idx")];
+    snprintf(name, sizeof(name), "%.*s.new.idx", TOX_PUBLIC_KEY_SIZE * 2, hex);
+
+    return utox_get_file(name, size, opts);
+}
+
+static bool chatlog_index_write_header(FILE *index, uint64_t log_size) {
+    LOG_FILE_INDEX_HEADER header = { .version = LOGFILE_INDEX_VERSION, .log_size = log_size };
+    memcpy(header.magic, chatlog_index_magic, sizeof(header.magic));
+
+    if (fseeko(index, 0, SEEK_SET)) {
+        return false;
+    }
+
+    return fwrite(&header, sizeof(header), 1, index) == 1;
+}
+
+/* Writes an index entry for every complete record in the log of log_size bytes, from offset to the
+ * end of the log, at the current position of the index.
+ *
+ * Returns the offset directly after the last complete record. */
+static uint64_t chatlog_index_scan(FILE *log, uint64_t log_size, FILE *index, uint64_t offset) {
+    if (fseeko(log, offset, SEEK_SET)) {
+        return offset;
+    }
+
+    LOG_FILE_MSG_HEADER header;
+    while (fread(&header, sizeof(header), 1, log) == 1) {
+        uint64_t next = offset + sizeof(header) + header.author_length + header.msg_length + 1;
+        // Seeking past the end works, so a record cut short has to be caught here.
+        if (next > log_size || fseeko(log, next, SEEK_SET)) {
+            break;
+        }
+
+        LOG_FILE_INDEX_ENTRY entry = { .offset = offset, .time = header.time };
+        if (fwrite(&entry, sizeof(entry), 1, index) != 1) {
+            break;
+        }
+
+        offset = next;
+    }
+
+    return offset;
+}
+
+/* Finds the first of the count entries in the index for a record at or after log_size, which can be
+ * there if the entries reached the disk but the header didn't.
+ *
+ * Returns the number of entries before it. */
+static size_t chatlog_index_find_end(FILE *index, size_t count, uint64_t log_size) {
+    LOG_FILE_INDEX_ENTRY entry;
+    while (count
+           && fseeko(index, sizeof(LOG_FILE_INDEX_HEADER) + (count - 1) * sizeof(entry), SEEK_SET) == 0
+           && fread(&entry, sizeof(entry), 1, index) == 1
+           && entry.offset >= log_size)
+    {
+        count--;
+    }
+
+    return count;
+}
+
+/* Opens the index of the log, bringing it up to date with the log first.
+ *
+ * An index that covers only the start of the log is extended with the new records, an index that
+ * can't be used is thrown away and rebuilt from the log.
+ *
+ * Returns the index and writes the number of records to count on success.
+ * Returns NULL on failure. */
+static FILE *chatlog_index_open(char hex[TOX_PUBLIC_KEY_SIZE * 2], FILE *log, size_t *count) {
+    if (fseeko(log, 0, SEEK_END)) {
+        return NULL;
+    }
+    uint64_t log_size = ftello(log);
+
+    size_t index_size = 0;
+    FILE *index = chatlog_get_index_file(hex, &index_size, UTOX_FILE_OPTS_READ | UTOX_FILE_OPTS_WRITE);
+
+    LOG_FILE_INDEX_HEADER header;
+    bool usable = index
+                  && index_size >= sizeof(header)
+                  && (index_size - sizeof(header)) % sizeof(LOG_FILE_INDEX_ENTRY) == 0
+                  && fread(&header, sizeof(header), 1, index) == 1
+                  && memcmp(header.magic, chatlog_index_magic, sizeof(header.magic)) == 0
+                  && header.version == LOGFILE_INDEX_VERSION
+                  && header.log_size <= log_size;
+
+    if (usable && header.log_size < log_size) {
+        /* Records were appended without the index being updated, catch up. Entries already written
+         * past the header's size are written again in place. */
+        size_t entries = (index_size - sizeof(header)) / sizeof(LOG_FILE_INDEX_ENTRY);
+        entries = chatlog_index_find_end(index, entries, header.log_size);
+
+        if (fseeko(index, sizeof(header) + entries * sizeof(LOG_FILE_INDEX_ENTRY), SEEK_SET) == 0) {
+            uint64_t indexed_size = chatlog_index_scan(log, log_size, index, header.log_size);
+
+            /* Anything left after what we wrote is for records that never made it into the log, that
+             * needs the index cut short, so rebuild it instead. */
+            usable = (uint64_t)ftello(index) >= index_size
+                     && (indexed_size == header.log_size || chatlog_index_write_header(index, indexed_size));
+        } else {
+            usable = false;
+        }
+    }
+
+    if (usable) {
+        fseeko(index, 0, SEEK_END);
+        index_size = ftello(index);
+    } else {
+        if (index) {
+            fclose(index);
+        }
+
+        /* The index is missing or unusable, rebuild it from scratch. */
+        index = chatlog_get_index_file(hex, NULL, UTOX_FILE_OPTS_WRITE | UTOX_FILE_OPTS_MKDIR);
+        if (!index) {
+            return NULL;
+        }
+
+        chatlog_index_write_header(index, 0);
+        uint64_t indexed_size = chatlog_index_scan(log, log_size, index, 0);
+        if (!chatlog_index_write_header(index, indexed_size)) {
+            fclose(index);
+            return NULL;
+        }
+        fclose(index);
+
+        index = chatlog_get_index_file(hex, &index_size, UTOX_FILE_OPTS_READ);
+        if (!index || index_size < sizeof(header)) {
+            if (index) {
+                fclose(index);
+            }
+            return NULL;
+        }
+    }
+
+    *count = (index_size - sizeof(header)) / sizeof(LOG_FILE_INDEX_ENTRY);
+    return index;
+}
+
+/* The log writer.
+ *
+ * Appends and receipt updates are queued by the callers and written out in batches by the log writer
+ * thread, which keeps the logs it writes to open until they've been idle for a while. Anything that
+ * reads or removes a log on disk has to release it from the writer first. */
+
+// How long a burst of writes is given to pile up before it's written out.
+#define CHATLOG_FLUSH_INTERVAL_MS 250
+// Write out right away once this much is queued.
+#define CHATLOG_FLUSH_BYTES (64 * 1024)
+// Close logs that haven't been written to for this many seconds.
+#define CHATLOG_IDLE_CLOSE_SECONDS 30
+
+typedef struct chatlog_write {
+    // Appends go to the end of the log, everything else overwrites the log at offset.
+    bool     append;
+    uint64_t offset;
+    size_t   length;
+
+    struct chatlog_write *next;
+    uint8_t data[];
+} CHATLOG_WRITE;
+
+typedef struct chatlog_open_log {
+    char hex[TOX_PUBLIC_KEY_SIZE * 2];
+
+    // Held while writing to the log, no file is touched with writer.lock held.
+    pthread_mutex_t io_lock;
+
+    // Only touched with io_lock held.
+    FILE  *log, *index;
+    time_t last_write;
+
+    // Writes queued for the log, guarded by writer.lock.
+    CHATLOG_WRITE *head, *tail;
+    size_t         queued_bytes;
+
+    // Size the log will have once everything queued is written, valid if size_known.
+    bool     size_known;
+    uint64_t size;
+    // Set while someone waits for the writer to measure the log.
+    bool measure;
+
+    // Logs are never freed, so this doesn't change once the log is on the list.
+    struct chatlog_open_log *next;
+} CHATLOG_OPEN_LOG;
+
+static struct {
+    // Guards the queues and the list of logs.
+    pthread_mutex_t lock;
+    // Wakes the writer thread, and wakes those waiting for it once it measured a log or stopped.
+    pthread_cond_t cond, done;
+
+    // Queued for every log together.
+    size_t queued_bytes;
+
+    CHATLOG_OPEN_LOG *logs;
+    bool running, stop, measure;
+} writer = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+// Must be called with writer.lock held.
+static CHATLOG_OPEN_LOG *chatlog_writer_find(char hex[TOX_PUBLIC_KEY_SIZE * 2], bool create) {
+    for (CHATLOG_OPEN_LOG *log = writer.logs; log; log = log->next) {
+        if (memcmp(log->hex, hex, sizeof(log->hex)) == 0) {
+            return log;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    CHATLOG_OPEN_LOG *log = calloc(1, sizeof(CHATLOG_OPEN_LOG));
+    if (!log) {
+        return NULL;
+    }
+
+    memcpy(log->hex, hex, sizeof(log->hex));
+    pthread_mutex_init(&log->io_lock, NULL);
+    log->next   = writer.logs;
+    writer.logs = log;
+
+    return log;
+}
+
+/* Opens the index for appending, if it's in sync with the log of log_size bytes. Anything else is left
+ * for chatlog_index_open() to fix the next time the log is read. */
+static FILE *chatlog_writer_open_index(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint64_t log_size) {
+    size_t index_size = 0;
+    FILE *index = chatlog_get_index_file(hex, &index_size, UTOX_FILE_OPTS_READ | UTOX_FILE_OPTS_WRITE);
+    if (!index) {
+        return NULL;
+    }
+
+    LOG_FILE_INDEX_HEADER header;
+    if (index_size == 0 && log_size == 0 && chatlog_index_write_header(index, 0)) {
+        return index;
+    }
+
+    if (index_size >= sizeof(header)
+        && fread(&header, sizeof(header), 1, index) == 1
+        && memcmp(header.magic, chatlog_index_magic, sizeof(header.magic)) == 0
+        && header.version == LOGFILE_INDEX_VERSION
+        && header.log_size == log_size)
+    {
+        return index;
+    }
+
+    fclose(index);
+    return NULL;
+}
+
+// Must be called with log->io_lock held.
+static void chatlog_writer_close(CHATLOG_OPEN_LOG *log) {
+    if (log->log) {
+        fclose(log->log);
+        log->log = NULL;
+    }
+
+    if (log->index) {
+        fclose(log->index);
+        log->index = NULL;
+    }
+}
+
+// Must be called with log->io_lock held.
+static bool chatlog_writer_write(CHATLOG_OPEN_LOG *log, CHATLOG_WRITE *op) {
+    if (!log->log) {
+        log->log = chatlog_get_file(log->hex, true);
+        if (!log->log) {
+            return false;
+        }
+
+        log->index = chatlog_writer_open_index(log->hex, ftello(log->log));
+    }
+
+    if (!op->append) {
+        return fseeko(log->log, op->offset, SEEK_SET) == 0 && fwrite(op->data, op->length, 1, log->log) == 1;
+    }
+
+    if (fseeko(log->log, 0, SEEK_END)) {
+        return false;
+    }
+
+    uint64_t offset = ftello(log->log);
+    if (fwrite(op->data, op->length, 1, log->log) != 1) {
+        return false;
+    }
+
+    if (log->index) {
+        LOG_FILE_MSG_HEADER record;
+        memcpy(&record, op->data, sizeof(record));
+
+        LOG_FILE_INDEX_ENTRY entry = { .offset = offset, .time = record.time };
+        if (fseeko(log->index, 0, SEEK_END) || fwrite(&entry, sizeof(entry), 1, log->index) != 1) {
+            // Stop touching it, it'll be fixed up when the log is read.
+            fclose(log->index);
+            log->index = NULL;
+        }
+    }
+
+    return true;
+}
+
+/* Writes out everything queued for log, on the calling thread, and closes it if close is set or it's
+ * been idle for long enough.
+ *
+ * Must be called with log->io_lock held. The queue is taken with io_lock held, so whoever takes it
+ * next can't write ahead of us. */
+static void chatlog_writer_flush_locked(CHATLOG_OPEN_LOG *log, time_t now, bool close) {
+    pthread_mutex_lock(&writer.lock);
+    CHATLOG_WRITE *op = log->head;
+    log->head = log->tail = NULL;
+    writer.queued_bytes -= log->queued_bytes;
+    log->queued_bytes = 0;
+    pthread_mutex_unlock(&writer.lock);
+
+    bool dirty = false;
+    while (op) {
+        CHATLOG_WRITE *next = op->next;
+
+        if (chatlog_writer_write(log, op)) {
+            dirty           = true;
+            log->last_write = now;
+        } else {
+            /* The log on disk no longer matches what we think it is, measure it again next time. */
+            pthread_mutex_lock(&writer.lock);
+            log->size_known = false;
+            pthread_mutex_unlock(&writer.lock);
+        }
+
+        free(op);
+        op = next;
+    }
+
+    /* Flush once, rather than once per write. */
+    if (dirty) {
+        fflush(log->log);
+
+        if (log->index && fseeko(log->log, 0, SEEK_END) == 0) {
+            chatlog_index_write_header(log->index, ftello(log->log));
+            fflush(log->index);
+        }
+    }
+
+    if (close || now - log->last_write >= CHATLOG_IDLE_CLOSE_SECONDS) {
+        chatlog_writer_close(log);
+    }
+}
+
+static void chatlog_writer_flush(CHATLOG_OPEN_LOG *log, time_t now, bool close) {
+    pthread_mutex_lock(&log->io_lock);
+    chatlog_writer_flush_locked(log, now, close);
+    pthread_mutex_unlock(&log->io_lock);
+}
+
+/* Writes out everything queued so far, on the calling thread. */
+static void chatlog_writer_drain(bool close) {
+    const time_t now = time(NULL);
+
+    pthread_mutex_lock(&writer.lock);
+    CHATLOG_OPEN_LOG *log = writer.logs;
+    pthread_mutex_unlock(&writer.lock);
+
+    for (; log; log = log->next) {
+        chatlog_writer_flush(log, now, close);
+    }
+}
+
+static struct timespec chatlog_writer_deadline(uint32_t ms) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec  += ms / 1000;
+    until.tv_nsec += (ms % 1000) * 1000 * 1000;
+    if (until.tv_nsec >= 1000 * 1000 * 1000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000 * 1000 * 1000;
+    }
+
+    return until;
+}
+
+/* Returns the size of the log of friend hex on disk, 0 if there's none. */
+static uint64_t chatlog_measure(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
+    char name[TOX_PUBLIC_KEY_SIZE * 2 + sizeof(".new.txt")];
+    snprintf(name, sizeof(name), "%.*s.new.txt", TOX_PUBLIC_KEY_SIZE * 2, hex);
+
+    size_t size = 0;
+    FILE *file = utox_get_file(name, &size, UTOX_FILE_OPTS_READ);
+    if (!file) {
+        return 0;
+    }
+
+    fclose(file);
+    return size;
+}
+
+/* Tells the writer the log of friend hex is size bytes on disk, unless it knows better. */
+static void chatlog_writer_set_size(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint64_t size) {
+    pthread_mutex_lock(&writer.lock);
+
+    CHATLOG_OPEN_LOG *log = chatlog_writer_find(hex, true);
+    if (log && !log->size_known) {
+        log->size       = size;
+        log->size_known = true;
+    }
+
+    pthread_mutex_unlock(&writer.lock);
+}
+
+/* Measures the logs someone is waiting on, once what's queued for them is written. */
+static void chatlog_writer_measure(void) {
+    const time_t now = time(NULL);
+
+    pthread_mutex_lock(&writer.lock);
+    CHATLOG_OPEN_LOG *log = writer.logs;
+    pthread_mutex_unlock(&writer.lock);
+
+    for (; log; log = log->next) {
+        pthread_mutex_lock(&writer.lock);
+        const bool measure = log->measure;
+        pthread_mutex_unlock(&writer.lock);
+
+        if (!measure) {
+            continue;
+        }
+
+        pthread_mutex_lock(&log->io_lock);
+        chatlog_writer_flush_locked(log, now, true);
+        const uint64_t size = chatlog_measure(log->hex);
+
+        pthread_mutex_lock(&writer.lock);
+        if (!log->size_known) {
+            log->size       = size;
+            log->size_known = true;
+        }
+        log->measure = false;
+        pthread_mutex_unlock(&writer.lock);
+
+        pthread_mutex_unlock(&log->io_lock);
+    }
+}
+
+static void chatlog_writer_thread(void *UNUSED(args)) {
+    pthread_mutex_lock(&writer.lock);
+
+    while (!writer.stop) {
+        if (!writer.queued_bytes && !writer.measure) {
+            // Wake up now and then to close idle logs, or when something is queued.
+            struct timespec until = chatlog_writer_deadline(CHATLOG_IDLE_CLOSE_SECONDS * 1000);
+            while (!writer.queued_bytes && !writer.measure && !writer.stop
+                   && pthread_cond_timedwait(&writer.cond, &writer.lock, &until) != ETIMEDOUT)
+            {
+                continue;
+            }
+        }
+
+        if (writer.measure) {
+            // Someone is waiting on this, so it goes first.
+            writer.measure = false;
+            pthread_mutex_unlock(&writer.lock);
+            chatlog_writer_measure();
+            pthread_mutex_lock(&writer.lock);
+            pthread_cond_broadcast(&writer.done);
+            continue;
+        }
+
+        if (writer.queued_bytes) {
+            // Let the rest of a burst of messages catch up, unless there's a lot of it.
+            struct timespec until = chatlog_writer_deadline(CHATLOG_FLUSH_INTERVAL_MS);
+            while (writer.queued_bytes < CHATLOG_FLUSH_BYTES && !writer.measure && !writer.stop
+                   && pthread_cond_timedwait(&writer.cond, &writer.lock, &until) != ETIMEDOUT)
+            {
+                continue;
+            }
+        }
+
+        pthread_mutex_unlock(&writer.lock);
+        chatlog_writer_drain(false);
+        pthread_mutex_lock(&writer.lock);
+    }
+
+    writer.running = false;
+    pthread_cond_broadcast(&writer.done);
+    pthread_mutex_unlock(&writer.lock);
+}
+
+/* Queues a write for the log of friend hex, returns the offset it'll be written at. */
+static bool chatlog_writer_queue(char hex[TOX_PUBLIC_KEY_SIZE * 2], bool append, uint64_t offset,
+                                 const uint8_t *data, size_t length, uint64_t *out_offset)
+{
+    CHATLOG_WRITE *op = calloc(1, sizeof(CHATLOG_WRITE) + length);
+    if (!op) {
+        return false;
+    }
+
+    op->append = append;
+    op->offset = offset;
+    op->length = length;
+    memcpy(op->data, data, length);
+
+    pthread_mutex_lock(&writer.lock);
+
+    CHATLOG_OPEN_LOG *log = chatlog_writer_find(hex, true);
+    if (!log) {
+        pthread_mutex_unlock(&writer.lock);
+        free(op);
+        return false;
+    }
+
+    if (!writer.running && !writer.stop) {
+        writer.running = true;
+        thread(chatlog_writer_thread, NULL);
+    }
+
+    /* Loading the log tells us its size, this is only for logs that weren't loaded. The writer
+     * measures it, so the caller never touches the disk. */
+    while (append && !log->size_known && writer.running) {
+        log->measure   = true;
+        writer.measure = true;
+        pthread_cond_signal(&writer.cond);
+        pthread_cond_wait(&writer.done, &writer.lock);
+    }
+
+    if (append && !log->size_known) {
+        // The writer is shutting down, we're on our own.
+        pthread_mutex_unlock(&writer.lock);
+        chatlog_writer_set_size(hex, chatlog_measure(hex));
+        pthread_mutex_lock(&writer.lock);
+    }
+
+    if (append) {
+        op->offset = log->size;
+        log->size += length;
+    }
+
+    // The writer can free op as soon as the lock is released.
+    const uint64_t queued_offset = op->offset;
+
+    if (log->tail) {
+        log->tail->next = op;
+    } else {
+        log->head = op;
+    }
+    log->tail = op;
+    log->queued_bytes += length;
+
+    /* Only wake the writer to start a batch, or to cut it short once it's big enough. */
+    const size_t queued = writer.queued_bytes;
+    writer.queued_bytes += length;
+    if (!queued || (queued < CHATLOG_FLUSH_BYTES && writer.queued_bytes >= CHATLOG_FLUSH_BYTES)) {
+        pthread_cond_signal(&writer.cond);
+    }
+
+    pthread_mutex_unlock(&writer.lock);
+
+    if (out_offset) {
+        *out_offset = queued_offset;
+    }
+
+    return true;
+}
+
+/* Writes out everything queued for the log of friend hex and closes it, then keeps the writer away
+ * from it until chatlog_writer_release(), so it's safe to read or remove the log.
+ *
+ * Returns NULL on failure. */
+static CHATLOG_OPEN_LOG *chatlog_writer_hold(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
+    pthread_mutex_lock(&writer.lock);
+    CHATLOG_OPEN_LOG *log = chatlog_writer_find(hex, true);
+    pthread_mutex_unlock(&writer.lock);
+
+    if (!log) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&log->io_lock);
+    chatlog_writer_flush_locked(log, time(NULL), true);
+    return log;
+}
+
+/* Lets the writer at the log again. Set forget if the log changed behind the writer's back. */
+static void chatlog_writer_release(CHATLOG_OPEN_LOG *log, bool forget) {
+    if (forget) {
+        pthread_mutex_lock(&writer.lock);
+        log->size_known = false;
+        pthread_mutex_unlock(&writer.lock);
+    }
+
+    pthread_mutex_unlock(&log->io_lock);
+}
+
 size_t utox_save_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint8_t *data, size_t length) {
-    FILE *fp = chatlog_get_file(hex, true);
-    if (!fp) {
+    if (length < sizeof(LOG_FILE_MSG_HEADER)) {
         return 0;
     }
 
-    fseeko(fp, 0, SEEK_END);
-    off_t offset = ftello(fp);
-    fwrite(data, length, 1, fp);
-    fclose(fp);
+    uint64_t offset = 0;
+    if (!chatlog_writer_queue(hex, true, 0, data, length, &offset)) {
+        return 0;
+    }
 
     return offset;
 }
 
+void utox_flush_chatlogs(void) {
+    // Stop the writer and wait for it, so nothing is left half written when we exit.
+    pthread_mutex_lock(&writer.lock);
+    writer.stop = true;
+    pthread_cond_signal(&writer.cond);
+    while (writer.running) {
+        pthread_cond_wait(&writer.done, &writer.lock);
+    }
+    writer.stop = false;
+    pthread_mutex_unlock(&writer.lock);
+
+    chatlog_writer_drain(true);
+}
+
 static size_t utox_count_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
     FILE *file = chatlog_get_file(hex, false);
 
@@ -73,6 +697,64 @@ static size_t utox_count_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
     return records_count;
 }
 
+/* Reads the offset of record number record from the index. */
+static bool chatlog_index_read(FILE *index, size_t record, uint64_t *offset) {
+    LOG_FILE_INDEX_ENTRY entry;
+    if (fseeko(index, sizeof(LOG_FILE_INDEX_HEADER) + record * sizeof(entry), SEEK_SET)
+        || fread(&entry, sizeof(entry), 1, index) != 1)
+    {
+        return false;
+    }
+
+    *offset = entry.offset;
+    return true;
+}
+
+/* Finds the byte range of the log holding count records starting at record number first, using the
+ * index if we have one.
+ *
+ * Returns true on success. */
+static bool chatlog_find_records(FILE *log, FILE *index, size_t first, size_t count, size_t records_count,
+                                 uint64_t *start, uint64_t *end)
+{
+    if (index) {
+        if (!chatlog_index_read(index, first, start)) {
+            return false;
+        }
+
+        if (first + count < records_count) {
+            return chatlog_index_read(index, first + count, end);
+        }
+
+        fseeko(log, 0, SEEK_END);
+        *end = ftello(log);
+        return true;
+    }
+
+    /* Without an index we have to walk every record before the ones we want. */
+    if (fseeko(log, 0, SEEK_SET)) {
+        return false;
+    }
+
+    LOG_FILE_MSG_HEADER header;
+    for (size_t i = 0; i < first + count; ++i) {
+        if (i == first) {
+            *start = ftello(log);
+        }
+
+        if (fread(&header, sizeof(header), 1, log) != 1) {
+            return false;
+        }
+        fseeko(log, header.author_length + header.msg_length + 1, SEEK_CUR);
+    }
+
+    *end = ftello(log);
+    if (!count) {
+        *start = *end;
+    }
+    return true;
+}
+
 /* TODO create fxn that will try to recover a corrupt chat history.
  *
  * In the majority of bug reports the corrupt message is often the first, so in
@@ -83,14 +765,38 @@ MSG_HEADER **utox_load_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t *size,
     /* Becasue every platform is different, we have to ask them to open the file for us.
      * However once we have it, every platform does the same thing, this should prevent issues
      * from occuring on a single platform. */
-
-    size_t records_count = utox_count_chatlog(hex);
-    if (skip >= records_count) {
+    /* The writer is kept away until we're done, so the index we open or rebuild and the records we
+     * read can't change under us. */
+    CHATLOG_OPEN_LOG *log = chatlog_writer_hold(hex);
+    if (!log) {
         return NULL;
     }
 
     FILE *file = chatlog_get_file(hex, false);
     if (!file) {
+        chatlog_writer_set_size(hex, 0);
+        chatlog_writer_release(log, false);
+        return NULL;
+    }
+
+    // Saves the writer measuring the log on the caller's thread later on.
+    if (fseeko(file, 0, SEEK_END) == 0) {
+        chatlog_writer_set_size(hex, ftello(file));
+    }
+
+    size_t records_count = 0;
+    FILE *index = chatlog_index_open(hex, file, &records_count);
+    if (!index) {
+        /* We couldn't get an index, fall back to counting the records by hand. */
+        records_count = utox_count_chatlog(hex);
+    }
+
+    if (skip >= records_count) {
+        if (index) {
+            fclose(index);
+        }
+        fclose(file);
+        chatlog_writer_release(log, false);
         return NULL;
     }
 
@@ -98,110 +804,146 @@ MSG_HEADER **utox_load_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t *size,
         count = records_count - skip;
     }
 
-    MSG_HEADER **data = calloc(count + 1, sizeof(MSG_HEADER *));
-    MSG_HEADER **start = data;
+    uint64_t file_offset = 0, end_offset = 0;
+    bool found = chatlog_find_records(file, index, records_count - count - skip, count, records_count,
+                                      &file_offset, &end_offset);
+    if (index) {
+        fclose(index);
+    }
+
+    if (!found) {
+        fclose(file);
+        chatlog_writer_release(log, false);
+        return NULL;
+    }
 
-    size_t start_at = records_count - count - skip;
-    size_t actual_count = 0;
+    /* Map the records we want and parse them in place. If the platform can't map the log we read them
+     * with a single fread() instead. */
+    size_t length = end_offset - file_offset;
+
+    uint8_t *buffer = NULL;
+    const uint8_t *records = native_map_file(file, file_offset, length);
+    if (!records && length) {
+        buffer = malloc(length);
+        if (!buffer || fseeko(file, file_offset, SEEK_SET) || fread(buffer, length, 1, file) != 1) {
+            free(buffer);
+            fclose(file);
+            chatlog_writer_release(log, false);
+            return NULL;
+        }
+        records = buffer;
+    }
 
-    size_t file_offset = 0;
+    /* First pass, find out how many complete records we have, and how much text they hold. */
+    size_t actual_count = 0, text_length = 0, position = 0;
 
     LOG_FILE_MSG_HEADER header;
-    while (fread(&header, sizeof(header), 1, file) == 1) {
-        if (start_at) {
-            fseeko(file, header.author_length, SEEK_CUR); /* Skip the recorded author */
-            fseeko(file, header.msg_length, SEEK_CUR);    /* Skip the message */
-            fseeko(file, 1, SEEK_CUR);                    /* Skip the newline char */
-            start_at--;
-            file_offset = ftello(file);
-            continue;
+    while (actual_count < count && position + sizeof(header) <= length) {
+        memcpy(&header, records + position, sizeof(header));
+
+        size_t record_length = sizeof(header) + header.author_length + header.msg_length + 1;
+        if (header.msg_length > 1 << 16 || header.author_length > length
+            || record_length > length - position)
+        {
+            /* Corrupt or incomplete record, everything after it is suspect. */
+            break;
         }
 
-        if (count) {
-            // We have to skip the author name for now.
-            // It's left here for group chats support in the future.
-            fseeko(file, header.author_length, SEEK_CUR);
-            if (header.msg_length > 1 << 16) {
-                if (size) {
-                    *size = 0;
-                }
+        text_length += header.msg_length;
+        position    += record_length;
+        actual_count++;
+    }
 
-                fclose(file);
-                return start;
-            }
+    MSG_HEADER **data = calloc(actual_count + 1, sizeof(MSG_HEADER *));
+    CHATLOG_SLAB *slab = NULL;
+    if (actual_count) {
+        slab = calloc(1, sizeof(CHATLOG_SLAB) + actual_count * sizeof(MSG_HEADER) + text_length);
+    }
 
-            MSG_HEADER *msg = calloc(1, sizeof(MSG_HEADER));
-
-            msg->our_msg       = header.author;
-            msg->receipt_time  = header.receipt;
-            msg->time          = header.time;
-            msg->msg_type      = header.msg_type;
-            msg->disk_offset   = file_offset;
-
-            msg->via.txt.length        = header.msg_length;
-            msg->via.txt.msg = calloc(1, msg->via.txt.length);
-
-            msg->via.txt.author_length = header.author_length;
-            // TODO: msg->via.txt.author used to be allocated but left empty. Commented out for now.
-            // msg->via.txt.author = calloc(1, msg->via.txt.author_length);
-            // if (!msg->via.txt.author) {
-            //                 //     free(msg->via.txt.msg);
-            //     free(msg);
-            //     fclose(file);
-            //     return NULL;
-            // }
-
-            if (fread(msg->via.txt.msg, msg->via.txt.length, 1, file) != 1) {
-                // free(msg->via.txt.author);
-                free(msg->via.txt.msg);
-                free(msg);
-                break;
-            }
+    if (!data || (actual_count && !slab)) {
+        free(data);
+        free(slab);
+        actual_count = 0;
+        data = NULL;
+        slab = NULL;
+    }
 
-            msg->via.txt.length = utf8_validate((uint8_t *)msg->via.txt.msg, msg->via.txt.length);
-            *data++ = msg;
-            --count;
-            ++actual_count;
-            fseeko(file, 1, SEEK_CUR); /* seek an extra \n char */
-            file_offset = ftello(file);
-        }
+    /* Second pass, build the messages in the slab. */
+    char *text = slab ? (char *)&slab->msg[actual_count] : NULL;
+    position = 0;
+
+    for (size_t i = 0; i < actual_count; ++i) {
+        memcpy(&header, records + position, sizeof(header));
+
+        MSG_HEADER *msg = &slab->msg[i];
+
+        msg->our_msg       = header.author;
+        msg->receipt_time  = header.receipt;
+        msg->time          = header.time;
+        msg->msg_type      = header.msg_type;
+        msg->disk_offset   = file_offset + position;
+        msg->slab          = slab;
+
+        // We have to skip the author name for now.
+        // It's left here for group chats support in the future.
+        msg->via.txt.author_length = header.author_length;
+
+        msg->via.txt.msg = text;
+        memcpy(text, records + position + sizeof(header) + header.author_length, header.msg_length);
+        msg->via.txt.length = utf8_validate((uint8_t *)text, header.msg_length);
+        text += header.msg_length;
+
+        data[i] = msg;
+        position += sizeof(header) + header.author_length + header.msg_length + 1; /* and the \n char */
+    }
+
+    if (slab) {
+        slab->refs = actual_count;
     }
 
+    if (buffer) {
+        free(buffer);
+    } else {
+        native_unmap_file((void *)records, file_offset, length);
+    }
     fclose(file);
+    chatlog_writer_release(log, false);
 
     if (size) {
         *size = actual_count;
     }
 
-    return start;
+    return data;
+}
+
+void chatlog_slab_release(CHATLOG_SLAB *slab) {
+    if (slab && --slab->refs == 0) {
+        free(slab);
+    }
 }
 
 bool utox_update_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t offset,
                          uint8_t *data, size_t length)
 {
-    FILE *file = chatlog_get_file(hex, true);
-
-    if (!file) {
-        return false;
-    }
-
-    if (fseeko(file, offset, SEEK_SET)) {
-        fclose(file);
-        return false;
-    }
-
-    fwrite(data, length, 1, file);
-    fclose(file);
-
-    return true;
+    return chatlog_writer_queue(hex, false, offset, data, length, NULL);
 }
 
 bool utox_remove_friend_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2]) {
+    CHATLOG_OPEN_LOG *log = chatlog_writer_hold(hex);
+
     char name[TOX_PUBLIC_KEY_SIZE * 2 + sizeof(".new.txt")];
 
+    snprintf(name, sizeof(name), "%.*s.new.idx", TOX_PUBLIC_KEY_SIZE * 2, hex);
+    utox_remove_file((uint8_t*)name, sizeof(name));
+
     snprintf(name, sizeof(name), "%.*s.new.txt", TOX_PUBLIC_KEY_SIZE * 2, hex);
 
-    return utox_remove_file((uint8_t*)name, sizeof(name));
+    const bool removed = utox_remove_file((uint8_t*)name, sizeof(name));
+    if (log) {
+        chatlog_writer_release(log, true);
+    }
+
+    return removed;
 }
 
 void utox_export_chatlog_init(uint32_t friend_number) {
@@ -215,6 +957,8 @@ void utox_export_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], FILE *dest_file) {
 
     struct tm tm_prev = { .tm_mday = 1 };
 
+    CHATLOG_OPEN_LOG *log = chatlog_writer_hold(hex);
+
     LOG_FILE_MSG_HEADER header;
     FILE *file = chatlog_get_file(hex, false);
 
@@ -264,4 +1008,8 @@ void utox_export_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], FILE *dest_file) {
 
     fclose(file);
     fclose(dest_file);
+
+    if (log) {
+        chatlog_writer_release(log, false);
+    }
 }
@@ -26,27 +26,57 @@ typedef struct {
     uint8_t zeroes[2];
 } LOG_FILE_MSG_HEADER;
 
+/* Every chat log <hex>.new.txt has a sidecar index <hex>.new.idx, a LOG_FILE_INDEX_HEADER followed by one
+ * LOG_FILE_INDEX_ENTRY per record. It lets us jump straight to any record without walking the whole log.
+ * The index is only a cache, if it's missing or doesn't match the log it's rebuilt from the log. */
+#define LOGFILE_INDEX_VERSION 1
+typedef struct {
+    uint8_t  magic[4];
+    uint32_t version;
+    // Number of bytes of the log file covered by the entries in this index.
+    uint64_t log_size;
+} LOG_FILE_INDEX_HEADER;
+
+typedef struct {
+    uint64_t offset;
+    int64_t  time;
+} LOG_FILE_INDEX_ENTRY;
+
 
 typedef struct msg_header MSG_HEADER;
 
+/* Messages read from the log by a single call to utox_load_chatlog() share one allocation, their headers
+ * and their text live in this slab, which is freed once every message in it has been released. */
+typedef struct chatlog_slab CHATLOG_SLAB;
+
+/**
+ * Releases one message's reference on its slab, freeing the slab with the last one.
+ */
+void chatlog_slab_release(CHATLOG_SLAB *slab);
+
 /**
  * Saves chat log for friend with id hex
  *
- * Returns the offset on success
+ * The record is queued and written out by the log writer thread shortly after, see utox_flush_chatlogs().
+ * Returns the offset the record will be written at on success
  * Returns 0 on failure
  */
 size_t utox_save_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], uint8_t *data, size_t length);
 
 // This one actually does the work of reading the logfile information.
+// The messages returned are backed by a CHATLOG_SLAB, see msg->slab.
 MSG_HEADER **utox_load_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t *size, uint32_t count, uint32_t skip);
 
 /** utox_update_chatlog Updates the data for this friend's history.
  *
  * When given a friend_number and offset, utox_update_chatlog will overwrite the file, with
  * the supplied data * length. It makes no attempt to verify the data or length, it'll just
- * write blindly. */
+ * write blindly. Like utox_save_chatlog() the write is queued. */
 bool utox_update_chatlog(char hex[TOX_PUBLIC_KEY_SIZE * 2], size_t offset, uint8_t *data, size_t length);
 
+/* Writes out every queued chat log write and closes the logs. */
+void utox_flush_chatlogs(void);
+
 /**
  * Deletes the chat log file for the friend with id hex
  *
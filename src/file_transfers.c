@@ -3,6 +3,7 @@
 #include "avatar.h"
 #include "friend.h"
 #include "macros.h"
+#include "messages.h"
 #include "self.h"
 #include "settings.h"
 #include "text.h"
@@ -14,14 +15,37 @@
 #include "native/thread.h"
 #include "native/time.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 
+// How many incoming transfers a friend can have at once, MAX_FILE_TRANSFERS is for outgoing ones.
 #define MAX_INCOMING_COUNT 32
 
 #define MAX_INLINE_FILESIZE (1024 * 1024 * 4)
 
+// How much of an outgoing file we map at a time.
+#define FILE_MAP_WINDOW_SIZE (1024 * 1024 * 4)
+
+/* How much of an incoming file we collect before writing it out, writes start at a multiple of it
+ * when the chunks allow. Whatever we have is written out after FILE_WRITE_BUFFER_TIME ns anyway, see
+ * ft_write_schedule(). */
+#define FILE_WRITE_BUFFER_SIZE (1024 * 256)
+#define FILE_WRITE_BUFFER_TIME (1000 * 1000 * 1000)
+
+// How many buffers of a transfer can wait for the writer thread before the toxcore thread waits too.
+#define FILE_WRITES_IN_FLIGHT 8
+
+// How much of an outgoing file is hashed at a time by ft_hash_file().
+#define FILE_HASH_BLOCK_SIZE (1024 * 1024)
+
+// Outgoing files this big are bulk, they wait in line and are held back by the rate limit.
+#define FILE_BULK_SIZE (1024 * 1024 * 8)
+
+// The biggest chunk toxcore asks for.
+#define FILE_CHUNK_SIZE 1371
+
 static void fid_to_string(char *dest, uint8_t *src) {
     to_hex(dest, src, TOX_FILE_ID_LENGTH);
 }
@@ -37,56 +61,261 @@ static uint32_t detox_incoming_file_number(uint32_t file_number) {
     return (file_number >> 16) - 1;
 }
 
-static FILE_TRANSFER *get_file_transfer(uint32_t friend_number, uint32_t file_number) {
-    FRIEND *f = get_friend(friend_number);
-    if (!f) {
-        return NULL;
+/* Every FILE_TRANSFER lives in a slot of ft_pages, pages are allocated as needed and never move or go away,
+ * so a pointer to a transfer stays good for as long as uTox runs. ft_table maps (friend, file number) to
+ * the slot of the transfer, with linear probing. ft_lock guards the pages, the table and the free slots. */
+#define FT_PAGE_SLOTS 64
+#define FT_MAX_PAGES  64
+#define FT_MAX_SLOTS  (FT_PAGE_SLOTS * FT_MAX_PAGES)
+#define FT_TABLE_SIZE (FT_MAX_SLOTS * 2)
+
+typedef struct {
+    uint32_t friend_number, file_number;
+    // Slot + 1, 0 if this entry is empty.
+    uint32_t slot;
+} FT_TABLE_ENTRY;
+
+static pthread_mutex_t ft_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FILE_TRANSFER  *ft_pages[FT_MAX_PAGES];
+static uint32_t        ft_slot_count;
+static uint32_t        ft_free_slots[FT_MAX_SLOTS];
+static uint32_t        ft_free_count;
+static FT_TABLE_ENTRY  ft_table[FT_TABLE_SIZE];
+
+static FILE_TRANSFER *ft_slot(uint32_t slot) {
+    return &ft_pages[slot / FT_PAGE_SLOTS][slot % FT_PAGE_SLOTS];
+}
+
+static uint32_t ft_table_hash(uint32_t friend_number, uint32_t file_number) {
+    return ((friend_number * 2654435761u) ^ (file_number * 2246822519u)) % FT_TABLE_SIZE;
+}
+
+// Returns the entry for the transfer, or the empty entry where it would go.
+static FT_TABLE_ENTRY *ft_table_find(uint32_t friend_number, uint32_t file_number) {
+    uint32_t i = ft_table_hash(friend_number, file_number);
+    while (ft_table[i].slot
+           && (ft_table[i].friend_number != friend_number || ft_table[i].file_number != file_number))
+    {
+        i = (i + 1) % FT_TABLE_SIZE;
     }
 
-    if (is_incoming_ft(file_number)) {
-        file_number = detox_incoming_file_number(file_number);
-        if (f->ft_incoming_size && f->ft_incoming_size >= file_number) {
-            return &f->ft_incoming[file_number];
+    return &ft_table[i];
+}
+
+static void ft_table_remove(FT_TABLE_ENTRY *entry) {
+    uint32_t hole = entry - ft_table;
+    ft_table[hole].slot = 0;
+
+    // Move back the entries after the hole that can't be found past it anymore.
+    for (uint32_t i = (hole + 1) % FT_TABLE_SIZE; ft_table[i].slot; i = (i + 1) % FT_TABLE_SIZE) {
+        const uint32_t home = ft_table_hash(ft_table[i].friend_number, ft_table[i].file_number);
+        if ((i > hole && (home <= hole || home > i)) || (i < hole && home <= hole && home > i)) {
+            ft_table[hole]      = ft_table[i];
+            ft_table[i].slot    = 0;
+            hole                = i;
+        }
+    }
+}
+
+static uint32_t ft_slot_new(void) {
+    if (ft_free_count) {
+        return ft_free_slots[--ft_free_count];
+    }
+
+    if (ft_slot_count == FT_MAX_SLOTS) {
+        return UINT32_MAX;
+    }
+
+    const uint32_t page = ft_slot_count / FT_PAGE_SLOTS;
+    if (!ft_pages[page]) {
+        ft_pages[page] = calloc(FT_PAGE_SLOTS, sizeof(FILE_TRANSFER));
+        if (!ft_pages[page]) {
+            return UINT32_MAX;
         }
-    } else if (f->ft_outgoing_size && f->ft_outgoing_size >= file_number) {
-        return &f->ft_outgoing[file_number];
     }
 
-    return NULL;
+    return ft_slot_count++;
 }
 
+/* Returns the transfer, NULL if there's no such transfer. For the toxcore thread, which is the only one that
+ * frees transfers, any other thread has to do what it needs under ft_lock instead. */
+FILE_TRANSFER *get_file_transfer(uint32_t friend_number, uint32_t file_number) {
+    pthread_mutex_lock(&ft_lock);
+
+    FT_TABLE_ENTRY *entry = ft_table_find(friend_number, file_number);
+    FILE_TRANSFER  *ft    = entry->slot ? ft_slot(entry->slot - 1) : NULL;
+
+    pthread_mutex_unlock(&ft_lock);
+    return ft;
+}
+
+/* Returns the slot for a new transfer, or the one it already has. Returns NULL when the friend already
+ * has as many transfers as they're allowed in that direction, or we're out of slots. */
 static FILE_TRANSFER *make_file_transfer(uint32_t friend_number, uint32_t file_number) {
     FRIEND *f = get_friend(friend_number);
     if (!f) {
         return NULL;
     }
 
-    if (is_incoming_ft(file_number)) {
-        file_number = detox_incoming_file_number(file_number);
-        if (f->ft_incoming_size <= file_number) {
-            FILE_TRANSFER *new_ftlist = realloc(f->ft_incoming, sizeof(FILE_TRANSFER) * (file_number + 1));
-            if (!new_ftlist) {
-                return NULL;
-            }
+    pthread_mutex_lock(&ft_lock);
+
+    FT_TABLE_ENTRY *entry = ft_table_find(friend_number, file_number);
+    if (entry->slot) {
+        FILE_TRANSFER *ft = ft_slot(entry->slot - 1);
+        pthread_mutex_unlock(&ft_lock);
+        return ft;
+    }
+
+    const bool full = is_incoming_ft(file_number) ? f->ft_incoming_active_count >= MAX_INCOMING_COUNT
+                                                  : f->ft_outgoing_active_count >= MAX_FILE_TRANSFERS;
+    const uint32_t slot = full ? UINT32_MAX : ft_slot_new();
+    if (slot == UINT32_MAX) {
+        pthread_mutex_unlock(&ft_lock);
+        return NULL;
+    }
 
-            f->ft_incoming = new_ftlist;
-            f->ft_incoming_size = file_number + 1;
+    entry->friend_number = friend_number;
+    entry->file_number   = file_number;
+    entry->slot          = slot + 1;
+
+    FILE_TRANSFER *ft = ft_slot(slot);
+    memset(ft, 0, sizeof(FILE_TRANSFER));
+
+    pthread_mutex_unlock(&ft_lock);
+    return ft;
+}
+
+/* Clears the transfer and gives its slot back. Done under ft_lock, so whoever holds it sees the transfer
+ * either as it was or gone. */
+static void free_file_transfer(FILE_TRANSFER *ft, uint32_t friend_number, uint32_t file_number) {
+    pthread_mutex_lock(&ft_lock);
+
+    memset(ft, 0, sizeof(FILE_TRANSFER));
+
+    FT_TABLE_ENTRY *entry = ft_table_find(friend_number, file_number);
+    if (entry->slot) {
+        ft_free_slots[ft_free_count++] = entry->slot - 1;
+        ft_table_remove(entry);
+    }
+
+    pthread_mutex_unlock(&ft_lock);
+}
+
+/* What the UI shows of every transfer, by slot. The toxcore thread publishes into it as often as it likes,
+ * the UI copies what changed into the messages on FILE_STATUS_UPDATE. Only one of those is ever on its way,
+ * and not more often than every FT_PROGRESS_INTERVAL ns unless the status of a transfer changed. Changes
+ * that came too soon to be posted are pending, ft_progress_schedule() posts them once the interval is up. */
+#define FT_PROGRESS_INTERVAL (1000 * 1000 * 1000 / 60)
+
+typedef struct {
+    MSG_HEADER *ui_data;
+    uint64_t    progress;
+    uint32_t    speed;
+    uint8_t     status;
+    bool        changed;
+} FT_PROGRESS;
+
+static pthread_mutex_t ft_progress_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FT_PROGRESS ft_progress[FT_MAX_SLOTS];
+static uint32_t    ft_progress_end;
+static bool        ft_progress_posted, ft_progress_pending;
+static uint64_t    ft_progress_time;
+
+static uint32_t ft_slot_index(FILE_TRANSFER *ft) {
+    for (uint32_t page = 0; page < FT_MAX_PAGES && ft_pages[page]; ++page) {
+        if (ft >= ft_pages[page] && ft < ft_pages[page] + FT_PAGE_SLOTS) {
+            return page * FT_PAGE_SLOTS + (ft - ft_pages[page]);
         }
+    }
 
-        return &f->ft_incoming[file_number];
+    return UINT32_MAX;
+}
+
+/* Publishes the progress and status of ft for the UI. now skips the wait for FT_PROGRESS_INTERVAL. */
+static void ft_progress_publish(FILE_TRANSFER *ft, bool now) {
+    const uint32_t slot = ft_slot_index(ft);
+    if (slot == UINT32_MAX) {
+        return;
     }
 
-    if (f->ft_outgoing_size <= file_number) {
-        FILE_TRANSFER *new_ftlist = realloc(f->ft_outgoing, sizeof(FILE_TRANSFER) * (file_number + 1));
-        if (!new_ftlist) {
-            return NULL;
+    // The UI thread sets ui_data under ft_lock, and ft_progress with it.
+    pthread_mutex_lock(&ft_lock);
+    pthread_mutex_lock(&ft_progress_lock);
+
+    FT_PROGRESS *progress = &ft_progress[slot];
+    progress->ui_data  = ft->ui_data;
+    progress->progress = ft->current_size;
+    progress->speed    = ft->speed;
+    progress->status   = ft->status;
+    progress->changed  = true;
+
+    if (ft_progress_end <= slot) {
+        ft_progress_end = slot + 1;
+    }
+
+    const uint64_t time = get_time();
+    const bool post = !ft_progress_posted && (now || time - ft_progress_time >= FT_PROGRESS_INTERVAL);
+    if (post) {
+        ft_progress_posted = true;
+        ft_progress_time   = time;
+    }
+    // A post on its way picks this up too.
+    ft_progress_pending = !ft_progress_posted;
+
+    pthread_mutex_unlock(&ft_progress_lock);
+    pthread_mutex_unlock(&ft_lock);
+
+    if (post) {
+        postmessage_utox(FILE_STATUS_UPDATE, 0, 0, NULL);
+    }
+}
+
+uint64_t ft_progress_schedule(uint64_t time) {
+    pthread_mutex_lock(&ft_progress_lock);
+
+    if (!ft_progress_pending) {
+        pthread_mutex_unlock(&ft_progress_lock);
+        return UINT64_MAX;
+    }
+
+    if (time - ft_progress_time < FT_PROGRESS_INTERVAL) {
+        const uint64_t wait = ft_progress_time + FT_PROGRESS_INTERVAL - time;
+        pthread_mutex_unlock(&ft_progress_lock);
+        return wait;
+    }
+
+    ft_progress_posted  = true;
+    ft_progress_pending = false;
+    ft_progress_time    = time;
+
+    pthread_mutex_unlock(&ft_progress_lock);
+
+    postmessage_utox(FILE_STATUS_UPDATE, 0, 0, NULL);
+    return UINT64_MAX;
+}
+
+void ft_progress_update(void) {
+    pthread_mutex_lock(&ft_progress_lock);
+
+    for (uint32_t i = 0; i < ft_progress_end; ++i) {
+        FT_PROGRESS *progress = &ft_progress[i];
+        if (!progress->changed) {
+            continue;
         }
 
-        f->ft_outgoing = new_ftlist;
-        f->ft_outgoing_size = file_number + 1;
+        if (progress->ui_data) {
+            progress->ui_data->via.ft.progress    = progress->progress;
+            progress->ui_data->via.ft.speed       = progress->speed;
+            progress->ui_data->via.ft.file_status = progress->status;
+        }
+        progress->changed = false;
     }
+    ft_progress_posted  = false;
+    ft_progress_pending = false;
 
-    return &f->ft_outgoing[file_number];
+    pthread_mutex_unlock(&ft_progress_lock);
 }
 
 /* Calculate the transfer speed for the UI. */
@@ -113,12 +342,25 @@ static void calculate_speed(FILE_TRANSFER *file) {
         file->last_check_transferred = file->current_size;
     }
 
-    FILE_TRANSFER *msg = calloc(1, sizeof(FILE_TRANSFER));
-
-    *msg = *file;
-    postmessage_utox(FILE_STATUS_UPDATE, file->status, 0, msg);
+    ft_progress_publish(file, false);
 }
 
+/* Files waiting to be sent, oldest first. Only touched by the toxcore thread. */
+static UTOX_MSG_FT *ft_send_first, *ft_send_last;
+static bool         ft_send_queue_changed;
+
+// Transfers with chunks held back, and how many bytes we may send before holding more back.
+static uint32_t ft_deferred_count;
+static int64_t  ft_send_tokens;
+static uint64_t ft_send_tokens_time;
+// What the last top up earned short of a whole byte, in bytes * ns / s.
+static uint64_t ft_send_tokens_owed;
+
+// Incoming transfers holding a write buffer, and transfers a write failed for.
+static uint32_t ft_buffered_count, ft_write_failures;
+
+static void ft_writes_wait(FILE_TRANSFER *ft, uint32_t pending);
+
 static void ft_decon(uint32_t friend_number, uint32_t file_number) {
     FILE_TRANSFER *ft = get_file_transfer(friend_number, file_number);
     if (!ft) {
@@ -130,6 +372,12 @@ static void ft_decon(uint32_t friend_number, uint32_t file_number) {
             yieldcpu(10);
         }
 
+        // The writer thread has to be done with the file before it's closed.
+        ft_writes_wait(ft, 0);
+        if (ft->write_failed) {
+            ft_write_failures--;
+        }
+
         if (ft->incoming) {
             get_friend(friend_number)->ft_incoming_active_count--;
         } else {
@@ -145,11 +393,31 @@ static void ft_decon(uint32_t friend_number, uint32_t file_number) {
         } else if (ft->avatar) {
             // free(ft->via.avatar)?
         } else if (ft->via.file) {
+            native_unmap_file(ft->map, ft->map_offset, ft->map_length);
             fclose(ft->via.file);
         }
+
+        free(ft->chunk_buffer);
+        if (ft->write_buffer) {
+            free(ft->write_buffer);
+            ft_buffered_count--;
+        }
+
+        if (ft->deferred_length) {
+            ft_deferred_count--;
+        }
+
+        if (!ft->incoming) {
+            // Someone waiting in line might get to go now.
+            ft_send_queue_changed = true;
+        }
+
+        if (ft->resume_file) {
+            fclose(ft->resume_file);
+        }
     }
 
-    memset(ft, 0, sizeof(FILE_TRANSFER));
+    free_file_transfer(ft, friend_number, file_number);
 }
 
 static bool resumeable_name(FILE_TRANSFER *ft, char *name) {
@@ -171,15 +439,44 @@ static bool resumeable_name(FILE_TRANSFER *ft, char *name) {
     return true;
 }
 
+static const uint8_t ft_resume_magic[4] = { 'u', 'F', 'T', 'R' };
+
+// FNV-1a, to catch resume files that were cut short or mangled.
+static uint32_t ft_resume_checksum(uint32_t hash, const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ data[i]) * 16777619;
+    }
+    return hash;
+}
+
+static void ft_resume_record(FILE_TRANSFER *ft, FT_RESUME_RECORD *record) {
+    memset(record, 0, sizeof(*record));
+    memcpy(record->magic, ft_resume_magic, sizeof(record->magic));
+    record->version     = FT_RESUME_VERSION;
+    record->path_length = strnlen((char *)ft->path, sizeof(ft->path) - 1);
+    record->incoming    = ft->incoming;
+    record->range_count = ft->resume_range_count;
+    record->target_size = ft->target_size;
+    memcpy(record->data_hash, ft->data_hash, TOX_HASH_LENGTH);
+    memcpy(record->range, ft->resume_range, sizeof(record->range));
+
+    uint32_t checksum = ft_resume_checksum(2166136261, (uint8_t *)record, sizeof(*record));
+    record->checksum  = ft_resume_checksum(checksum, ft->path, record->path_length);
+}
+
+/* Rewrites the record and the path in place at the start of the resume file. */
 static bool ft_update_resumable(FILE_TRANSFER *ft) {
-    // Check if resume_file is a valid file pointer.
-    struct stat buffer;
-    if (fstat(fileno(ft->resume_file), &buffer) != 0) {
+    if (!ft->resume_file) {
         return false;
     }
 
-    fseeko(ft->resume_file, SEEK_SET, 0);
-    if (fwrite(ft, sizeof(FILE_TRANSFER), 1, ft->resume_file) != 1) {
+    FT_RESUME_RECORD record;
+    ft_resume_record(ft, &record);
+
+    if (fseeko(ft->resume_file, 0, SEEK_SET)
+        || fwrite(&record, sizeof(record), 1, ft->resume_file) != 1
+        || fwrite(ft->path, 1, record.path_length, ft->resume_file) != record.path_length)
+    {
         return false;
     }
 
@@ -187,8 +484,52 @@ static bool ft_update_resumable(FILE_TRANSFER *ft) {
     return true;
 }
 
+/* Marks the bytes from start to end of an incoming file as on disk. If that's more ranges than the record
+ * holds, the last one is forgotten, those bytes will just be sent again. */
+static void ft_resume_add_range(FILE_TRANSFER *ft, uint64_t start, uint64_t end) {
+    FILE_TRANSFER_RANGE *range = ft->resume_range;
+    uint8_t count = ft->resume_range_count;
+
+    // Find the first range this one touches or comes before.
+    uint8_t i = 0;
+    while (i < count && range[i].end < start) {
+        ++i;
+    }
+
+    // Swallow every range it touches.
+    uint8_t j = i;
+    while (j < count && range[j].start <= end) {
+        start = range[j].start < start ? range[j].start : start;
+        end   = range[j].end > end ? range[j].end : end;
+        ++j;
+    }
+
+    if (i == j) {
+        // It touches nothing, make room for it.
+        if (count == FT_RESUME_MAX_RANGES) {
+            if (i == count) {
+                return;
+            }
+            --count;
+        }
+        memmove(&range[i + 1], &range[i], (count - i) * sizeof(*range));
+        ++count;
+    } else if (j - i > 1) {
+        memmove(&range[i + 1], &range[j], (count - j) * sizeof(*range));
+        count -= j - i - 1;
+    }
+
+    range[i].start = start;
+    range[i].end   = end;
+    ft->resume_range_count = count;
+}
+
 /* Create the file transfer resume info file. */
 static bool ft_init_resumable(FILE_TRANSFER *ft) {
+    if (ft->in_memory || ft->avatar) {
+        return false;
+    }
+
     char name[UTOX_FILE_NAME_LENGTH];
     if (!resumeable_name(ft, name)) {
         return false;
@@ -204,6 +545,11 @@ static bool ft_init_resumable(FILE_TRANSFER *ft) {
 
 /* Free/Remove/Unlink the file transfer resume info file. */
 static void ft_decon_resumable(FILE_TRANSFER *ft) {
+    if (ft->resume_file) {
+        fclose(ft->resume_file);
+        ft->resume_file = NULL;
+    }
+
     char name[UTOX_FILE_NAME_LENGTH];
     if (!resumeable_name(ft, name)) {
         return;
@@ -218,6 +564,205 @@ static void ft_decon_resumable(FILE_TRANSFER *ft) {
     utox_get_file(name, NULL, UTOX_FILE_OPTS_DELETE);
 }
 
+/* Full write buffers of incoming files, on their way to disk. The toxcore thread hands them to a
+ * single writer thread, started with the first one, and carries on. The writer hands them back once
+ * they're written, and the toxcore thread claims the bytes in the resume info. ft_write_lock guards
+ * the lists. */
+typedef struct ft_write {
+    FILE_TRANSFER *ft;
+    FILE          *file;
+    uint8_t       *buffer;
+    uint64_t       offset;
+    size_t         length;
+    bool           written;
+
+    struct ft_write *next;
+} FT_WRITE;
+
+static pthread_mutex_t ft_write_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  ft_write_cond = PTHREAD_COND_INITIALIZER, ft_written_cond = PTHREAD_COND_INITIALIZER;
+static FT_WRITE *      ft_write_first, *ft_write_last, *ft_written_first, *ft_written_last;
+static bool            ft_write_running;
+
+static void ft_write_thread(void *UNUSED(args)) {
+    while (1) {
+        pthread_mutex_lock(&ft_write_lock);
+        while (!ft_write_first) {
+            pthread_cond_wait(&ft_write_cond, &ft_write_lock);
+        }
+
+        FT_WRITE *write = ft_write_first;
+        ft_write_first  = write->next;
+        if (!ft_write_first) {
+            ft_write_last = NULL;
+        }
+        pthread_mutex_unlock(&ft_write_lock);
+
+        uint8_t count = 10;
+        while (!file_lock(write->file, write->offset, write->length)) {
+            yieldcpu(10);
+            if (count == 0) {
+                break;
+            }
+            count--;
+            // If you get a bug report about this hanging utox, just disable it, it's unlikely to be needed!
+        }
+
+        write->written = !fseeko(write->file, write->offset, SEEK_SET)
+                         && fwrite(write->buffer, 1, write->length, write->file) == write->length;
+        fflush(write->file);
+        file_unlock(write->file, write->offset, write->length);
+
+        write->next = NULL;
+
+        pthread_mutex_lock(&ft_write_lock);
+        if (ft_written_last) {
+            ft_written_last->next = write;
+        } else {
+            ft_written_first = write;
+        }
+        ft_written_last = write;
+        pthread_cond_broadcast(&ft_written_cond);
+        pthread_mutex_unlock(&ft_write_lock);
+    }
+}
+
+static void ft_write_fail(FILE_TRANSFER *ft) {
+    if (!ft->write_failed) {
+        ft->write_failed = true;
+        ft_write_failures++;
+    }
+}
+
+/* Takes back the buffers the writer thread is done with. The bytes that made it to disk go into the
+ * resume info, a transfer whose write failed is dealt with by ft_write_schedule(). */
+static void ft_writes_done(FT_WRITE *write) {
+    while (write) {
+        FT_WRITE      *next = write->next;
+        FILE_TRANSFER *ft   = write->ft;
+
+        ft->writes_pending--;
+        if (write->written) {
+            // Only now is it safe to claim these bytes in the resume info.
+            ft_resume_add_range(ft, write->offset, write->offset + write->length);
+            if (ft->resumeable) {
+                ft_update_resumable(ft);
+            }
+        } else {
+            ft_write_fail(ft);
+        }
+
+        free(write->buffer);
+        free(write);
+        write = next;
+    }
+}
+
+// Waits until the writer thread has no more than pending buffers of ft left.
+static void ft_writes_wait(FILE_TRANSFER *ft, uint32_t pending) {
+    while (ft->writes_pending > pending) {
+        pthread_mutex_lock(&ft_write_lock);
+        while (!ft_written_first) {
+            pthread_cond_wait(&ft_written_cond, &ft_write_lock);
+        }
+
+        FT_WRITE *written = ft_written_first;
+        ft_written_first = ft_written_last = NULL;
+        pthread_mutex_unlock(&ft_write_lock);
+
+        ft_writes_done(written);
+    }
+}
+
+/* Hands the buffered chunks of an incoming file to the writer thread. The resume info is updated once
+ * they're on disk. Does nothing for anything else. Returns false if a write of the file failed. */
+static bool ft_flush_writes(FILE_TRANSFER *ft) {
+    if (!ft->write_length || ft->write_failed) {
+        return !ft->write_failed;
+    }
+
+    FT_WRITE *write = calloc(1, sizeof(FT_WRITE));
+    if (!write) {
+        ft_write_fail(ft);
+        return false;
+    }
+
+    write->ft     = ft;
+    write->file   = ft->via.file;
+    write->buffer = ft->write_buffer;
+    write->offset = ft->write_offset;
+    write->length = ft->write_length;
+
+    // The next chunk starts a new buffer.
+    ft->write_buffer = NULL;
+    ft->write_length = 0;
+    ft_buffered_count--;
+    ft->writes_pending++;
+
+    pthread_mutex_lock(&ft_write_lock);
+    if (ft_write_last) {
+        ft_write_last->next = write;
+    } else {
+        ft_write_first = write;
+    }
+    ft_write_last = write;
+
+    if (!ft_write_running) {
+        ft_write_running = true;
+        thread(ft_write_thread, NULL);
+    }
+    pthread_cond_signal(&ft_write_cond);
+    pthread_mutex_unlock(&ft_write_lock);
+
+    // Only hold up the toxcore thread when the disk can't keep up.
+    ft_writes_wait(ft, FILE_WRITES_IN_FLIGHT);
+    return !ft->write_failed;
+}
+
+/* Adds a chunk of an incoming file to its write buffer, handing the buffer to the writer thread
+ * whenever it's full or the chunk doesn't follow on from it. Returns false if a write failed. */
+static bool ft_buffer_write(FILE_TRANSFER *ft, uint64_t position, const uint8_t *data, size_t length) {
+    if (ft->write_length && position != ft->write_offset + ft->write_length && !ft_flush_writes(ft)) {
+        return false;
+    }
+
+    while (length) {
+        if (!ft->write_buffer) {
+            ft->write_buffer = malloc(FILE_WRITE_BUFFER_SIZE);
+            if (!ft->write_buffer) {
+                return false;
+            }
+            ft_buffered_count++;
+        }
+
+        if (!ft->write_length) {
+            ft->write_offset = position;
+            ft->write_time   = get_time();
+        }
+
+        // Stop at the next multiple of the buffer size, so the following writes line up with it.
+        const size_t room = FILE_WRITE_BUFFER_SIZE - ft->write_offset % FILE_WRITE_BUFFER_SIZE - ft->write_length;
+        const size_t size = length < room ? length : room;
+
+        memcpy(ft->write_buffer + ft->write_length, data, size);
+        ft->write_length += size;
+
+        position += size;
+        data     += size;
+        length   -= size;
+
+        if (size == room && !ft_flush_writes(ft)) {
+            return false;
+        }
+    }
+
+    return !ft->write_failed;
+}
+
+/* Loads what the resume file of ft remembers about it into ft. An incoming ft needs its target_size to
+ * match, and picks up at the end of the bytes it already has on disk.
+ *
+ * Returns false if there's no resume file we can use. */
 static bool ft_find_resumeable(FILE_TRANSFER *ft) {
     char resume_name[UTOX_FILE_NAME_LENGTH];
     if (!resumeable_name(ft, resume_name)) {
@@ -232,44 +777,67 @@ static bool ft_find_resumeable(FILE_TRANSFER *ft) {
         return false;
     }
 
-    if (size != sizeof(FILE_TRANSFER)) {
+    FT_RESUME_RECORD record;
+    uint8_t path[sizeof(ft->path)];
+
+    // A longer path can be left behind the one in the record, we just don't read it.
+    if (size < sizeof(record)
+        || fread(&record, sizeof(record), 1, resume_disk) != 1
+        || record.path_length >= sizeof(path)
+        || size - sizeof(record) < record.path_length)
+    {
         fclose(resume_disk);
         return false;
     }
 
-    FILE_TRANSFER resume_file;
-    bool read_resumeable = fread(&resume_file, size, 1, resume_disk);
+    const size_t path_length = record.path_length;
+    const bool read_path = fread(path, 1, path_length, resume_disk) == path_length;
     fclose(resume_disk);
 
-    if (!read_resumeable) {
-        return false;
-    }
-
-    if (!resume_file.resumeable
-        || !resume_file.in_use
-        || resume_file.in_memory
-        || resume_file.avatar
-        || resume_file.inline_img)
+    const uint32_t checksum = record.checksum;
+    record.checksum = 0;
+
+    if (!read_path
+        || memcmp(record.magic, ft_resume_magic, sizeof(record.magic)) != 0
+        || record.version != FT_RESUME_VERSION
+        || !path_length
+        || record.range_count > FT_RESUME_MAX_RANGES
+        || record.incoming != ft->incoming
+        || (ft->incoming && record.target_size != ft->target_size)
+        || ft_resume_checksum(ft_resume_checksum(2166136261, (uint8_t *)&record, sizeof(record)), path, path_length)
+               != checksum)
     {
         return false;
     }
 
-    memcpy(ft, &resume_file, sizeof(FILE_TRANSFER));
+    memcpy(ft->path, path, path_length);
+    ft->path[path_length] = 0;
+
+    ft->target_size = record.target_size;
+    memcpy(ft->data_hash, record.data_hash, TOX_HASH_LENGTH);
+
+    ft->resume_range_count = record.range_count;
+    memcpy(ft->resume_range, record.range, sizeof(ft->resume_range));
+
+    ft->current_size = 0;
+    if (ft->resume_range_count && ft->resume_range[0].start == 0) {
+        ft->current_size = ft->resume_range[0].end;
+    }
 
     ft->name_length = 0;
-    uint8_t *p = ft->path + strlen((char *)ft->path);
-    while (*--p != '/' && *p != '\\') {
+    uint8_t *p = ft->path + path_length;
+    while (p > ft->path && p[-1] != '/' && p[-1] != '\\') {
+        --p;
         ++ft->name_length;
     }
-    ++p;
-    ++ft->name_length;
 
+    free(ft->name);
     ft->name = calloc(1, ft->name_length + 1);
-    snprintf((char *)ft->name, ft->name_length + 1, "%s", p);
-
-    ft->via.file = NULL;
-    ft->resume_file = NULL;
-    ft->ui_data = NULL;
+    if (!ft->name) {
+        ft->name_length = 0;
+        return true;
+    }
+    memcpy(ft->name, p, ft->name_length);
 
     return true;
 }
@@ -291,6 +859,8 @@ static void kill_file(FILE_TRANSFER *file) {
     file->status = FILE_TRANSFER_STATUS_KILLED;
     postmessage_utox(FILE_STATUS_DONE, file->status, 0, file->ui_data);
 
+    // Writes still in flight would bring the resume info back.
+    ft_writes_wait(file, 0);
     if (file->resumeable) {
         ft_decon_resumable(file);
     }
@@ -323,6 +893,9 @@ static void break_file(FILE_TRANSFER *file) {
     file->status = FILE_TRANSFER_STATUS_BROKEN;
     postmessage_utox(FILE_STATUS_DONE, file->status, 0, file->ui_data);
 
+    ft_flush_writes(file);
+    ft_writes_wait(file, 0);
+
     if (file->resumeable) {
         ft_update_resumable(file);
     }
@@ -332,6 +905,9 @@ static void break_file(FILE_TRANSFER *file) {
 
 /* Pause active file. */
 static void utox_pause_file(FILE_TRANSFER *file, bool us) {
+    // Don't keep anything in memory while we wait on a paused file.
+    ft_flush_writes(file);
+
     switch (file->status) {
         case FILE_TRANSFER_STATUS_BROKEN:
         case FILE_TRANSFER_STATUS_COMPLETED:
@@ -380,11 +956,7 @@ static void utox_pause_file(FILE_TRANSFER *file, bool us) {
         }
     }
 
-    FILE_TRANSFER *msg = calloc(1, sizeof(FILE_TRANSFER));
-
-    *msg = *file;
-    postmessage_utox(FILE_STATUS_UPDATE, file->status, 0, msg);
-    // TODO free not freed data.
+    ft_progress_publish(file, true);
 }
 
 /* Start/Resume active file. */
@@ -417,10 +989,7 @@ static void run_file_local(FILE_TRANSFER *file) {
         }
     }
 
-    FILE_TRANSFER *msg = calloc(1, sizeof(FILE_TRANSFER));
-
-    *msg = *file;
-    postmessage_utox(FILE_STATUS_UPDATE, file->status, 0, msg);
+    ft_progress_publish(file, true);
 }
 
 static void run_file_remote(FILE_TRANSFER *file) {
@@ -442,10 +1011,7 @@ static void run_file_remote(FILE_TRANSFER *file) {
         }
     }
 
-    FILE_TRANSFER *msg = calloc(1, sizeof(FILE_TRANSFER));
-
-    *msg = *file;
-    postmessage_utox(FILE_STATUS_UPDATE, file->status, 0, msg);
+    ft_progress_publish(file, true);
 }
 
 static void decode_inline_png(uint32_t friend_id, uint8_t *data, uint64_t size) {
@@ -466,10 +1032,16 @@ static void decode_inline_png(uint32_t friend_id, uint8_t *data, uint64_t size)
 
 /* Complete active file, (when the whole file transfer is successful). */
 static void utox_complete_file(FILE_TRANSFER *file) {
-    FILE_TRANSFER *msg = calloc(1, sizeof(FILE_TRANSFER));
+    // It's only done once all of it is on disk.
+    ft_flush_writes(file);
+    ft_writes_wait(file, 0);
+    if (file->write_failed) {
+        // The last of it didn't make it to disk, keep the resume info so the file can be resumed.
+        break_file(file);
+        return;
+    }
 
-    *msg = *file;
-    postmessage_utox(FILE_STATUS_UPDATE, file->status, 0, msg);
+    ft_progress_publish(file, true);
 
     if (file->status == FILE_TRANSFER_STATUS_ACTIVE) {
         file->status = FILE_TRANSFER_STATUS_COMPLETED;
@@ -494,7 +1066,7 @@ static void utox_complete_file(FILE_TRANSFER *file) {
 }
 
 /* Friend has come online, restart our outgoing transfers to this friend. */
-void ft_friend_online(Tox *tox, uint32_t friend_number) {
+void ft_friend_online(Tox *UNUSED(tox), uint32_t friend_number) {
     for (uint16_t i = 0; i < MAX_FILE_TRANSFERS; i++) {
         FILE_TRANSFER *file = calloc(1, sizeof(FILE_TRANSFER));
         file->friend_number = friend_number;
@@ -503,27 +1075,34 @@ void ft_friend_online(Tox *tox, uint32_t friend_number) {
         ft_find_resumeable(file);
         if (file->path[0]) {
             /* If we got a path from utox_file_load we should try to resume! */
-            file->via.file = fopen((char *)file->path, "rb+");
-            ft_send_file(tox, friend_number, file->via.file, file->path, strlen((char *)file->path), file->data_hash);
+            UTOX_MSG_FT *msg = calloc(1, sizeof(UTOX_MSG_FT));
+            if (msg) {
+                msg->file          = fopen((char *)file->path, "rb+");
+                msg->name          = (uint8_t *)strdup((char *)file->path);
+                msg->friend_number = friend_number;
+                msg->hashed        = true;
+                msg->size          = file->target_size;
+                memcpy(msg->hash, file->data_hash, TOX_HASH_LENGTH);
+                ft_send_queue(msg);
+            }
         }
+        free(file->name);
         free(file);
     }
+
+    // Whatever was waiting for this friend can go.
+    ft_send_queue_changed = true;
 }
 
 /* Friend has gone offline, break our outgoing transfers to this friend. */
 void ft_friend_offline(Tox *UNUSED(tox), uint32_t friend_number) {
 
-    FRIEND *f = get_friend(friend_number);
-    if (!f) {
-        return;
-    }
-
-    for (uint16_t i = 0; i < f->ft_outgoing_size; ++i) {
-        break_file(&f->ft_outgoing[i]);
-    }
-
-    for (uint16_t i = 0; i < f->ft_incoming_size; ++i) {
-        break_file(&f->ft_incoming[i]);
+    // Only this thread makes or frees transfers, so the slots can't change under us.
+    for (uint32_t i = 0; i < ft_slot_count; ++i) {
+        FILE_TRANSFER *ft = ft_slot(i);
+        if (ft->in_use && ft->friend_number == friend_number) {
+            break_file(ft);
+        }
     }
 }
 
@@ -537,7 +1116,7 @@ void ft_local_control(Tox *tox, uint32_t friend_number, uint32_t file_number, TO
     switch (control) {
         case TOX_FILE_CONTROL_RESUME: {
             if (info->status != FILE_TRANSFER_STATUS_ACTIVE) {
-                if (get_friend(friend_number)->ft_outgoing_size < MAX_FILE_TRANSFERS) {
+                if (get_friend(friend_number)->ft_outgoing_active_count <= MAX_FILE_TRANSFERS) {
                     tox_file_control(tox, friend_number, file_number, control, NULL);
                 }
             }
@@ -715,6 +1294,7 @@ static void incoming_file_callback_request(Tox *tox, uint32_t friend_number, uin
     ft->friend_number = friend_number;
     ft->file_number   = file_number;
     ft->incoming      = true;
+    ft->target_size   = size;
     tox_file_get_file_id(tox, friend_number, file_number, ft->data_hash, NULL);
     ft->name = calloc(1, name_length + 1);
     snprintf((char *)ft->name, name_length + 1, "%.*s", (int)name_length, name);
@@ -750,6 +1330,8 @@ static void incoming_file_callback_request(Tox *tox, uint32_t friend_number, uin
             return;
         }
         // This is fine-ish, we'll just fallback to new incoming file.
+        ft->current_size       = 0;
+        ft->resume_range_count = 0;
     }
 
     ft->friend_number = friend_number;
@@ -767,6 +1349,43 @@ static void incoming_file_callback_request(Tox *tox, uint32_t friend_number, uin
     /* Auto accept if it's a utox-inline image, with the correct size */
 }
 
+/* Buffers the parts of an incoming chunk that aren't on disk yet. A resumed file has the id it had last
+ * time, and the sender derives that from the hashes of its blocks, so the bytes we already hold match
+ * the ones coming in and don't need writing again. toxcore only lets us seek once, before the transfer
+ * starts, so everything after the first missing byte is still sent. Returns false if a write failed. */
+static bool ft_write_missing(FILE_TRANSFER *ft, uint64_t position, const uint8_t *data, size_t length) {
+    while (length) {
+        // Writes that finish while we buffer can change the ranges, so look them up again each time.
+        const FILE_TRANSFER_RANGE *held = NULL;
+        for (uint8_t i = 0; i < ft->resume_range_count; ++i) {
+            if (ft->resume_range[i].end > position) {
+                held = &ft->resume_range[i];
+                break;
+            }
+        }
+
+        if (!held || held->start >= position + length) {
+            return ft_buffer_write(ft, position, data, length);
+        }
+
+        size_t size = 0;
+        if (held->start > position) {
+            size = held->start - position;
+            if (!ft_buffer_write(ft, position, data, size)) {
+                return false;
+            }
+        } else {
+            size = MIN(held->end - position, length);
+        }
+
+        position += size;
+        data += size;
+        length -= size;
+    }
+
+    return true;
+}
+
 /* Called by toxcore to deliver the next chunk of incoming data. */
 static void incoming_file_callback_chunk(Tox *tox, uint32_t friend_number, uint32_t file_number,
                                          uint64_t position, const uint8_t *data, size_t length, void *UNUSED(user_data))
@@ -794,38 +1413,20 @@ static void incoming_file_callback_chunk(Tox *tox, uint32_t friend_number, uint3
     } else if (ft->avatar && ft->via.avatar) {
         memcpy(ft->via.avatar + position, data, length);
     } else if (ft->via.file) {
-        uint8_t count = 10;
-        while (!file_lock(ft->via.file, position, length)) {
-            yieldcpu(10);
-            if (count == 0) {
-                break;
-            }
-            count--;
-            // If you get a bug report about this hanging utox, just disable it, it's unlikely to be needed!
-        }
-        fseeko(ft->via.file, position, SEEK_SET);
-        size_t write_size = fwrite(data, 1, length, ft->via.file);
-        fflush(ft->via.file);
-        file_unlock(ft->via.file, position, length);
-        if (write_size != length) {
+        if (!ft_write_missing(ft, position, data, length)) {
             ft_local_control(tox, friend_number, file_number, TOX_FILE_CANCEL);
             return;
         }
+
+        ft->current_size += length;
         calculate_speed(ft);
+        return;
     } else {
         ft_local_control(tox, friend_number, file_number, TOX_FILE_CANCEL);
         return;
     }
 
     ft->current_size += length;
-    if (ft->resume_update) {
-        --ft->resume_update;
-    } else {
-        ft_update_resumable(ft);
-        ft->resume_update = 20; // every 20 packets we update
-    }
-    // TODO dirty hack, this needs to be replaced
-    // moved it cal_speed() // ft_update_resumable(ft);
 }
 
 uint32_t ft_send_avatar(Tox *tox, uint32_t friend_number) {
@@ -938,6 +1539,94 @@ uint32_t ft_send_file(Tox *tox, uint32_t friend_number, FILE *file, uint8_t *pat
     return file_number;
 }
 
+static bool ft_hash_blocks(FILE *file, uint8_t *hash) {
+    uint8_t *block = malloc(FILE_HASH_BLOCK_SIZE);
+    size_t hashes_size = 64;
+    uint8_t *hashes = malloc(hashes_size * TOX_HASH_LENGTH);
+    if (!block || !hashes || fseeko(file, 0, SEEK_SET)) {
+        free(block);
+        free(hashes);
+        return false;
+    }
+
+    size_t count = 0, size;
+    while ((size = fread(block, 1, FILE_HASH_BLOCK_SIZE, file))) {
+        if (count == hashes_size) {
+            uint8_t *new_hashes = realloc(hashes, hashes_size * 2 * TOX_HASH_LENGTH);
+            if (!new_hashes) {
+                break;
+            }
+            hashes = new_hashes;
+            hashes_size *= 2;
+        }
+
+        tox_hash(hashes + count++ * TOX_HASH_LENGTH, block, size);
+    }
+
+    const bool hashed = feof(file) && !ferror(file) && tox_hash(hash, hashes, count * TOX_HASH_LENGTH);
+
+    free(block);
+    free(hashes);
+    return hashed;
+}
+
+/* Files waiting to be hashed, oldest first. They're hashed one at a time by a single worker thread, started
+ * with the first one, so sending a folder of files doesn't start a thread for each and read them all at once. */
+static pthread_mutex_t ft_hash_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  ft_hash_cond = PTHREAD_COND_INITIALIZER;
+static UTOX_MSG_FT *   ft_hash_first, *ft_hash_last;
+static bool            ft_hash_running;
+
+static void ft_hash_thread(void *UNUSED(args)) {
+    while (1) {
+        pthread_mutex_lock(&ft_hash_lock);
+        while (!ft_hash_first) {
+            pthread_cond_wait(&ft_hash_cond, &ft_hash_lock);
+        }
+
+        UTOX_MSG_FT *msg = ft_hash_first;
+        ft_hash_first    = msg->next;
+        if (!ft_hash_first) {
+            ft_hash_last = NULL;
+        }
+        pthread_mutex_unlock(&ft_hash_lock);
+
+        msg->hashed = ft_hash_blocks(msg->file, msg->hash);
+        if (!fseeko(msg->file, 0, SEEK_END)) {
+            msg->size = ftello(msg->file);
+        }
+
+        postmessage_toxcore(TOX_FILE_SEND_HASHED, msg->friend_number, 0, msg);
+    }
+}
+
+void ft_hash_file(uint32_t friend_number, UTOX_MSG_FT *msg) {
+    msg->friend_number = friend_number;
+    msg->hashed        = false;
+    msg->next          = NULL;
+
+    if (!msg->file) {
+        // Nothing to hash, ft_send_file() will turn it down. We're on the toxcore thread already.
+        ft_send_queue(msg);
+        return;
+    }
+
+    pthread_mutex_lock(&ft_hash_lock);
+    if (ft_hash_last) {
+        ft_hash_last->next = msg;
+    } else {
+        ft_hash_first = msg;
+    }
+    ft_hash_last = msg;
+
+    if (!ft_hash_running) {
+        ft_hash_running = true;
+        thread(ft_hash_thread, NULL);
+    }
+    pthread_cond_signal(&ft_hash_cond);
+    pthread_mutex_unlock(&ft_hash_lock);
+}
+
 /* Returns file number on success, UINT32_MAX on failure. */
 uint32_t ft_send_data(Tox *tox, uint32_t friend_number, uint8_t *data, size_t size, uint8_t *name, size_t name_length) {
     if (!tox || !data || !name) {
@@ -1008,15 +1697,223 @@ uint32_t ft_send_data(Tox *tox, uint32_t friend_number, uint8_t *data, size_t si
 }
 
 bool ft_set_ui_data(uint32_t friend_number, uint32_t file_number, MSG_HEADER *ui_data) {
-    FILE_TRANSFER *file = get_file_transfer(friend_number, file_number);
-    if (!file) {
+    // Called from the UI thread, the lock keeps the transfer from going away before it's set.
+    pthread_mutex_lock(&ft_lock);
+
+    FT_TABLE_ENTRY *entry = ft_table_find(friend_number, file_number);
+    const bool      found = entry->slot;
+    if (found) {
+        ft_slot(entry->slot - 1)->ui_data = ui_data;
+
+        // Don't let a change published before this go to the old message.
+        pthread_mutex_lock(&ft_progress_lock);
+        ft_progress[entry->slot - 1].ui_data = ui_data;
+        pthread_mutex_unlock(&ft_progress_lock);
+    }
+
+    pthread_mutex_unlock(&ft_lock);
+    return found;
+}
+
+// Drops the mapped window of the outgoing file, if there is one.
+static void ft_unmap_window(FILE_TRANSFER *ft) {
+    native_unmap_file(ft->map, ft->map_offset, ft->map_length);
+    ft->map        = NULL;
+    ft->map_length = 0;
+}
+
+/* Returns true and writes the size of the outgoing file to size if it still has length bytes at
+ * position. Touching a mapping past the end of the file would kill us instead of failing the read,
+ * so this is checked before every chunk. */
+static bool ft_file_has(FILE_TRANSFER *ft, uint64_t position, size_t length, uint64_t *size) {
+    struct stat info;
+    if (fstat(fileno(ft->via.file), &info) != 0 || (uint64_t)info.st_size < position + length) {
         return false;
     }
 
-    file->ui_data = ui_data;
+    *size = info.st_size;
     return true;
 }
 
+/* Maps the window of the outgoing file starting at position, as much of it as the file still has.
+ * Returns false if the file is too short or can't be mapped. */
+static bool ft_map_window(FILE_TRANSFER *ft, uint64_t position, size_t length) {
+    ft_unmap_window(ft);
+
+    uint64_t size;
+    if (!ft_file_has(ft, position, length, &size)) {
+        return false;
+    }
+
+    uint64_t window = size - position;
+    if (window > FILE_MAP_WINDOW_SIZE) {
+        window = length > FILE_MAP_WINDOW_SIZE ? length : FILE_MAP_WINDOW_SIZE;
+    }
+
+    ft->map = native_map_file(ft->via.file, position, window);
+    if (!ft->map) {
+        // It won't work any better for the next chunk, read them all from now on.
+        ft->map_failed = true;
+        return false;
+    }
+
+    ft->map_offset = position;
+    ft->map_length = window;
+    return true;
+}
+
+/* Returns length bytes of the outgoing file at position, or NULL if they can't be read.
+ *
+ * The bytes come straight from the mapped window if we can map the file, otherwise they're read
+ * into the transfer's chunk buffer. Either way they're only good until the next call. */
+static const uint8_t *ft_read_chunk(FILE_TRANSFER *ft, uint64_t position, size_t length) {
+    if (ft->map && position >= ft->map_offset && position + length <= ft->map_offset + ft->map_length) {
+        // The file may have shrunk since it was mapped.
+        uint64_t size;
+        if (!ft_file_has(ft, position, length, &size)) {
+            ft_unmap_window(ft);
+            return NULL;
+        }
+
+        return ft->map + (position - ft->map_offset);
+    }
+
+    if (!ft->map_failed && ft_map_window(ft, position, length)) {
+        return ft->map;
+    }
+
+    if (ft->chunk_buffer_size < length) {
+        uint8_t *buffer = realloc(ft->chunk_buffer, length);
+        if (!buffer) {
+            return NULL;
+        }
+
+        ft->chunk_buffer      = buffer;
+        ft->chunk_buffer_size = length;
+    }
+
+    if (fseeko(ft->via.file, position, SEEK_SET) || fread(ft->chunk_buffer, length, 1, ft->via.file) != 1) {
+        return NULL;
+    }
+
+    return ft->chunk_buffer;
+}
+
+static bool ft_is_bulk(FILE_TRANSFER *ft) {
+    return !ft->in_memory && !ft->avatar && ft->target_size >= FILE_BULK_SIZE;
+}
+
+typedef enum {
+    FT_CHUNK_SENT,
+    // Toxcore can't take it right now, it has to be sent again later.
+    FT_CHUNK_LATER,
+    // Toxcore won't take it at all, the transfer is over as far as it's concerned.
+    FT_CHUNK_DROPPED,
+    // It couldn't be read.
+    FT_CHUNK_FAILED,
+} FT_CHUNK_RESULT;
+
+/* Sends length bytes of the outgoing ft from position. */
+static FT_CHUNK_RESULT ft_send_chunk(Tox *tox, FILE_TRANSFER *ft, uint64_t position, size_t length) {
+    const uint8_t *chunk;
+    if (ft->in_memory) {
+        chunk = ft->via.memory + position;
+    } else if (ft->avatar) {
+        chunk = self.png_data + position;
+    } else {
+        chunk = ft_read_chunk(ft, position, length);
+        if (!chunk) {
+            return FT_CHUNK_FAILED;
+        }
+    }
+
+    TOX_ERR_FILE_SEND_CHUNK error;
+    tox_file_send_chunk(tox, ft->friend_number, ft->file_number, position, chunk, length, &error);
+    switch (error) {
+        case TOX_ERR_FILE_SEND_CHUNK_OK: {
+            break;
+        }
+
+        // Toxcore only asks for each chunk once, so one it couldn't queue has to be held back and retried.
+        case TOX_ERR_FILE_SEND_CHUNK_SENDQ:
+        case TOX_ERR_FILE_SEND_CHUNK_NOT_TRANSFERRING: {
+            return FT_CHUNK_LATER;
+        }
+
+        default: {
+            return FT_CHUNK_DROPPED;
+        }
+    }
+
+    ft_send_tokens -= length;
+
+    if (!ft->avatar) {
+        calculate_speed(ft);
+    }
+
+    ft->current_size += length;
+    return FT_CHUNK_SENT;
+}
+
+/* Holds back length bytes of ft from position, which have to follow the ones already held back. */
+static void ft_defer(FILE_TRANSFER *ft, uint64_t position, size_t length) {
+    if (ft->deferred_length) {
+        ft->deferred_length += length;
+        return;
+    }
+
+    ft->deferred_position = position;
+    ft->deferred_length   = length;
+    ft->deferred_chunk    = length;
+    ft_deferred_count++;
+}
+
+static void ft_defer_drop(FILE_TRANSFER *ft) {
+    if (ft->deferred_length) {
+        ft->deferred_length = 0;
+        ft_deferred_count--;
+    }
+}
+
+/* Sends up to length bytes of the chunks held back for ft, stopping early once toxcore's send queue
+ * is full. Returns how much was sent. */
+static size_t ft_send_deferred(Tox *tox, FILE_TRANSFER *ft, size_t length) {
+    size_t sent = 0;
+    while (ft->deferred_length && sent < length) {
+        const size_t size = MIN(ft->deferred_chunk, ft->deferred_length);
+        switch (ft_send_chunk(tox, ft, ft->deferred_position, size)) {
+            case FT_CHUNK_SENT: {
+                break;
+            }
+
+            case FT_CHUNK_LATER: {
+                return sent;
+            }
+
+            case FT_CHUNK_DROPPED: {
+                ft_defer_drop(ft);
+                return sent;
+            }
+
+            case FT_CHUNK_FAILED: {
+                ft_defer_drop(ft);
+                ft_local_control(tox, ft->friend_number, ft->file_number, TOX_FILE_CONTROL_CANCEL);
+                return sent;
+            }
+        }
+
+        ft->deferred_position += size;
+        ft->deferred_length   -= size;
+        sent                  += size;
+    }
+
+    if (!ft->deferred_length) {
+        ft_defer_drop(ft);
+    }
+
+    return sent;
+}
+
 static void outgoing_file_callback_chunk(Tox *tox, uint32_t friend_number, uint32_t file_number,
                                          uint64_t position,
                                          size_t length, void *UNUSED(user_data))
@@ -1036,36 +1933,203 @@ static void outgoing_file_callback_chunk(Tox *tox, uint32_t friend_number, uint3
         return;
     }
 
-    if (ft->in_memory) {
-        if (!ft->via.memory) {
+    if ((ft->in_memory && !ft->via.memory) || (ft->avatar && !self.png_data)
+        || (!ft->in_memory && !ft->avatar && !ft->via.file))
+    {
+        return;
+    }
+
+    if (ft->deferred_length) {
+        if (position == ft->deferred_position + ft->deferred_length) {
+            // Get in line behind the chunks already held back.
+            ft_defer(ft, position, length);
             return;
         }
 
-        tox_file_send_chunk(tox, friend_number, file_number, position, ft->via.memory + position, length, NULL);
+        /* Toxcore only asks for chunks out of order after seeking, and then it won't take the ones
+         * we held back any more. */
+        ft_defer_drop(ft);
+    } else if (settings.ft_send_rate && ft_send_tokens <= 0 && ft_is_bulk(ft)) {
+        ft_defer(ft, position, length);
+        return;
+    }
 
-        calculate_speed(ft);
-    } else if (ft->avatar) {
-        if (!self.png_data) {
-            return;
+    switch (ft_send_chunk(tox, ft, position, length)) {
+        case FT_CHUNK_SENT:
+        case FT_CHUNK_DROPPED: {
+            break;
         }
 
-        tox_file_send_chunk(tox, friend_number, file_number, position, self.png_data + position, length, NULL);
+        case FT_CHUNK_LATER: {
+            ft_defer(ft, position, length);
+            break;
+        }
+
+        case FT_CHUNK_FAILED: {
+            ft_local_control(tox, friend_number, file_number, TOX_FILE_CONTROL_CANCEL);
+            break;
+        }
+    }
+}
+
+void ft_send_queue(UTOX_MSG_FT *msg) {
+    msg->next = NULL;
+    if (ft_send_last) {
+        ft_send_last->next = msg;
     } else {
-        // Ft is a file
-        if (ft->via.file) {
-            uint8_t buffer[length];
-            fseeko(ft->via.file, position, SEEK_SET);
-            if (fread(buffer, length, 1, ft->via.file) != 1) {
-                ft_local_control(tox, friend_number, file_number, TOX_FILE_CONTROL_CANCEL);
-                return;
+        ft_send_first = msg;
+    }
+    ft_send_last = msg;
+
+    ft_send_queue_changed = true;
+}
+
+// How many bulk files are on their way to the friend.
+static uint32_t ft_bulk_sending(uint32_t friend_number) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < ft_slot_count; ++i) {
+        FILE_TRANSFER *ft = ft_slot(i);
+        if (ft->in_use && !ft->incoming && ft->friend_number == friend_number && ft_is_bulk(ft)) {
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+/* Starts the files in line that can go, the ones that don't have to wait first. */
+static void ft_send_start(Tox *tox) {
+    for (int pass = 0; pass < 2; ++pass) {
+        const bool bulk = pass;
+
+        UTOX_MSG_FT **link = &ft_send_first, *last = NULL;
+        while (*link) {
+            UTOX_MSG_FT *msg = *link;
+            FRIEND      *f   = get_friend(msg->friend_number);
+
+            bool go = f && f->online && (msg->size >= FILE_BULK_SIZE) == bulk
+                      && f->ft_outgoing_active_count < MAX_FILE_TRANSFERS;
+            if (go && bulk && settings.ft_max_sending) {
+                go = ft_bulk_sending(msg->friend_number) < settings.ft_max_sending;
             }
 
-            tox_file_send_chunk(tox, friend_number, file_number, position, buffer, length, NULL);
+            if (f && !go) {
+                last = msg;
+                link = &msg->next;
+                continue;
+            }
+
+            *link = msg->next;
+
+            if (!f || !msg->name || ft_send_file(tox, msg->friend_number, msg->file, msg->name, strlen((char *)msg->name),
+                                   msg->hashed ? msg->hash : NULL) == UINT32_MAX)
+            {
+                // The friend is gone, or toxcore won't have it. Either way it's not going anywhere.
+                if (msg->file) {
+                    fclose(msg->file);
+                }
+            }
+
+            free(msg->name);
+            free(msg);
         }
-        calculate_speed(ft);
+
+        ft_send_last = last;
     }
+}
 
-    ft->current_size += length;
+uint64_t ft_send_schedule(Tox *tox, uint64_t time) {
+    if (ft_send_queue_changed) {
+        ft_send_queue_changed = false;
+        ft_send_start(tox);
+    }
+
+    const uint64_t rate = settings.ft_send_rate;
+
+    // Top up what we may send, a second's worth at most. Parts of a byte are kept for the next top up.
+    if (rate && ft_send_tokens_time) {
+        const uint64_t elapsed = time - ft_send_tokens_time;
+        if (elapsed >= 1000 * 1000 * 1000) {
+            ft_send_tokens      = rate;
+            ft_send_tokens_owed = 0;
+        } else {
+            const uint64_t owed = elapsed * rate + ft_send_tokens_owed;
+            ft_send_tokens     += owed / (1000 * 1000 * 1000);
+            ft_send_tokens_owed = owed % (1000 * 1000 * 1000);
+            ft_send_tokens      = MIN(ft_send_tokens, (int64_t)rate);
+        }
+    } else if (!rate) {
+        ft_send_tokens      = 0;
+        ft_send_tokens_owed = 0;
+    }
+    ft_send_tokens_time = time;
+
+    /* Hand out what we may send in turns, so every transfer that's held back keeps moving. Without a
+     * rate, each transfer sends what its send queue has room for. Whatever toxcore can't take yet
+     * stays held back for the next iteration. */
+    bool sent = true;
+    while (sent && ft_deferred_count && (!rate || ft_send_tokens > 0)) {
+        sent = false;
+        for (uint32_t i = 0; i < ft_slot_count && ft_deferred_count && (!rate || ft_send_tokens > 0); ++i) {
+            FILE_TRANSFER *ft = ft_slot(i);
+            if (!ft->in_use || !ft->deferred_length) {
+                continue;
+            }
+
+            if (ft_send_deferred(tox, ft, rate ? FILE_CHUNK_SIZE : SIZE_MAX) && rate) {
+                sent = true;
+            }
+        }
+    }
+
+    // Anything still held back without a rate, or with tokens to spare, waits on toxcore's send queue.
+    if (!ft_deferred_count || !rate || ft_send_tokens >= FILE_CHUNK_SIZE) {
+        return UINT64_MAX;
+    }
+
+    // Wake up once there's enough for the next chunk, rounding up so we don't wake up a little early.
+    const uint64_t needed = (uint64_t)(FILE_CHUNK_SIZE - ft_send_tokens) * 1000 * 1000 * 1000;
+    return (needed - MIN(needed, ft_send_tokens_owed) + rate - 1) / rate;
+}
+
+uint64_t ft_write_schedule(Tox *tox, uint64_t time) {
+    // Take back what the writer thread got onto disk since the last time round.
+    pthread_mutex_lock(&ft_write_lock);
+    FT_WRITE *written = ft_written_first;
+    ft_written_first = ft_written_last = NULL;
+    pthread_mutex_unlock(&ft_write_lock);
+
+    ft_writes_done(written);
+
+    uint64_t wait = UINT64_MAX;
+
+    for (uint32_t i = 0; i < ft_slot_count && (ft_buffered_count || ft_write_failures); ++i) {
+        FILE_TRANSFER *ft = ft_slot(i);
+        if (!ft->in_use) {
+            continue;
+        }
+
+        if (ft->write_failed) {
+            ft_local_control(tox, ft->friend_number, ft->file_number, TOX_FILE_CONTROL_CANCEL);
+            continue;
+        }
+
+        if (!ft->write_buffer) {
+            continue;
+        }
+
+        if (time - ft->write_time < FILE_WRITE_BUFFER_TIME) {
+            wait = MIN(wait, ft->write_time + FILE_WRITE_BUFFER_TIME - time);
+            continue;
+        }
+
+        // Nothing came in for a while, write out what we have rather than hold on to it.
+        if (!ft_flush_writes(ft)) {
+            ft_local_control(tox, ft->friend_number, ft->file_number, TOX_FILE_CONTROL_CANCEL);
+        }
+    }
+
+    return wait;
 }
 
 bool utox_file_start_write(uint32_t friend_number, uint32_t file_number, const char *file) {
@@ -1082,6 +2146,9 @@ bool utox_file_start_write(uint32_t friend_number, uint32_t file_number, const c
         return false;
     }
 
+    // The resume info was written before we knew where the file goes.
+    ft_update_resumable(ft);
+
     return true;
 }
 
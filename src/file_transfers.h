@@ -21,11 +21,43 @@ typedef enum {
     FILE_TRANSFER_STATUS_KILLED,
 } UTOX_FILE_TRANSFER_STATUS;
 
-typedef struct {
+typedef struct utox_msg_ft {
     FILE *file;
     uint8_t *name;
+
+    // Filled in by ft_hash_file().
+    uint32_t friend_number;
+    bool     hashed;
+    uint8_t  hash[TOX_HASH_LENGTH];
+    uint64_t size;
+
+    // Next in line to be sent, see ft_send_queue().
+    struct utox_msg_ft *next;
 } UTOX_MSG_FT;
 
+typedef struct {
+    uint64_t start, end;
+} FILE_TRANSFER_RANGE;
+
+/* Every resumable transfer has a resume file, an FT_RESUME_RECORD followed by the path of the file.
+ * It's all fixed width, so it doesn't depend on how FILE_TRANSFER happens to be laid out. Both are
+ * rewritten in place at the start of the file as the transfer goes. */
+#define FT_RESUME_VERSION 1
+#define FT_RESUME_MAX_RANGES 8
+typedef struct {
+    uint8_t  magic[4];
+    uint32_t version;
+    // Of the record with this set to 0, followed by the path.
+    uint32_t checksum;
+    uint16_t path_length;
+    uint8_t  incoming;
+    uint8_t  range_count;
+    uint64_t target_size;
+    uint8_t  data_hash[TOX_HASH_LENGTH];
+    // The bytes of an incoming file that are known to be on disk, sorted and not touching.
+    FILE_TRANSFER_RANGE range[FT_RESUME_MAX_RANGES];
+} FT_RESUME_RECORD;
+
 typedef struct file_transfer {
     bool in_use;
     bool incoming;
@@ -55,25 +87,82 @@ typedef struct file_transfer {
         FILE    *file;
     } via;
 
+    /* Outgoing files are read through a window of via.file mapped into memory, or through
+     * chunk_buffer if the platform can't map it, which map_failed remembers. Both live until the
+     * transfer is done. */
+    uint8_t *map;
+    uint64_t map_offset;
+    size_t   map_length;
+    bool     map_failed;
+
+    uint8_t *chunk_buffer;
+    size_t   chunk_buffer_size;
+
+    /* Chunks toxcore asked for that we hold back to keep under settings.ft_send_rate, or that its
+     * send queue had no room for. They always follow each other, so they're deferred_length bytes
+     * from deferred_position in deferred_chunk sized pieces. */
+    uint64_t deferred_position;
+    size_t   deferred_length, deferred_chunk;
+
+    /* Incoming chunks that follow each other are collected in write_buffer and written to via.file
+     * together. write_offset is where they go in the file, write_time when the first one came in.
+     * writes_pending counts the buffers the writer thread has yet to hand back, write_failed is set
+     * once one of them couldn't be written. */
+    uint8_t *write_buffer;
+    uint64_t write_offset, write_time;
+    size_t   write_length;
+    uint32_t writes_pending;
+    bool     write_failed;
+
     /* speed + progress calculations. */
     uint32_t speed, num_packets;
     uint64_t last_check_time, last_check_transferred;
 
     FILE    *resume_file;
-    uint8_t  resume_update;
+    FILE_TRANSFER_RANGE resume_range[FT_RESUME_MAX_RANGES];
+    uint8_t  resume_range_count;
 
     MSG_HEADER *ui_data;
     bool decon_wait; // Used to pause decon/file cleanup, for the UI thread to copy the data;
 } FILE_TRANSFER;
 
+/* Returns the transfer with the toxcore file number of the friend, NULL if there's none.
+ * For the toxcore thread only, the transfer can be freed and its slot reused on any other. */
+FILE_TRANSFER *get_file_transfer(uint32_t friend_number, uint32_t file_number);
+
 void ft_local_control(Tox *tox, uint32_t friend_number, uint32_t file_number, TOX_FILE_CONTROL control);
 
 uint32_t ft_send_avatar(Tox *tox, uint32_t friend_number);
 
 uint32_t ft_send_file(Tox *tox, uint32_t friend_number, FILE *file, uint8_t *name, size_t name_length, uint8_t *hash);
 
+/* Puts the file of msg in line for the hashing thread, which posts TOX_FILE_SEND_HASHED with msg back to
+ * toxcore to send it. For the toxcore thread. The hash of a file is the hash of the hashes of its blocks, so
+ * sending the same file again gets it the same file id, and the friend can resume it instead of starting over. */
+void ft_hash_file(uint32_t friend_number, UTOX_MSG_FT *msg);
+
+/* Puts the file of msg, once it's hashed, in line to be sent. Avatars, inline images and small files never
+ * wait, big files wait until the friend has fewer than settings.ft_max_sending of them on the way. */
+void ft_send_queue(UTOX_MSG_FT *msg);
+
+/* Starts the files in line that can go, and sends the chunks we held back as settings.ft_send_rate allows.
+ * For the toxcore thread, every iteration. Returns the ns until it wants to be called again. */
+uint64_t ft_send_schedule(Tox *tox, uint64_t time);
+
+/* Writes out the buffered chunks of incoming files that have waited FILE_WRITE_BUFFER_TIME, and lets go of
+ * their buffers. For the toxcore thread, every iteration. Returns the ns until it wants to be called again. */
+uint64_t ft_write_schedule(Tox *tox, uint64_t time);
+
 uint32_t ft_send_data(Tox *tox, uint32_t friend_number, uint8_t *data, size_t size, uint8_t *name, size_t name_length);
 
+/* Posts the progress updates that came too soon after the last post, once it's time.
+ * For the toxcore thread, every iteration. Returns the ns until it wants to be called again. */
+uint64_t ft_progress_schedule(uint64_t time);
+
+/* Copies the progress of the transfers that changed since last time into their messages.
+ * For the UI thread, when it gets FILE_STATUS_UPDATE. */
+void ft_progress_update(void);
+
 /** Sets the UI pointer to the File Transfer Message pointer.
  *
  * This is non robust and could use some LTC */
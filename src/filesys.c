@@ -21,6 +21,10 @@ bool utox_move_file(const uint8_t *current_name, const uint8_t *new_name) {
     return native_move_file(current_name, new_name);
 }
 
+bool utox_replace_file(const char *name, const char *new_name) {
+    return native_replace_file(name, new_name, settings.portable_mode);
+}
+
 void *file_raw(char *path, uint32_t *size) {
     FILE *file = fopen(path, "rb");
     if (!file) {
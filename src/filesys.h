@@ -47,6 +47,13 @@ bool utox_remove_file(const uint8_t *full_name, size_t length);
 
 bool utox_move_file(const uint8_t *current_name, const uint8_t *new_name);
 
+/**
+ * Renames the file name in the utox storage folder to new_name, replacing new_name in one go if it exists.
+ *
+ * Returns true on success.
+ */
+bool utox_replace_file(const char *name, const char *new_name);
+
 /**
  * Takes a null-terminated utf8 filepath and creates it with permissions 0700
  * (in posix environments) if it doesn't already exist. In Windows environments
@@ -458,8 +458,8 @@ static void page_open(ITEM *i) {
 
             memcpy(edit_chat_msg_friend.data, f->typed, f->typed_length);
             edit_chat_msg_friend.length = f->typed_length;
+            text_layout_invalidate(&edit_chat_msg_friend.layout);
 
-            f->msg.width  = current_width;
             f->msg.id     = f->number;
             f->unread_msg = false;
             /* We use the MESSAGES struct from the friend, but we need the info from the panel. */
@@ -496,8 +496,8 @@ static void page_open(ITEM *i) {
 
             memcpy(edit_chat_msg_group.data, g->typed, g->typed_length);
             edit_chat_msg_group.length = g->typed_length;
+            text_layout_invalidate(&edit_chat_msg_group.layout);
 
-            g->msg.width  = current_width;
             g->msg.id     = g->number;
             g->unread_msg = 0;
             /* We use the MESSAGES struct from the group, but we need the info from the panel. */
@@ -445,11 +445,12 @@ void friend_free(FRIEND *f) {
     free(f->avatar);
 
     for (uint32_t i = 0; i < f->msg.number; ++i) {
-        MSG_HEADER *msg = f->msg.data[i];
+        MSG_HEADER *msg = message_at(&f->msg, i);
         message_free(msg);
     }
 
     free(f->msg.data);
+    free(f->msg.heights);
 
     memset(f, 0, sizeof(FRIEND));
     self.friend_list_count--;
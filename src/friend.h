@@ -90,12 +90,8 @@ typedef struct utox_friend {
     /* File transfers */
     bool ft_autoaccept;
 
-    FILE_TRANSFER  *ft_incoming;
-    uint16_t        ft_incoming_size;
+    // The transfers themselves live in the transfer table of file_transfers.c.
     uint16_t        ft_incoming_active_count;
-
-    FILE_TRANSFER  *ft_outgoing;
-    uint16_t        ft_outgoing_size;
     uint16_t        ft_outgoing_active_count;
 } FRIEND;
 
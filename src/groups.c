@@ -7,6 +7,7 @@
 #include "text.h"
 
 #include "av/audio.h"
+#include "av/mixer.h"
 #include "av/utox_av.h"
 
 #include "native/notify.h"
@@ -22,6 +23,8 @@
 
 static GROUPCHAT *group = NULL;
 
+pthread_mutex_t group_mixer_lock = PTHREAD_MUTEX_INITIALIZER;
+
 GROUPCHAT *get_group(uint32_t group_number) {
     if (group_number >= self.groups_list_size) {
         return NULL;
@@ -86,6 +89,11 @@ void group_init(GROUPCHAT *g, uint32_t group_number, bool av_group) {
     g->number   = group_number;
     g->notify   = settings.group_notifications;
     g->av_group = av_group;
+    if (av_group && !g->mixer) {
+        pthread_mutex_lock(&group_mixer_lock);
+        g->mixer = mixer_new(UTOX_MAX_GROUP_PEERS);
+        pthread_mutex_unlock(&group_mixer_lock);
+    }
     pthread_mutex_unlock(&messages_lock);
 
     flist_add_group(g);
@@ -150,7 +158,7 @@ void group_peer_add(GROUPCHAT *g, uint32_t peer_id, bool UNUSED(our_peer_number)
     g->peer_count++;
 
     if (g->av_group) {
-        group_av_peer_add(g, peer_id); //add a source for the peer
+        group_av_peer_add(g, peer_id);
     }
 
     pthread_mutex_unlock(&messages_lock);
@@ -251,15 +259,23 @@ void group_free(GROUPCHAT *g) {
     group_reset_peerlist(g);
 
     for (size_t i = 0; i < g->msg.number; ++i) {
-        free(g->msg.data[i]->via.grp.author);
+        MSG_HEADER *msg = message_at(&g->msg, i);
+        free(msg->via.grp.author);
 
         // Freeing this here was causing a double free.
         // TODO: Is it needed to prevent a memory leak in some cases?
-        // free(g->msg.data[i]->via.grp.msg);
+        // free(msg->via.grp.msg);
 
-        message_free(g->msg.data[i]);
+        message_free(msg);
     }
     free(g->msg.data);
+    free(g->msg.heights);
+
+    pthread_mutex_lock(&group_mixer_lock);
+    MIXER *mixer = g->mixer;
+    g->mixer     = NULL;
+    pthread_mutex_unlock(&group_mixer_lock);
+    mixer_free(mixer);
 
     memset(g, 0, sizeof(GROUPCHAT));
 
@@ -5,9 +5,13 @@
 
 typedef unsigned int ALuint;
 typedef struct edit_change EDIT_CHANGE;
+typedef struct mixer MIXER;
 
 #define UTOX_MAX_GROUP_PEERS 256
 
+// Mixed frames queued on a group call's source at once.
+#define UTOX_GROUP_AUDIO_BUFFERS 5
+
 /*  UTOX_SAVE limits 8 as the max */
 typedef enum {
     GNOTIFY_NEVER,      /* 0: never send notifications, */
@@ -32,8 +36,11 @@ typedef struct groupchat {
     bool active_call;
     bool muted;
     ALuint audio_dest;
-    /* Audio sources */
-    unsigned int source[UTOX_MAX_GROUP_PEERS];
+    /* The peers' audio is mixed into audio_dest, which plays it from audio_buffer. The first
+     * audio_buffer_free of them haven't been queued yet. Hold group_mixer_lock to use mixer. */
+    MIXER   *mixer;
+    ALuint   audio_buffer[UTOX_GROUP_AUDIO_BUFFERS];
+    uint8_t  audio_buffer_free;
     /* TODO: thread safety (This should work fine but it isn't very clean.) */
     volatile uint64_t last_recv_audio[UTOX_MAX_GROUP_PEERS];
 
@@ -56,6 +63,10 @@ typedef struct groupchat {
     GROUP_PEER **peer;
 } GROUPCHAT;
 
+/* Held while using the mixer of a group, the UI thread frees it while the toxcore thread pushes to it
+ * and the audio thread mixes from it. */
+extern pthread_mutex_t group_mixer_lock;
+
 /* Initialize a new groupchat */
 void group_init(GROUPCHAT *g, uint32_t group_number, bool av_group);
 
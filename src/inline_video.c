@@ -21,29 +21,21 @@
 
 #include "native/image.h"
 
-#include <stdlib.h>
-#include <string.h>
+#include <pthread.h>
 
-static UTOX_FRAME_PKG current_frame = { 0, 0, 0, 0 };
+// Set from the toxav thread, drawn on the UI thread.
+static pthread_mutex_t current_frame_lock = PTHREAD_MUTEX_INITIALIZER;
+static UTOX_FRAME_PKG *current_frame;
 
-bool inline_set_frame(uint16_t w, uint16_t h, size_t size, void *img) {
-    current_frame.w    = w;
-    current_frame.h    = h;
-    current_frame.size = size;
+void inline_set_frame(UTOX_FRAME_PKG *frame) {
+    frame_ref(frame);
 
-    uint8_t *tmp = realloc(current_frame.img, size);
-    if (!size || !tmp) {
-        current_frame.w    = 0;
-        current_frame.h    = 0;
-        current_frame.size = 0;
-        tmp ? free(tmp) : free(current_frame.img);
+    pthread_mutex_lock(&current_frame_lock);
+    UTOX_FRAME_PKG *old = current_frame;
+    current_frame = frame;
+    pthread_mutex_unlock(&current_frame_lock);
 
-        return false;
-    }
-
-    current_frame.img = tmp;
-    memcpy(current_frame.img, img, size);
-    return true;
+    frame_unref(old);
 }
 
 void inline_video_draw(INLINE_VID *UNUSED(p), int x, int y, int width, int height) {
@@ -51,11 +43,15 @@ void inline_video_draw(INLINE_VID *UNUSED(p), int x, int y, int width, int heigh
         return;
     }
 
+    // Hold on to the frame while drawing it, a newer one may replace it meanwhile.
+    pthread_mutex_lock(&current_frame_lock);
+    UTOX_FRAME_PKG *frame = current_frame ? frame_ref(current_frame) : NULL;
+    pthread_mutex_unlock(&current_frame_lock);
 
-    if (current_frame.img && current_frame.size) {
-        draw_inline_image(current_frame.img, current_frame.size,
-                          MIN(current_frame.w, width), MIN(current_frame.h, height),
+    if (frame) {
+        draw_inline_image(frame->img, frame->size, MIN(frame->w, width), MIN(frame->h, height),
                           x, y + MAIN_TOP_FRAME_THICK);
+        frame_unref(frame);
     }
 }
 
@@ -9,7 +9,10 @@
 
 typedef struct inline_vid { PANEL panel; } INLINE_VID;
 
-bool inline_set_frame(uint16_t w, uint16_t h, size_t size, void *img);
+typedef struct utox_frame_pkg UTOX_FRAME_PKG;
+
+// Shows frame inline from now on, taking a reference to it.
+void inline_set_frame(UTOX_FRAME_PKG *frame);
 
 void inline_video_draw(INLINE_VID *p, int x, int y, int width, int height);
 
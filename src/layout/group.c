@@ -347,6 +347,7 @@ static void e_chat_msg_ontab(EDIT *edit) {
                 text[6] = ' ';
                 memcpy(text + 7, g->name, g->name_length);
                 edit->length = g->name_length + 7;
+                text_layout_invalidate(&edit->layout);
                 edit_setcursorpos(edit, edit->length);
 
                 return;
@@ -171,6 +171,8 @@ static void draw_settings_text_ui(int x, int y, int UNUSED(w), int UNUSED(height
     drawstr(x + SCALE(20) + BM_SWITCH_WIDTH,  y + SCALE(125), START_IN_TRAY);
     drawstr(x + SCALE(20) + BM_SWITCH_WIDTH,  y + SCALE(155), AUTO_STARTUP);
     drawstr(x + SCALE(20) + BM_SWITCH_WIDTH,  y + SCALE(185), SETTINGS_UI_MINI_ROSTER);
+    drawstr(x + SCALE(10),  y + SCALE(215), SETTINGS_FT_MAX_SENDING);
+    drawstr(x + SCALE(220), y + SCALE(215), SETTINGS_FT_SEND_RATE);
 }
 
 // Audio/Video settings page
@@ -353,6 +355,8 @@ panel_settings_ui = {
         (PANEL*)&switch_start_in_tray,
         (PANEL*)&switch_auto_startup,
         (PANEL*)&switch_mini_contacts,
+        (PANEL*)&dropdown_ft_max_sending,
+        (PANEL*)&dropdown_ft_send_rate,
         NULL
     }
 },
@@ -480,7 +484,7 @@ static void button_settings_sub_profile_on_mup(void) {
 }
 
 static void button_settings_sub_ui_on_mup(void) {
-    scrollbar_settings.content_height = SCALE(280);
+    scrollbar_settings.content_height = SCALE(310);
     disable_all_setting_sub();
     panel_settings_ui.disabled = false;
 }
@@ -1041,6 +1045,29 @@ static void dropdown_global_group_notifications_onselect(const uint16_t i,
     settings.group_notifications = i;
 }
 
+static void dropdown_ft_max_sending_onselect(const uint16_t i, const DROPDOWN *UNUSED(dm)) {
+    // The first is unlimited, then the count.
+    settings.ft_max_sending = i;
+}
+
+// In KiB/s, the first is unlimited.
+static const uint16_t ft_send_rates[] = { 0, 64, 256, 1024, 4096 };
+
+static void dropdown_ft_send_rate_onselect(const uint16_t i, const DROPDOWN *UNUSED(dm)) {
+    settings.ft_send_rate = (uint32_t)ft_send_rates[i] * 1024;
+}
+
+void dropdown_ft_select(uint8_t max_sending, uint32_t send_rate) {
+    dropdown_ft_max_sending.selected = dropdown_ft_max_sending.over = MIN(max_sending, 4);
+
+    // The closest limit that's no higher, anything below the lowest gets the lowest.
+    uint16_t i = COUNTOF(ft_send_rates) - 1;
+    while (i > 1 && (uint32_t)ft_send_rates[i] * 1024 > send_rate) {
+        --i;
+    }
+    dropdown_ft_send_rate.selected = dropdown_ft_send_rate.over = send_rate ? i : 0;
+}
+
 static UTOX_I18N_STR dpidrops[] = {
     STR_DPI_TINY, STR_DPI_060, STR_DPI_070, STR_DPI_080, STR_DPI_090, STR_DPI_NORMAL, STR_DPI_110,
     STR_DPI_120, STR_DPI_130, STR_DPI_140, STR_DPI_BIG, STR_DPI_160, STR_DPI_170, STR_DPI_180,
@@ -1112,6 +1139,30 @@ DROPDOWN dropdown_global_group_notifications = {
     .userdata  = notifydrops
 };
 
+static UTOX_I18N_STR ftmaxsendingdrops[] = {
+    STR_SETTINGS_FT_UNLIMITED,     STR_SETTINGS_FT_MAX_SENDING_1, STR_SETTINGS_FT_MAX_SENDING_2,
+    STR_SETTINGS_FT_MAX_SENDING_3, STR_SETTINGS_FT_MAX_SENDING_4,
+};
+
+DROPDOWN dropdown_ft_max_sending = {
+    .ondisplay = simple_dropdown_ondisplay,
+    .onselect  = dropdown_ft_max_sending_onselect,
+    .dropcount = COUNTOF(ftmaxsendingdrops),
+    .userdata  = ftmaxsendingdrops
+};
+
+static UTOX_I18N_STR ftsendratedrops[] = {
+    STR_SETTINGS_FT_UNLIMITED,   STR_SETTINGS_FT_SEND_RATE_64K, STR_SETTINGS_FT_SEND_RATE_256K,
+    STR_SETTINGS_FT_SEND_RATE_1M, STR_SETTINGS_FT_SEND_RATE_4M,
+};
+
+DROPDOWN dropdown_ft_send_rate = {
+    .ondisplay = simple_dropdown_ondisplay,
+    .onselect  = dropdown_ft_send_rate_onselect,
+    .dropcount = COUNTOF(ftsendratedrops),
+    .userdata  = ftsendratedrops
+};
+
 static char edit_name_data[128],
             edit_status_msg_data[128],
             edit_proxy_ip_data[256],
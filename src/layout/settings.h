@@ -1,6 +1,8 @@
 #ifndef LAYOUT_SETTINGS_H
 #define LAYOUT_SETTINGS_H
 
+#include <stdint.h>
+
 typedef struct scrollable SCROLLABLE;
 extern SCROLLABLE scrollbar_settings;
 
@@ -62,6 +64,8 @@ extern DROPDOWN /* Profile */
                 /* User interface */
                 dropdown_theme,
                 dropdown_dpi,
+                dropdown_ft_max_sending,
+                dropdown_ft_send_rate,
                 /* AV */
                 dropdown_audio_in,
                 dropdown_audio_out,
@@ -69,6 +73,9 @@ extern DROPDOWN /* Profile */
                 /* Notifications */
                 dropdown_global_group_notifications;
 
+/* Selects the options of the file transfer dropdowns that match the settings best. */
+void dropdown_ft_select(uint8_t max_sending, uint32_t send_rate);
+
 typedef struct edit EDIT;
 extern EDIT /* Profile */
             edit_name,
@@ -1,7 +1,9 @@
 #include "main.h"
 
+#include "chatlog.h"
 #include "settings.h"
 #include "theme.h"
+#include "tox.h"
 
 #include "native/filesys.h"
 #include "native/main.h"
@@ -10,6 +12,7 @@
 #include "av/utox_av.h"
 
 #include <getopt.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -19,7 +22,9 @@
  */
 
 bool utox_data_save_tox(uint8_t *data, size_t length) {
-    FILE *fp = utox_get_file("tox_save.tox", NULL, UTOX_FILE_OPTS_WRITE);
+    /* Write it all out next to the save first, so a crash half way through never costs us the save.
+     * utox_data_load_tox() falls back to the temporary file if the save is gone. */
+    FILE *fp = utox_get_file("tox_save.tmp", NULL, UTOX_FILE_OPTS_WRITE);
     if (!fp) {
         return true;
     }
@@ -32,7 +37,7 @@ bool utox_data_save_tox(uint8_t *data, size_t length) {
     flush_file(fp);
     fclose(fp);
 
-    return false;
+    return !utox_replace_file("tox_save.tmp", "tox_save.tox");
 }
 
 uint8_t *utox_data_load_tox(size_t *size) {
@@ -180,6 +185,7 @@ void parse_args(int argc, char *argv[],
             }
 
             case 'v': {
+                settings.verbose = true;
                 break;
             }
 
@@ -207,7 +213,21 @@ void utox_init(void) {
     UTOX_SAVE *save = config_load();
     free(save);
 
-    thread(utox_av_ctrl_thread, NULL);
+    utox_av_ctrl_thread_start();
 }
 
-void utox_raze(void) {}
+void utox_raze(void) {
+    utox_flush_chatlogs();
+
+    if (settings.verbose) {
+        TOX_THREAD_STATS stats;
+        tox_thread_stats(&stats);
+
+        fprintf(stderr, "toxcore thread: %" PRIu64 " iterations, %" PRIu64 " woken by messages\n", stats.iterations,
+                stats.wakeups);
+        fprintf(stderr, "toxcore thread: %" PRIu64 " messages, %" PRIu64 " ns mean latency, %" PRIu64 " ns worst\n",
+                stats.commands, stats.commands ? stats.latency_total / stats.commands : 0, stats.latency_max);
+        fprintf(stderr, "toxcore thread: %" PRIu64 " saves, %" PRIu64 " ns mean latency, %" PRIu64 " ns worst\n",
+                stats.saves, stats.saves ? stats.save_latency_total / stats.saves : 0, stats.save_latency_max);
+    }
+}
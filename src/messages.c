@@ -29,11 +29,20 @@
 #include "native/image.h"
 #include "native/keyboard.h"
 #include "native/os.h"
+#include "native/thread.h"
 
 #include <stdlib.h>
 #include <string.h>
 
 #define UTOX_MAX_BACKLOG_MESSAGES 256
+// Messages kept while the user is paging through older history.
+#define UTOX_MAX_HISTORY_MESSAGES (UTOX_MAX_BACKLOG_MESSAGES * 4)
+// Log records read per page of history.
+#define UTOX_HISTORY_PAGE_MESSAGES 64
+// Messages measured per redraw after a resize, on top of the ones in view.
+#define UTOX_RELAYOUT_SLICE_MESSAGES 256
+// Id of the first message, half way so that paging in older history never wraps around.
+#define MESSAGES_FIRST_ID (UINT32_MAX / 2)
 
 /** Appends a messages from self or friend to the message list;
  * will realloc or trim messages as needed;
@@ -53,8 +62,8 @@ static int msgheight(MSG_HEADER *msg, int width) {
         case MSG_TYPE_ACTION_TEXT:
         case MSG_TYPE_NOTICE:
         case MSG_TYPE_NOTICE_DAY_CHANGE: {
-            int  theight = text_height(abs(width - MESSAGES_X - TIME_WIDTH), font_small_lineheight,
-                                       msg->via.txt.msg, msg->via.txt.length);
+            int  theight = text_layout_height(&msg->layout, abs(width - MESSAGES_X - TIME_WIDTH),
+                                              font_small_lineheight, msg->via.txt.msg, msg->via.txt.length);
             return (theight == 0) ? 0 : theight + MESSAGES_SPACING;
         }
 
@@ -81,8 +90,8 @@ static int msgheight_group(MSG_HEADER *msg, int width) {
         case MSG_TYPE_ACTION_TEXT:
         case MSG_TYPE_NOTICE:
         case MSG_TYPE_NOTICE_DAY_CHANGE: {
-            int theight = text_height(abs(width - MESSAGES_X - TIME_WIDTH), font_small_lineheight,
-                                      msg->via.grp.msg, msg->via.grp.length);
+            int theight = text_layout_height(&msg->layout, abs(width - MESSAGES_X - TIME_WIDTH),
+                                             font_small_lineheight, msg->via.grp.msg, msg->via.grp.length);
             return (theight == 0) ? 0 : theight + MESSAGES_SPACING;
         }
 
@@ -106,93 +115,406 @@ static int message_setheight(MESSAGES *m, MSG_HEADER *msg) {
     } else {
         msg->height = msgheight(msg, m->width);
     }
+    msg->height_gen = m->height_gen;
 
     return msg->height;
 }
 
-static void message_updateheight(MESSAGES *m, MSG_HEADER *msg) {
+/* Guesses the height of msg at m->width from the number of lines its text wrapped into the last time
+ * it was measured, so it doesn't have to be measured again just yet. */
+static int message_estimateheight(MESSAGES *m, MSG_HEADER *msg) {
+    switch (msg->msg_type) {
+        case MSG_TYPE_TEXT:
+        case MSG_TYPE_ACTION_TEXT:
+        case MSG_TYPE_NOTICE:
+        case MSG_TYPE_NOTICE_DAY_CHANGE: {
+            const uint16_t length = m->is_groupchat ? msg->via.grp.length : msg->via.txt.length;
+            if (!length) {
+                return msg->height = 0;
+            }
+
+            const TEXT_LAYOUT *layout = &msg->layout;
+            const int right = abs(m->width - MESSAGES_X - TIME_WIDTH);
+
+            uint32_t lines = 1;
+            if (layout->valid && !layout->unfit && layout->right > 0 && right > 0) {
+                lines = ((uint32_t)layout->lines * layout->right + right - 1) / right;
+                lines = lines ? lines : 1;
+            }
+
+            return msg->height = lines * font_small_lineheight + MESSAGES_SPACING;
+        }
+
+        default: {
+            // Anything else is cheap to measure.
+            return message_setheight(m, msg);
+        }
+    }
+}
+
+// Slot of m->data holding message number index, counting from the oldest one held.
+#define MESSAGES_SLOT(m, index) ((m)->data[((m)->head + (index)) & ((m)->size - 1)])
+
+MSG_HEADER *message_at(const MESSAGES *m, uint32_t index) {
+    if (index >= m->number) {
+        return NULL;
+    }
+
+    return MESSAGES_SLOT(m, index);
+}
+
+// Returns the message with id id, or NULL if it's no longer held.
+static MSG_HEADER *message_get(const MESSAGES *m, uint32_t id) {
+    return message_at(m, id - m->base);
+}
+
+/* m->heights is a Fenwick tree over the slots of m->data, holding the height of the message in each
+ * slot and 0 for empty slots, so the height of any run of messages is O(log n) to find. */
+static void messages_heights_add(MESSAGES *m, uint32_t slot, int32_t delta) {
+    for (uint32_t i = slot + 1; i <= m->size; i += i & -i) {
+        m->heights[i - 1] += delta;
+    }
+}
+
+// Returns the height of the messages in the first slots slots of m->data.
+static uint32_t messages_heights_sum(const MESSAGES *m, uint32_t slots) {
+    uint32_t sum = 0;
+    for (uint32_t i = slots; i; i -= i & -i) {
+        sum += m->heights[i - 1];
+    }
+
+    return sum;
+}
+
+// Returns the slot holding the message y pixels below the top of slot 0.
+static uint32_t messages_heights_search(const MESSAGES *m, uint32_t y) {
+    uint32_t slot = 0;
+    for (uint32_t step = m->size; step; step >>= 1) {
+        if (slot + step <= m->size && m->heights[slot + step - 1] <= y) {
+            slot += step;
+            y    -= m->heights[slot - 1];
+        }
+    }
+
+    return slot;
+}
+
+static void messages_heights_rebuild(MESSAGES *m) {
+    memset(m->heights, 0, m->size * sizeof(*m->heights));
+
+    for (uint32_t i = 0; i < m->number; ++i) {
+        m->heights[(m->head + i) & (m->size - 1)] = MESSAGES_SLOT(m, i)->height;
+    }
+
+    for (uint32_t i = 1; i <= m->size; ++i) {
+        uint32_t parent = i + (i & -i);
+        if (parent <= m->size) {
+            m->heights[parent - 1] += m->heights[i - 1];
+        }
+    }
+}
+
+// Returns the height of the first count messages.
+static uint32_t messages_height_before(const MESSAGES *m, uint32_t count) {
+    const uint32_t head = messages_heights_sum(m, m->head);
+
+    if (m->head + count <= m->size) {
+        return messages_heights_sum(m, m->head + count) - head;
+    }
+
+    return messages_heights_sum(m, m->size) - head + messages_heights_sum(m, m->head + count - m->size);
+}
+
+// Returns the index of the message y pixels below the top of the first one, m->number if there's none.
+static uint32_t messages_find(const MESSAGES *m, int y) {
+    if (y < 0 || !m->number) {
+        return 0;
+    }
+
+    const uint32_t total = messages_heights_sum(m, m->size);
+    if ((uint32_t)y >= total) {
+        return m->number;
+    }
+
+    const uint32_t head  = messages_heights_sum(m, m->head);
+    const uint32_t after = total - head;
+
+    if ((uint32_t)y < after) {
+        return messages_heights_search(m, y + head) - m->head;
+    }
+
+    return messages_heights_search(m, y - after) + m->size - m->head;
+}
+
+static void message_updateheight(MESSAGES *m, uint32_t index) {
     if (m->width == 0) {
         return;
     }
 
     setfont(FONT_TEXT);
 
+    MSG_HEADER *msg = MESSAGES_SLOT(m, index);
+    const uint32_t height = msg->height;
+
     m->height   -= msg->height;
     msg->height  = message_setheight(m, msg);
     m->height   += msg->height;
+
+    messages_heights_add(m, (m->head + index) & (m->size - 1), msg->height - height);
 }
 
-static uint32_t message_add(MESSAGES *m, MSG_HEADER *msg) {
-    pthread_mutex_lock(&messages_lock);
+// Returns the index of the message with id id, clamped to the messages held.
+static uint32_t messages_clamp_index(const MESSAGES *m, uint32_t id) {
+    if ((int32_t)(id - m->base) < 0) {
+        return 0;
+    }
 
-    if (m->number < UTOX_MAX_BACKLOG_MESSAGES) {
-        if (!m->data || m->extra <= 0) {
-            if (m->data) {
-                m->data = realloc(m->data, (m->number + 10) * sizeof(void *));
-                m->extra += 10;
-            } else {
-                m->data = calloc(20, sizeof(void *));
-                m->extra = 20;
-            }
+    return MIN(id - m->base, m->number);
+}
 
-            if (!m->data) {
-                exit(1);
-            }
+/* Measures message number index if its height is only an estimate, keeping the view over the
+ * message at index first. Returns true if it had to be measured. */
+static bool messages_relayout_one(MESSAGES *m, uint32_t index, uint32_t first) {
+    MSG_HEADER *msg = MESSAGES_SLOT(m, index);
+    if (msg->height_gen == m->height_gen) {
+        return false;
+    }
+
+    const int height = msg->height;
+    message_updateheight(m, index);
+
+    m->history_resize += (int)msg->height - height;
+    if (index < first) {
+        m->history_shift += (int)msg->height - height;
+    }
+
+    return true;
+}
+
+/* Measures up to UTOX_RELAYOUT_SLICE_MESSAGES messages with an estimated height, working outwards from
+ * the one the view was over when the layout changed. Returns true if there are more left. */
+static bool messages_relayout(MESSAGES *m, uint32_t first) {
+    uint32_t up   = messages_clamp_index(m, m->relayout_up);
+    uint32_t down = messages_clamp_index(m, m->relayout_down);
+
+    uint32_t count = 0;
+    while (count < UTOX_RELAYOUT_SLICE_MESSAGES && (up > 0 || down < m->number)) {
+        if (down < m->number) {
+            count += messages_relayout_one(m, down++, first);
         }
-        m->data[m->number++] = msg;
-        m->extra--;
+
+        if (up > 0) {
+            count += messages_relayout_one(m, --up, first);
+        }
+    }
+
+    m->relayout_up   = m->base + up;
+    m->relayout_down = m->base + down;
+
+    return up > 0 || down < m->number;
+}
+
+static void messages_set_content_height(MESSAGES *m) {
+    if (flist_get_groupchat() && m->is_groupchat && flist_get_groupchat() == get_group(m->id)) {
+        m->panel.content_scroll->content_height = m->height;
+    } else if (flist_get_friend() && flist_get_friend()->number == get_friend(m->id)->number) {
+        m->panel.content_scroll->content_height = m->height;
+    }
+}
+
+// Makes room for count more messages in m->data.
+static bool messages_reserve(MESSAGES *m, uint32_t count) {
+    if (m->data && m->number + count <= m->size) {
+        return true;
+    }
+
+    uint32_t size = m->size ? m->size : 32;
+    while (size < m->number + count) {
+        size *= 2;
+    }
+
+    MSG_HEADER **data  = calloc(size, sizeof(MSG_HEADER *));
+    uint32_t *heights = calloc(size, sizeof(uint32_t));
+    if (!data || !heights) {
+        free(data);
+        free(heights);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < m->number; ++i) {
+        data[i] = MESSAGES_SLOT(m, i);
+    }
+
+    free(m->data);
+    free(m->heights);
+    m->data    = data;
+    m->heights = heights;
+    m->size    = size;
+    m->head    = 0;
+
+    messages_heights_rebuild(m);
+
+    return true;
+}
+
+static void messages_shift_cursor(uint32_t *msg, uint32_t *position, uint32_t at, uint32_t removed,
+                                  uint32_t inserted)
+{
+    if (*msg == UINT32_MAX || *msg < at) {
+        return;
+    }
+
+    if (*msg >= at + removed) {
+        *msg = *msg - removed + inserted;
     } else {
-        m->height -= m->data[0]->height;
-        message_free(m->data[0]);
-        memmove(m->data, m->data + 1, (UTOX_MAX_BACKLOG_MESSAGES - 1) * sizeof(MSG_HEADER *));
-        m->data[UTOX_MAX_BACKLOG_MESSAGES - 1] = msg;
-
-        // Scroll selection up so that it stays over the same messages.
-        if (m->sel_start_msg != UINT32_MAX) {
-            if (0 < m->sel_start_msg) {
-                m->sel_start_msg--;
-            } else {
-                m->sel_start_position = 0;
+        *msg      = at;
+        *position = 0;
+    }
+}
+
+/* Keeps selections and cursors over the same messages after messages were removed from or inserted
+ * into the middle of m->data, before the message with id at. */
+static void messages_shift_cursors(MESSAGES *m, uint32_t at, uint32_t removed, uint32_t inserted) {
+    messages_shift_cursor(&m->sel_start_msg, &m->sel_start_position, at, removed, inserted);
+    messages_shift_cursor(&m->sel_end_msg, &m->sel_end_position, at, removed, inserted);
+    messages_shift_cursor(&m->cursor_down_msg, &m->cursor_down_position, at, removed, inserted);
+    messages_shift_cursor(&m->cursor_over_msg, &m->cursor_over_position, at, removed, inserted);
+}
+
+static void messages_clamp_cursor(uint32_t *msg, uint32_t *position, uint32_t base) {
+    if (*msg != UINT32_MAX && *msg < base) {
+        *msg      = base;
+        *position = 0;
+    }
+}
+
+/* Frees count messages starting at index at, which must be either the top of m->data or the bottom of
+ * the paged history. Returns the height of the removed messages. Call with messages_lock held. */
+static int messages_remove(MESSAGES *m, uint32_t at, uint32_t count) {
+    int height = 0;
+
+    for (uint32_t i = at; i < at + count; ++i) {
+        MSG_HEADER *msg = MESSAGES_SLOT(m, i);
+
+        if (i < m->history_end) {
+            if (msg->slab) {
+                m->history_loaded--;
+                if (at) {
+                    // Paged out below the history, it'll have to be read again to fill the gap.
+                    m->history_gap++;
+                }
             }
+        } else if (msg->slab || msg->logged) {
+            m->history_live--;
         }
 
-        if (m->sel_end_msg != UINT32_MAX) {
-            if (0 < m->sel_end_msg) {
-                m->sel_end_msg--;
-            } else {
-                m->sel_end_position = 0;
-            }
+        height += msg->height;
+        messages_heights_add(m, (m->head + i) & (m->size - 1), -(int32_t)msg->height);
+        message_free(msg);
+    }
+
+    m->height -= height;
+
+    if (at == 0) {
+        /* Dropping the oldest messages doesn't move the others, only cursors over the dropped
+         * messages need to move down onto the new first one. */
+        m->head    = (m->head + count) & (m->size - 1);
+        m->base   += count;
+        m->number -= count;
+
+        messages_clamp_cursor(&m->sel_start_msg, &m->sel_start_position, m->base);
+        messages_clamp_cursor(&m->sel_end_msg, &m->sel_end_position, m->base);
+        messages_clamp_cursor(&m->cursor_down_msg, &m->cursor_down_position, m->base);
+        messages_clamp_cursor(&m->cursor_over_msg, &m->cursor_over_position, m->base);
+    } else {
+        for (uint32_t i = at; i + count < m->number; ++i) {
+            MESSAGES_SLOT(m, i) = MESSAGES_SLOT(m, i + count);
         }
+        m->number -= count;
+        messages_heights_rebuild(m);
 
-        if (m->cursor_down_msg != UINT32_MAX) {
-            if (0 < m->cursor_down_msg) {
-                m->cursor_down_msg--;
-            } else {
-                m->cursor_down_position = 0;
-            }
+        messages_shift_cursors(m, m->base + at, count, 0);
+    }
+
+    if (at < m->history_end) {
+        m->history_end -= MIN(count, m->history_end - at);
+    }
+
+    if (at == 0) {
+        m->history_done = false;
+        if (!m->history_end) {
+            // Nothing is left above the gap, so it's just older history now.
+            m->history_gap = 0;
         }
-        if (m->cursor_over_msg != UINT32_MAX) {
-            if (0 < m->cursor_over_msg) {
-                m->cursor_over_msg--;
-            } else {
-                m->cursor_over_position = 0;
-            }
+    }
+
+    return height;
+}
+
+/* Inserts count messages into m->data at index at. Returns the height of the inserted messages.
+ * Call with messages_lock held. */
+static int messages_insert(MESSAGES *m, uint32_t at, MSG_HEADER **msgs, uint32_t count) {
+    if (!messages_reserve(m, count)) {
+        return -1;
+    }
+
+    if (at == 0) {
+        // The ids of the messages already held stay the same.
+        m->head  = (m->head - count) & (m->size - 1);
+        m->base -= count;
+    } else {
+        for (uint32_t i = m->number; i-- > at;) {
+            MESSAGES_SLOT(m, i + count) = MESSAGES_SLOT(m, i);
         }
+
+        messages_shift_cursors(m, m->base + at, 0, count);
     }
+    m->number += count;
 
-    message_updateheight(m, msg);
+    int height = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        MESSAGES_SLOT(m, at + i) = msgs[i];
+        height += message_setheight(m, msgs[i]);
+    }
+    m->height += height;
 
-    if (flist_get_groupchat() && m->is_groupchat && flist_get_groupchat() == get_group(m->id)) {
-        m->panel.content_scroll->content_height = m->height;
-    } else if (flist_get_friend() && flist_get_friend()->number == get_friend(m->id)->number) {
-        m->panel.content_scroll->content_height = m->height;
+    if (at == 0) {
+        for (uint32_t i = 0; i < count; ++i) {
+            messages_heights_add(m, (m->head + i) & (m->size - 1), msgs[i]->height);
+        }
+    } else {
+        messages_heights_rebuild(m);
+    }
+
+    if (at <= m->history_end) {
+        m->history_end += count;
+    }
+
+    return height;
+}
+
+static uint32_t message_add(MESSAGES *m, MSG_HEADER *msg) {
+    pthread_mutex_lock(&messages_lock);
+
+    if (m->number >= (m->history_paged ? UTOX_MAX_HISTORY_MESSAGES : UTOX_MAX_BACKLOG_MESSAGES)) {
+        messages_remove(m, 0, 1);
+    }
+
+    if (!messages_reserve(m, 1)) {
+        exit(1);
     }
 
+    MESSAGES_SLOT(m, m->number++) = msg;
+
+    message_updateheight(m, m->number - 1);
+    messages_set_content_height(m);
+
     pthread_mutex_unlock(&messages_lock);
     return m->number;
 }
 
-static bool msg_add_day_notice(MESSAGES *m, time_t last, time_t next) {
+// Returns a new day change notice if next is on a later day than last, NULL otherwise.
+static MSG_HEADER *msg_day_notice(time_t last, time_t next) {
     /* The tm struct is shared, we have to do it this way */
     int ltime_year = 0, ltime_mon = 0, ltime_day = 0;
 
@@ -220,11 +542,20 @@ static bool msg_add_day_notice(MESSAGES *m, time_t last, time_t next) {
         msg->via.notice_day.length = strftime((char *)msg->via.notice_day.msg, 256,
                                               "Day has changed to %A %B %d %Y", msg_time);
 
-        message_add(m, msg);
-        return true;
+        return msg;
     }
 
-    return false;
+    return NULL;
+}
+
+static bool msg_add_day_notice(MESSAGES *m, time_t last, time_t next) {
+    MSG_HEADER *msg = msg_day_notice(last, next);
+    if (!msg) {
+        return false;
+    }
+
+    message_add(m, msg);
+    return true;
 }
 
 /* TODO leaving this here is a little hacky, but it was the fastest way
@@ -259,7 +590,7 @@ uint32_t message_add_type_text(MESSAGES *m, bool auth, const char *msgtxt, uint1
     memcpy(msg->via.txt.msg, msgtxt, length);
 
     if (m->data && m->number) {
-        MSG_HEADER *day_msg = m->data[m->number ? m->number - 1 : 0];
+        MSG_HEADER *day_msg = message_at(m, m->number - 1);
         msg_add_day_notice(m, day_msg->time, msg->time);
     }
 
@@ -445,6 +776,11 @@ bool message_log_to_disk(MESSAGES *m, MSG_HEADER *msg) {
             strcpy2(data + length - 1, "\n");
 
             msg->disk_offset = utox_save_chatlog(f->id_str, data, length);
+            msg->logged      = true;
+
+            pthread_mutex_lock(&messages_lock);
+            m->history_live++;
+            pthread_mutex_unlock(&messages_lock);
 
             free(data);
             return true;
@@ -469,6 +805,8 @@ bool messages_read_from_log(uint32_t friend_number) {
     time_t last = 0;
 
     if (data) {
+        bool done = actual_count < UTOX_MAX_BACKLOG_MESSAGES;
+
         MSG_HEADER **p = data;
         MSG_HEADER *msg;
         while (actual_count--) {
@@ -482,12 +820,255 @@ bool messages_read_from_log(uint32_t friend_number) {
             }
         }
         free(data);
+
+        /* Everything read so far is the first page of history. */
+        pthread_mutex_lock(&messages_lock);
+        MESSAGES *m = &f->msg;
+        m->history_end    = m->number;
+        m->history_loaded = 0;
+        for (uint32_t i = 0; i < m->number; ++i) {
+            m->history_loaded += !!message_at(m, i)->slab;
+        }
+        m->history_done = done;
+        pthread_mutex_unlock(&messages_lock);
+
         return true;
     }
 
     return false;
 }
 
+/* Pages of history are read from the log by a single loader thread, started with the first one, and handed
+ * back to the UI thread to be inserted and measured. Either the page just above what's loaded, or the page
+ * at the top of the gap left by paging out newer history. */
+struct messages_history_load {
+    uint32_t friend_number;
+    bool     older;
+
+    // What the messages looked like when the page was read, and the page.
+    uint32_t     loaded, gap, live, count;
+    MSG_HEADER **data;
+    size_t       actual_count;
+
+    struct messages_history_load *next;
+};
+
+static pthread_mutex_t        history_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t         history_cond = PTHREAD_COND_INITIALIZER;
+static MESSAGES_HISTORY_LOAD *history_first, *history_last;
+static bool                   history_running;
+
+static void messages_history_free(MESSAGES_HISTORY_LOAD *load) {
+    for (size_t i = 0; load->data && i < load->actual_count; ++i) {
+        if (load->data[i]) {
+            message_free(load->data[i]);
+        }
+    }
+    free(load->data);
+    free(load);
+}
+
+// Reads the page of load from the log, and posts it to the UI thread.
+static void messages_history_read(MESSAGES_HISTORY_LOAD *load) {
+    pthread_mutex_lock(&messages_lock);
+
+    FRIEND *f = get_friend(load->friend_number);
+    if (!f || !f->msg.history_loading) {
+        pthread_mutex_unlock(&messages_lock);
+        free(load);
+        return;
+    }
+
+    MESSAGES *m = &f->msg;
+
+    char hex[TOX_PUBLIC_KEY_SIZE * 2];
+    memcpy(hex, f->id_str, sizeof(hex));
+
+    load->loaded = m->history_loaded;
+    load->gap    = m->history_gap;
+    load->live   = m->history_live;
+    load->count  = load->older ? UTOX_HISTORY_PAGE_MESSAGES : MIN(load->gap, UTOX_HISTORY_PAGE_MESSAGES);
+    const uint32_t skip = load->older ? load->live + load->gap + load->loaded
+                                      : load->live + load->gap - load->count;
+
+    pthread_mutex_unlock(&messages_lock);
+
+    load->data = utox_load_chatlog(hex, &load->actual_count, load->count, skip);
+
+    postmessage_utox(FRIEND_HISTORY_PAGE, 0, 0, load);
+}
+
+static void messages_history_thread(void *UNUSED(args)) {
+    while (1) {
+        pthread_mutex_lock(&history_lock);
+        while (!history_first) {
+            pthread_cond_wait(&history_cond, &history_lock);
+        }
+
+        MESSAGES_HISTORY_LOAD *load = history_first;
+        history_first = load->next;
+        if (!history_first) {
+            history_last = NULL;
+        }
+        pthread_mutex_unlock(&history_lock);
+
+        messages_history_read(load);
+    }
+}
+
+void messages_history_page(MESSAGES_HISTORY_LOAD *load) {
+    pthread_mutex_lock(&messages_lock);
+
+    FRIEND   *f = get_friend(load->friend_number);
+    MESSAGES *m = f ? &f->msg : NULL;
+    if (!m || !m->history_loading
+        || m->history_loaded != load->loaded || m->history_gap != load->gap || m->history_live != load->live)
+    {
+        /* The messages changed while the page was read, the next draw will ask again. */
+        if (m) {
+            m->history_loading = false;
+        }
+        pthread_mutex_unlock(&messages_lock);
+        messages_history_free(load);
+        return;
+    }
+
+    const bool     older = load->older;
+    const uint32_t count = load->count, gap = load->gap;
+
+    // Room for a day change notice before every message, and after the last one.
+    MSG_HEADER *page[UTOX_HISTORY_PAGE_MESSAGES * 2 + 1];
+    uint32_t page_count = 0, records = 0;
+
+    time_t last = (older || !m->history_end) ? 0 : message_at(m, m->history_end - 1)->time;
+    time_t page_last = 0;
+    for (size_t i = 0; load->data && i < load->actual_count; ++i) {
+        MSG_HEADER *msg = load->data[i];
+        if (!msg) {
+            continue;
+        }
+
+        MSG_HEADER *notice = msg_day_notice(last, msg->time);
+        if (notice) {
+            page[page_count++] = notice;
+            last = msg->time;
+        }
+
+        page[page_count++] = msg;
+        page_last = msg->time;
+        records++;
+    }
+
+    const size_t actual_count = load->actual_count;
+    free(load->data);
+    free(load);
+
+    /* The first of the messages the page goes in front of got its day change notice against
+     * whatever came before it then. Now it follows the page, so it only needs one if the page ended
+     * on an earlier day. */
+    const uint32_t at = older ? 0 : m->history_end;
+    if (records && at < m->number) {
+        const bool had_notice = message_at(m, at)->msg_type == MSG_TYPE_NOTICE_DAY_CHANGE;
+        const uint32_t next = at + had_notice;
+
+        if (next < m->number) {
+            MSG_HEADER *notice = msg_day_notice(page_last, message_at(m, next)->time);
+            if (notice && !had_notice) {
+                page[page_count++] = notice;
+            } else if (notice) {
+                message_free(notice);
+            } else if (had_notice) {
+                const int removed = messages_remove(m, at, 1);
+                m->history_resize -= removed;
+                if (older) {
+                    m->history_shift -= removed;
+                }
+            }
+        }
+    }
+
+    int height = messages_insert(m, at, page, page_count);
+    if (height < 0) {
+        for (uint32_t i = 0; i < page_count; ++i) {
+            message_free(page[i]);
+        }
+        m->history_loading = false;
+        pthread_mutex_unlock(&messages_lock);
+        return;
+    }
+
+    m->history_loaded += records;
+    m->history_resize += height;
+
+    if (older) {
+        m->history_shift += height;
+        m->history_paged  = true;
+        m->history_done   = actual_count < count;
+
+        /* Page out the newest history, far below the view. */
+        uint32_t evict = 0;
+        if (m->number > UTOX_MAX_HISTORY_MESSAGES) {
+            evict = MIN(m->number - UTOX_MAX_HISTORY_MESSAGES, m->history_end - page_count);
+        }
+
+        if (evict) {
+            m->history_resize -= messages_remove(m, m->history_end - evict, evict);
+        }
+    } else {
+        // Anything short of a full page means the log is shorter than we thought, so stop looking.
+        m->history_gap = records < count ? 0 : gap - records;
+
+        /* Page out the oldest history, far above the view. */
+        uint32_t first = m->history_end - page_count;
+        if (m->number > UTOX_MAX_HISTORY_MESSAGES && first) {
+            height = messages_remove(m, 0, MIN(m->number - UTOX_MAX_HISTORY_MESSAGES, first));
+            m->history_resize -= height;
+            m->history_shift  -= height;
+        }
+    }
+
+    messages_set_content_height(m);
+    m->history_loading = false;
+
+    pthread_mutex_unlock(&messages_lock);
+}
+
+/* Puts the next page of history in line for the loader thread, if there's one to read.
+ * Call with messages_lock held. */
+static void messages_history_load(MESSAGES *m, bool older) {
+    if (m->is_groupchat || m->history_loading) {
+        return;
+    }
+
+    if (older ? m->history_done : !m->history_gap) {
+        return;
+    }
+
+    MESSAGES_HISTORY_LOAD *load = calloc(1, sizeof(MESSAGES_HISTORY_LOAD));
+    if (!load) {
+        return;
+    }
+
+    load->friend_number = m->id;
+    load->older         = older;
+    m->history_loading  = true;
+
+    pthread_mutex_lock(&history_lock);
+    if (history_last) {
+        history_last->next = load;
+    } else {
+        history_first = load;
+    }
+    history_last = load;
+
+    if (!history_running) {
+        history_running = true;
+        thread(messages_history_thread, NULL);
+    }
+    pthread_cond_signal(&history_cond);
+    pthread_mutex_unlock(&history_lock);
+}
+
 void messages_send_from_queue(MESSAGES *m, uint32_t friend_number) {
     uint32_t start    = m->number;
     uint8_t  seek_num = 3; /* this magic number is the number of messages we'll skip looking for the first unsent */
@@ -504,8 +1085,8 @@ void messages_send_from_queue(MESSAGES *m, uint32_t friend_number) {
             break;
         }
 
-        if (m->data[start]) {
-            MSG_HEADER *msg = m->data[start];
+        MSG_HEADER *msg = message_at(m, start);
+        if (msg) {
             if (msg->msg_type == MSG_TYPE_TEXT || msg->msg_type == MSG_TYPE_ACTION_TEXT) {
                 if (msg->our_msg) {
                     if (msg->receipt_time) {
@@ -521,8 +1102,8 @@ void messages_send_from_queue(MESSAGES *m, uint32_t friend_number) {
     int sent_count = 0;
     /* start sending messages, hopefully in order */
     while (start < m->number && sent_count <= 25) {
-        if (m->data[start]) {
-            MSG_HEADER *msg = m->data[start];
+        MSG_HEADER *msg = message_at(m, start);
+        if (msg) {
             if (msg->msg_type == MSG_TYPE_TEXT || msg->msg_type == MSG_TYPE_ACTION_TEXT) {
                 if (msg->our_msg && !msg->receipt_time) {
                     postmessage_toxcore((msg->msg_type == MSG_TYPE_TEXT ? TOX_SEND_MESSAGE : TOX_SEND_ACTION),
@@ -542,8 +1123,8 @@ void messages_clear_receipt(MESSAGES *m, uint32_t receipt_number) {
     uint32_t start = m->number;
 
     while (start--) {
-        if (m->data[start]) {
-            MSG_HEADER *msg = m->data[start];
+        MSG_HEADER *msg = message_at(m, start);
+        if (msg) {
             if (msg->msg_type == MSG_TYPE_TEXT || msg->msg_type == MSG_TYPE_ACTION_TEXT) {
                 if (msg->receipt == receipt_number) {
                     msg->receipt = -1;
@@ -616,7 +1197,8 @@ static void messages_draw_author(int x, int y, int w, char *name, uint32_t lengt
     drawtextwidth_right(x, w, y, name, length);
 }
 
-static int messages_draw_text(const char *msg, size_t length, uint32_t msg_height, uint8_t msg_type,
+static int messages_draw_text(TEXT_LAYOUT *layout, const char *msg, size_t length, uint32_t msg_height,
+                              uint8_t msg_type,
                               bool author, bool receipt, uint16_t highlight_start,
                               uint16_t highlight_end, int x, int y, int w, int UNUSED(h))
 {
@@ -643,9 +1225,9 @@ static int messages_draw_text(const char *msg, size_t length, uint32_t msg_heigh
 
     setfont(FONT_TEXT);
 
-    int ny = utox_draw_text_multiline_within_box(x, y, w + x, MAIN_TOP, y + msg_height,
-                                                 font_small_lineheight, msg,
-                                                 length, highlight_start, highlight_end, 0, 0, 1);
+    int ny = utox_draw_text_layout_within_box(layout, x, y, w + x, MAIN_TOP, y + msg_height,
+                                              font_small_lineheight, msg,
+                                              length, highlight_start, highlight_end, 0, 0);
     return ny;
 }
 
@@ -927,11 +1509,46 @@ static int messages_draw_group(MESSAGES *m, MSG_HEADER *msg, uint32_t curr_msg_i
 
     messages_draw_author(x, y, MESSAGES_X - NAME_OFFSET, msg->via.grp.author, msg->via.grp.author_length, msg->via.grp.author_color);
     messages_draw_timestamp(x + width, y, &msg->time);
-    return messages_draw_text(msg->via.grp.msg, msg->via.grp.length, msg->height, msg->msg_type,
+    return messages_draw_text(&msg->layout, msg->via.grp.msg, msg->via.grp.length, msg->height, msg->msg_type,
                               msg->our_msg, 1, h1, h2, x + MESSAGES_X, y,
                               width - TIME_WIDTH - MESSAGES_X, height) + MESSAGES_SPACING;
 }
 
+/* Sets the content height of scroll to that of m, applying the content height and scroll offset changes
+ * in m->history_resize and history_shift so the view stays over the same messages, unless it's at the
+ * bottom. Takes the top of the messages for the scroll offset so far, returns it for the new one. */
+static int messages_apply_resize(MESSAGES *m, SCROLLABLE *scroll, int height, int y) {
+    const int before = scroll_gety(scroll, height);
+
+    if (scroll->d < 1.0 && (m->history_resize || m->history_shift)) {
+        const int old_content = m->height - m->history_resize;
+        const int old_y       = old_content > height ? scroll->d * (old_content - height) + 0.5 : 0;
+        const int new_y       = old_y + m->history_shift;
+
+        if (m->height > height) {
+            scroll->d = (double)new_y / (m->height - height);
+            scroll->d = scroll->d < 0.0 ? 0.0 : scroll->d > 1.0 ? 1.0 : scroll->d;
+        }
+    }
+
+    scroll->content_height = m->height;
+    m->history_resize = m->history_shift = 0;
+
+    return y + before - scroll_gety(scroll, height);
+}
+
+/* Returns the index of the first message that reaches into the view, moving y from the top of the
+ * messages to the top of that one. */
+static uint32_t messages_first(const MESSAGES *m, int *y) {
+    if (*y >= MAIN_TOP) {
+        return 0;
+    }
+
+    const uint32_t first = messages_find(m, MAIN_TOP - *y);
+    *y += messages_height_before(m, first);
+    return first;
+}
+
 /** Formats all messages from self and friends, and then call draw functions
  * to write them to the UI.
  *
@@ -948,19 +1565,60 @@ void messages_draw(PANEL *panel, int x, int y, int width, int height) {
     // Do not draw author name next to every message
     uint8_t lastauthor = 0xFF;
 
-    // Message iterator
-    MSG_HEADER **p = m->data;
-    uint32_t n = m->number;
+    messages_updateheight(m, width);
 
-    if (m->width != width) {
-        m->width = width;
-        messages_updateheight(m, width - MESSAGES_X + TIME_WIDTH);
-        y -= scroll_gety(panel->content_scroll, height);
+    SCROLLABLE *scroll = panel->content_scroll;
+    y = messages_apply_resize(m, scroll, height, y);
+
+    if (m->history_paged && scroll->d >= 1.0 && !m->history_loading) {
+        /* Back at the bottom, page out the older history far above the view. */
+        if (m->number > UTOX_MAX_BACKLOG_MESSAGES) {
+            const int before = scroll_gety(scroll, height);
+            messages_remove(m, 0, m->number - UTOX_MAX_BACKLOG_MESSAGES);
+            messages_set_content_height(m);
+            y += before - scroll_gety(scroll, height);
+        }
+        m->history_paged = false;
+    } else if (scroll_gety(scroll, height) < height) {
+        messages_history_load(m, true);
+    }
+
+    /* Skip straight to the first message that reaches into the view. */
+    const int top_of_messages = y;
+    uint32_t  first           = messages_first(m, &y);
+
+    if (m->relayout_up != m->base || m->relayout_down != m->base + m->number) {
+        /* Still relaying out after a resize, measure what's in view now and some more of the rest. */
+        int top = y;
+        for (uint32_t i = first; i < m->number && top < height + SCALE(100); ++i) {
+            messages_relayout_one(m, i, first);
+            top += MESSAGES_SLOT(m, i)->height;
+        }
+
+        if (messages_relayout(m, first)) {
+            postmessage_utox(REDRAW, 0, 0, NULL);
+        }
+
+        y     = messages_apply_resize(m, scroll, height, top_of_messages);
+        first = messages_first(m, &y);
+    }
+
+    m->view_msg    = m->base + first;
+    m->view_offset = MAX(MAIN_TOP - y, 0);
+
+    if (m->history_end < first && m->history_gap) {
+        // The gap under the history is above the view.
+        messages_history_load(m, false);
     }
 
-    // Go through messages
-    for (size_t curr_msg_i = 0; curr_msg_i != n; curr_msg_i++) {
-        MSG_HEADER *msg = *p++;
+    // Go through messages, curr_msg_i is the id of msg.
+    for (uint32_t curr_msg_i = m->base + first; curr_msg_i != m->base + m->number; curr_msg_i++) {
+        MSG_HEADER *msg = message_get(m, curr_msg_i);
+
+        if (curr_msg_i - m->base == m->history_end && m->history_gap && y < height * 2) {
+            // The gap under the history is coming into view.
+            messages_history_load(m, false);
+        }
 
         /* Decide if we should even bother drawing this message. */
         if (msg->height == 0) {
@@ -1079,7 +1737,7 @@ void messages_draw(PANEL *panel, int x, int y, int width, int height) {
                     }
                 }
 
-                y = messages_draw_text(msg->via.notice.msg, msg->via.notice.length, msg->height,
+                y = messages_draw_text(&msg->layout, msg->via.notice.msg, msg->via.notice.length, msg->height,
                                        msg->msg_type, msg->our_msg, msg->receipt_time,
                                        h1, h2, x + MESSAGES_X, y, width - TIME_WIDTH - MESSAGES_X, height);
                 break;
@@ -1105,13 +1763,13 @@ void messages_draw(PANEL *panel, int x, int y, int width, int height) {
     pthread_mutex_unlock(&messages_lock);
 }
 
-static bool messages_mmove_text(MESSAGES *m, int width, int mx, int my, int dy, char *message,
-                                uint32_t msg_height, uint16_t msg_length)
+static bool messages_mmove_text(MESSAGES *m, TEXT_LAYOUT *layout, int width, int mx, int my, int dy,
+                                char *message, uint32_t msg_height, uint16_t msg_length)
 {
     cursor = CURSOR_TEXT;
-    m->cursor_over_position = hittextmultiline(mx - MESSAGES_X, width - MESSAGES_X - TIME_WIDTH,
-                                               (my < 0 ? 0 : my), msg_height, font_small_lineheight,
-                                               message, msg_length, 1);
+    m->cursor_over_position = hittext_layout(layout, mx - MESSAGES_X, width - MESSAGES_X - TIME_WIDTH,
+                                             (my < 0 ? 0 : my), msg_height, font_small_lineheight,
+                                             message, msg_length);
 
     if (my < 0 || my >= dy || mx < MESSAGES_X || m->cursor_over_position == msg_length) {
         m->cursor_over_uri = UINT32_MAX;
@@ -1201,9 +1859,9 @@ bool messages_mmove(PANEL *panel, int UNUSED(px), int UNUSED(py), int width, int
         m->cursor_over_time = 0;
     }
 
-    if (m->cursor_down_msg < m->number) {
+    if (message_get(m, m->cursor_down_msg)) {
         uint32_t maxwidth = width - MESSAGES_X - TIME_WIDTH;
-        MSG_HEADER *msg = m->data[m->cursor_down_msg];
+        MSG_HEADER *msg = message_get(m, m->cursor_down_msg);
         if ((msg->msg_type == MSG_TYPE_IMAGE) && (msg->via.img.w > maxwidth)) {
             msg->via.img.position -= (double)dx / (double)(msg->via.img.w - maxwidth);
             if (msg->via.img.position > 1.0) {
@@ -1226,12 +1884,15 @@ bool messages_mmove(PANEL *panel, int UNUSED(px), int UNUSED(py), int width, int
 
     setfont(FONT_TEXT);
 
-    MSG_HEADER **p = m->data;
-    uint32_t i = 0;
     bool need_redraw = false;
 
-    while (i < m->number) {
-        MSG_HEADER *msg = *p++;
+    /* Skip straight to the message under the mouse. */
+    uint32_t first = messages_find(m, my);
+    my -= messages_height_before(m, first);
+
+    uint32_t i = m->base + first;
+    while (i != m->base + m->number) {
+        MSG_HEADER *msg = message_get(m, i);
 
         int dy = msg->height; /* dy is the wrong name here, you should change it! */
 
@@ -1248,10 +1909,10 @@ bool messages_mmove(PANEL *panel, int UNUSED(px), int UNUSED(py), int width, int
                 case MSG_TYPE_NOTICE:
                 case MSG_TYPE_NOTICE_DAY_CHANGE: {
                     if (m->is_groupchat) {
-                        messages_mmove_text(m, width, mx, my, dy, msg->via.grp.msg,
+                        messages_mmove_text(m, &msg->layout, width, mx, my, dy, msg->via.grp.msg,
                                             msg->height, msg->via.grp.length);
                     } else {
-                        messages_mmove_text(m, width, mx, my, dy, msg->via.txt.msg,
+                        messages_mmove_text(m, &msg->layout, width, mx, my, dy, msg->via.txt.msg,
                                             msg->height, msg->via.txt.length);
                     }
                     if (m->cursor_down_msg != UINT32_MAX
@@ -1280,7 +1941,7 @@ bool messages_mmove(PANEL *panel, int UNUSED(px), int UNUSED(py), int width, int
             }
 
             if (i != m->cursor_over_msg && m->cursor_over_msg != UINT32_MAX
-                && (msg->msg_type == MSG_TYPE_FILE || m->data[m->cursor_over_msg]->msg_type == MSG_TYPE_FILE)) {
+                && (msg->msg_type == MSG_TYPE_FILE || message_get(m, m->cursor_over_msg)->msg_type == MSG_TYPE_FILE)) {
                 need_redraw = true; // Redraw file on hover-in/out.
             }
 
@@ -1321,8 +1982,8 @@ bool messages_mdown(PANEL *panel) {
     MESSAGES *m        = panel->object;
     m->cursor_down_msg = UINT32_MAX;
 
-    if (m->cursor_over_msg != UINT32_MAX) {
-        MSG_HEADER *msg = m->data[m->cursor_over_msg];
+    MSG_HEADER *msg = message_get(m, m->cursor_over_msg);
+    if (msg) {
         switch (msg->msg_type) {
             case MSG_TYPE_NULL: {
                 return false;
@@ -1345,7 +2006,7 @@ bool messages_mdown(PANEL *panel) {
                 if (m->cursor_over_position) {
                     if (!msg->via.img.zoom) {
                         msg->via.img.zoom = 1;
-                        message_updateheight(m, msg);
+                        message_updateheight(m, m->cursor_over_msg - m->base);
                     } else {
                         m->cursor_down_msg = m->cursor_over_msg;
                     }
@@ -1358,15 +2019,6 @@ bool messages_mdown(PANEL *panel) {
                     break;
                 }
 
-                FRIEND *f = get_friend(m->id);
-                FILE_TRANSFER *ft;
-                uint32_t ft_number = msg->via.ft.file_number;
-                if (ft_number >= (1 << 16)) {
-                    ft = &f->ft_incoming[(ft_number >> 16) - 1]; // TODO, abstraction needed
-                } else {
-                    ft = &f->ft_outgoing[ft_number]; // TODO, abstraction needed
-                }
-
                 if (msg->via.ft.file_status == FILE_TRANSFER_STATUS_COMPLETED) {
                     if (m->cursor_over_position) {
                         if (msg->via.ft.inline_png) {
@@ -1380,18 +2032,19 @@ bool messages_mdown(PANEL *panel) {
                 }
 
                 if (m->cursor_over_position == 2) { // Right button, should be accept/pause/resume
+                    // Everything the transfer needs is in msg, the transfer itself is the toxcore thread's.
                     if (!msg->our_msg && msg->via.ft.file_status == FILE_TRANSFER_STATUS_NONE) {
-                        native_select_dir_ft(m->id, msg->via.ft.file_number, ft);
+                        native_select_dir_ft(m->id, msg);
                         return true;
                     }
 
                     if (msg->via.ft.file_status == FILE_TRANSFER_STATUS_ACTIVE) {
-                        postmessage_toxcore(TOX_FILE_PAUSE, m->id, msg->via.ft.file_number, ft);
+                        postmessage_toxcore(TOX_FILE_PAUSE, m->id, msg->via.ft.file_number, NULL);
                     } else {
-                        postmessage_toxcore(TOX_FILE_RESUME, m->id, msg->via.ft.file_number, ft);
+                        postmessage_toxcore(TOX_FILE_RESUME, m->id, msg->via.ft.file_number, NULL);
                     }
                 } else if (m->cursor_over_position == 1) { // Should be cancel
-                    postmessage_toxcore(TOX_FILE_CANCEL, m->id, msg->via.ft.file_number, ft);
+                    postmessage_toxcore(TOX_FILE_CANCEL, m->id, msg->via.ft.file_number, NULL);
                 }
 
                 return true;
@@ -1419,8 +2072,8 @@ bool messages_dclick(PANEL *panel, bool triclick) {
         return true;
     }
 
-    if (m->cursor_over_msg != UINT32_MAX) {
-        MSG_HEADER *msg = m->data[m->cursor_over_msg];
+    MSG_HEADER *msg = message_get(m, m->cursor_over_msg);
+    if (msg) {
 
         switch (msg->msg_type) {
             case MSG_TYPE_NULL: {
@@ -1460,7 +2113,7 @@ bool messages_dclick(PANEL *panel, bool triclick) {
                 if (m->cursor_over_position) {
                     if (msg->via.img.zoom) {
                         msg->via.img.zoom = 0;
-                        message_updateheight(m, msg);
+                        message_updateheight(m, m->cursor_over_msg - m->base);
                     }
                 }
 
@@ -1478,12 +2131,11 @@ static void contextmenu_messages_onselect(uint8_t i) {
 
 bool messages_mright(PANEL *panel) {
     const MESSAGES *m = panel->object;
-    if (m->cursor_over_msg == UINT32_MAX) {
+    const MSG_HEADER *msg = message_get(m, m->cursor_over_msg);
+    if (!msg) {
         return false;
     }
 
-    const MSG_HEADER *msg = m->data[m->cursor_over_msg];
-
     switch (msg->msg_type) {
         case MSG_TYPE_NULL: {
             return false;
@@ -1518,8 +2170,8 @@ bool messages_mup(PANEL *panel) {
         return false;
     }
 
-    if (m->cursor_over_msg != UINT32_MAX) {
-        MSG_HEADER *msg = m->data[m->cursor_over_msg];
+    MSG_HEADER *msg = message_get(m, m->cursor_over_msg);
+    if (msg) {
         if (msg->msg_type == MSG_TYPE_TEXT) {
             if (m->cursor_over_uri != UINT32_MAX && m->cursor_down_uri == m->cursor_over_uri
                 && m->cursor_over_position >= m->cursor_over_uri
@@ -1561,12 +2213,14 @@ int messages_selection(PANEL *panel, char *buffer, uint32_t len, bool names) {
     }
 
     uint32_t i = m->sel_start_msg, n = m->sel_end_msg + 1;
-    MSG_HEADER **dp = &m->data[i];
 
     char *p = buffer;
 
     while (i != UINT32_MAX && i != n) {
-        const MSG_HEADER *msg = *dp++;
+        const MSG_HEADER *msg = message_get(m, i);
+        if (!msg) {
+            break;
+        }
 
         if (names && (i != m->sel_start_msg || m->sel_start_position == 0)) {
             if (m->is_groupchat) {
@@ -1677,15 +2331,45 @@ void messages_updateheight(MESSAGES *m, int width) {
         return;
     }
 
+    if (width == m->width && ui_scale == m->scale) {
+        return;
+    }
+
+    /* Keep the top of the view the same distance into the message it's over. */
+    uint32_t anchor = messages_clamp_index(m, m->view_msg);
+    int      offset = m->view_offset;
+    if (anchor == m->number) {
+        anchor = 0;
+        offset = 0;
+    }
+
+    const int      old_height        = m->height;
+    const int      old_top           = messages_height_before(m, anchor) + offset;
+    const uint32_t old_anchor_height = anchor < m->number ? message_at(m, anchor)->height : 0;
+
+    m->width = width;
+    m->scale = ui_scale;
+    m->height_gen++;
+
     setfont(FONT_TEXT);
 
     uint32_t height = 0;
 
     for (uint32_t i = 0; i < m->number; ++i) {
-        height += message_setheight(m, (void *)m->data[i]);
+        height += message_estimateheight(m, message_at(m, i));
     }
+    messages_heights_rebuild(m);
 
     m->panel.content_scroll->content_height = m->height = height;
+
+    if (old_anchor_height) {
+        offset = (int64_t)offset * message_at(m, anchor)->height / old_anchor_height;
+    }
+
+    m->history_resize += m->height - old_height;
+    m->history_shift  += (int)messages_height_before(m, anchor) + offset - old_top;
+
+    m->relayout_up = m->relayout_down = m->base + anchor;
 }
 
 bool messages_char(uint32_t ch) {
@@ -1734,14 +2418,26 @@ void messages_init(MESSAGES *m, uint32_t friend_number) {
 
     memset(m, 0, sizeof(*m) * COUNTOF(m));
 
-    m->data = calloc(20, sizeof(void *));
-    m->extra = 20;
-    m->id    = friend_number;
+    m->size    = 32;
+    m->data    = calloc(m->size, sizeof(void *));
+    m->heights = calloc(m->size, sizeof(uint32_t));
+    m->base    = MESSAGES_FIRST_ID;
+    m->id   = friend_number;
+
+    m->view_msg = m->relayout_up = m->relayout_down = m->base;
 
     pthread_mutex_unlock(&messages_lock);
 }
 
 void message_free(MSG_HEADER *msg) {
+    text_layout_free(&msg->layout);
+
+    if (msg->slab) {
+        // Both the message and its text belong to the slab.
+        chatlog_slab_release(msg->slab);
+        return;
+    }
+
     // The group messages are free()d in groups.c (group_free(GROUPCHAT *g))
     switch (msg->msg_type) {
         case MSG_TYPE_NULL: {
@@ -1788,16 +2484,23 @@ void messages_clear_all(MESSAGES *m) {
     pthread_mutex_lock(&messages_lock);
 
     for (uint32_t i = 0; i < m->number; i++) {
-        message_free(m->data[i]);
+        message_free(message_at(m, i));
     }
 
     free(m->data);
-    m->data   = NULL;
-    m->number = 0;
-    m->extra  = 0;
+    free(m->heights);
+    m->data    = NULL;
+    m->heights = NULL;
+    m->number  = 0;
+    m->size   = 0;
+    m->head   = 0;
 
     m->sel_start_msg = m->sel_end_msg = m->sel_start_position = m->sel_end_position = 0;
 
+    m->history_end = m->history_loaded = m->history_gap = m->history_live = 0;
+    m->history_resize = m->history_shift = 0;
+    m->history_paged = m->history_loading = m->history_done = false;
+
     m->height = 0;
     pthread_mutex_unlock(&messages_lock);
 }
@@ -2,6 +2,7 @@
 #define MESSAGES_H
 
 #include "ui/panel.h"
+#include "ui/text.h"
 
 #include <stdint.h>
 #include <time.h>
@@ -10,6 +11,7 @@
 pthread_mutex_t messages_lock;
 
 typedef struct native_image NATIVE_IMAGE;
+typedef struct chatlog_slab CHATLOG_SLAB;
 
 typedef enum UTOX_MSG_TYPE {
     MSG_TYPE_NULL,
@@ -81,6 +83,8 @@ typedef struct msg_header {
     bool    our_msg;
 
     uint32_t height;
+    // Matches height_gen of the MESSAGES it's in if height was measured, rather than estimated.
+    uint32_t height_gen;
     time_t   time;
 
 
@@ -89,6 +93,14 @@ typedef struct msg_header {
     uint32_t receipt;
     time_t   receipt_time;
 
+    // Set if this message and its text were read from the log and live in a shared slab.
+    CHATLOG_SLAB *slab;
+    // true if this message was written to the log after it was received or sent.
+    bool logged;
+
+    // Line breaks of the text of the message, at the width it was last measured at.
+    TEXT_LAYOUT layout;
+
     union {
         MSG_TEXT txt;
         MSG_TEXT action;
@@ -129,16 +141,44 @@ typedef struct messages {
 
     // Number of messages in data array.
     uint32_t number;
-    // Number of extra to speedup realloc.
-    int8_t extra;
+    // data is a ring buffer of size slots, a power of 2, with the oldest message at data[head].
+    uint32_t size, head;
+    /* Every message has an id, base is the id of the oldest one held. Ids don't change when messages
+     * are added or the oldest ones dropped, so the cursor and selection _msg fields hold ids. */
+    uint32_t base;
 
-    // Pointers at various message structs, at most MAX_BACKLOG_MESSAGES.
+    // Pointers at various message structs, at most MAX_BACKLOG_MESSAGES. Use message_at().
     MSG_HEADER **data;
+    // Fenwick tree of the message heights in each slot of data.
+    uint32_t *heights;
 
     // Field for preserving position of text scroll
     double scroll;
+
+    /* Heights are for width and scale. A resize bumps height_gen and estimates every height, then
+     * the messages are measured from the top of the view outwards a slice at a time. All messages
+     * with ids from relayout_up up to relayout_down have been measured since. */
+    double   scale;
+    uint32_t height_gen, relayout_up, relayout_down;
+    // Id of the message at the top of the view as last drawn, and how far into it the view starts.
+    uint32_t view_msg;
+    int      view_offset;
+
+    /* Paged history, counted in chat log records.
+     *
+     * The messages read from the log sit at the top of data, up to history_end, and hold
+     * history_loaded records. Below them come history_gap records that were paged out, and below
+     * those the history_live records logged since. Older pages are read with a skip of all three. */
+    uint32_t history_end, history_loaded, history_gap, history_live;
+    // Content height change and scroll offset change in pixels from paging or relayout, applied on the next draw.
+    int history_resize, history_shift;
+    // history_paged is set while older pages are kept around beyond UTOX_MAX_BACKLOG_MESSAGES.
+    bool history_paged, history_loading, history_done;
 } MESSAGES;
 
+// Returns message number index, counting from the oldest one held, or NULL.
+MSG_HEADER *message_at(const MESSAGES *m, uint32_t index);
+
 uint32_t message_add_group(MESSAGES *m, MSG_HEADER *msg);
 
 uint32_t message_add_type_text(MESSAGES *m, bool auth, const char *msgtxt, uint16_t length, bool log, bool send);
@@ -153,6 +193,11 @@ bool message_log_to_disk(MESSAGES *m, MSG_HEADER *msg);
 // Returns true if data was read from log.
 bool messages_read_from_log(uint32_t friend_number);
 
+/* Inserts a page of history read by the loader thread, and measures it.
+ * For the UI thread, when it gets FRIEND_HISTORY_PAGE. */
+typedef struct messages_history_load MESSAGES_HISTORY_LOAD;
+void messages_history_page(MESSAGES_HISTORY_LOAD *load);
+
 void messages_send_from_queue(MESSAGES *m, uint32_t friend_number);
 void messages_clear_receipt(MESSAGES *m, uint32_t receipt_number);
 
@@ -176,6 +221,8 @@ bool messages_mleave(PANEL *m);
 bool messages_char(uint32_t ch);
 int messages_selection(PANEL *panel, char *buffer, uint32_t len, bool names);
 
+/* Relays out m for width and the current scale, if they changed. Heights are only estimated here,
+ * messages_draw() measures the ones in view right away and the rest a slice per redraw. */
 void messages_updateheight(MESSAGES *m, int width);
 
 
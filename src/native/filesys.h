@@ -17,6 +17,16 @@ bool native_remove_file(const uint8_t *name, size_t length, bool portable_mode);
 
 bool native_move_file(const uint8_t *current_name, const uint8_t *new_name);
 
+/** Renames the file name in the uTox storage folder to new_name, replacing new_name atomically if it exists. */
+bool native_replace_file(const char *name, const char *new_name, bool portable_mode);
+
+/** Maps length bytes of file, starting at offset, read only into memory.
+ *
+ * Returns a pointer to the byte at offset, or NULL on failure.
+ * The mapping must be released with native_unmap_file() using the same offset and length. */
+void *native_map_file(FILE *file, uint64_t offset, size_t length);
+void native_unmap_file(void *data, uint64_t offset, size_t length);
+
 // shows a file chooser to the user and calls utox_export_chatlog in turn
 // TODO not let this depend on chatlogs
 // TODO refactor this to be a simple filechooser which returns the file instead
@@ -27,7 +37,8 @@ void file_save_inline_image_png(MSG_HEADER *msg);
 // TODO same as for chatlogs, this is mainly native because of the file selector thing
 typedef struct file_transfer FILE_TRANSFER;
 void native_autoselect_dir_ft(uint32_t fid, FILE_TRANSFER *file);
-void native_select_dir_ft(uint32_t fid, uint32_t num, FILE_TRANSFER *file);
+// Asks where to save the incoming file of msg. Copies what it needs of msg before returning.
+void native_select_dir_ft(uint32_t fid, MSG_HEADER *msg);
 
 
 
@@ -7,7 +7,9 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 bool native_create_dir(const uint8_t *filepath) {
     const int status = mkdir((char *)filepath, S_IRWXU);
@@ -114,3 +116,64 @@ bool native_move_file(const uint8_t *current_name, const uint8_t *new_name) {
 
     return rename((char *)current_name, (char *)new_name);
 }
+
+bool native_replace_file(const char *name, const char *new_name, bool portable_mode) {
+    char path[UTOX_FILE_NAME_LENGTH], new_path[UTOX_FILE_NAME_LENGTH];
+
+    const char *dir = portable_mode ? "./tox/" : "%s/.config/tox/";
+    int length     = snprintf(path, sizeof(path), dir, getenv("HOME"));
+    if (length < 0 || (size_t)length + strlen(name) >= sizeof(path)
+        || (size_t)length + strlen(new_name) >= sizeof(new_path))
+    {
+        return false;
+    }
+
+    memcpy(new_path, path, length);
+    strcpy(path + length, name);
+    strcpy(new_path + length, new_name);
+
+    // rename() replaces new_path atomically.
+    if (rename(path, new_path)) {
+        return false;
+    }
+
+    // The rename is only on disk once the directory is.
+    path[length] = '\0';
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    const bool synced = !fsync(fd);
+    close(fd);
+    return synced;
+}
+
+// mmap() wants an offset that's a multiple of the page size.
+static uint64_t map_offset_delta(uint64_t offset) {
+    return offset % (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+void *native_map_file(FILE *file, uint64_t offset, size_t length) {
+    if (!file || !length) {
+        return NULL;
+    }
+
+    const uint64_t delta = map_offset_delta(offset);
+
+    uint8_t *map = mmap(NULL, length + delta, PROT_READ, MAP_PRIVATE, fileno(file), offset - delta);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    return map + delta;
+}
+
+void native_unmap_file(void *data, uint64_t offset, size_t length) {
+    if (!data) {
+        return;
+    }
+
+    const uint64_t delta = map_offset_delta(offset);
+    munmap((uint8_t *)data - delta, length + delta);
+}
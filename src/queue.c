@@ -0,0 +1,107 @@
+#include "queue.h"
+
+#include "native/time.h"
+
+#include <time.h>
+
+void queue_open(UTOX_QUEUE *q) {
+    pthread_mutex_lock(&q->lock);
+    q->head  = 0;
+    q->count = 0;
+    q->open  = true;
+    pthread_mutex_unlock(&q->lock);
+}
+
+void queue_close(UTOX_QUEUE *q) {
+    pthread_mutex_lock(&q->lock);
+    q->head  = 0;
+    q->count = 0;
+    q->open  = false;
+    pthread_cond_broadcast(&q->space);
+    pthread_mutex_unlock(&q->lock);
+}
+
+bool queue_post(UTOX_QUEUE *q, uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
+    pthread_mutex_lock(&q->lock);
+
+    while (q->open && q->count == UTOX_QUEUE_SIZE) {
+        pthread_cond_wait(&q->space, &q->lock);
+    }
+
+    if (!q->open) {
+        pthread_mutex_unlock(&q->lock);
+        return false;
+    }
+
+    UTOX_QUEUED_MSG *m = &q->msg[(q->head + q->count++) % UTOX_QUEUE_SIZE];
+    m->msg.msg    = msg;
+    m->msg.param1 = param1;
+    m->msg.param2 = param2;
+    m->msg.data   = data;
+    m->time       = get_time();
+
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    return true;
+}
+
+bool queue_wait(UTOX_QUEUE *q, uint32_t ms) {
+    pthread_mutex_lock(&q->lock);
+
+    if (!q->count && ms == UTOX_QUEUE_FOREVER) {
+        while (!q->count) {
+            pthread_cond_wait(&q->cond, &q->lock);
+        }
+    } else if (!q->count && ms) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec  += ms / 1000;
+        until.tv_nsec += (ms % 1000) * 1000 * 1000;
+        if (until.tv_nsec >= 1000 * 1000 * 1000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000 * 1000 * 1000;
+        }
+
+        pthread_cond_timedwait(&q->cond, &q->lock, &until);
+    }
+
+    const bool ready = q->count;
+
+    pthread_mutex_unlock(&q->lock);
+    return ready;
+}
+
+bool queue_get(UTOX_QUEUE *q, TOX_MSG *msg) {
+    pthread_mutex_lock(&q->lock);
+
+    if (!q->count) {
+        pthread_mutex_unlock(&q->lock);
+        return false;
+    }
+
+    *msg    = q->msg[q->head].msg;
+    q->head = (q->head + 1) % UTOX_QUEUE_SIZE;
+    q->count--;
+
+    pthread_cond_signal(&q->space);
+    pthread_mutex_unlock(&q->lock);
+    return true;
+}
+
+uint32_t queue_take(UTOX_QUEUE *q, UTOX_QUEUED_MSG *msgs) {
+    pthread_mutex_lock(&q->lock);
+
+    const uint32_t count = q->count;
+    for (uint32_t i = 0; i < count; ++i) {
+        msgs[i] = q->msg[(q->head + i) % UTOX_QUEUE_SIZE];
+    }
+    q->head  = (q->head + count) % UTOX_QUEUE_SIZE;
+    q->count = 0;
+
+    if (count) {
+        pthread_cond_broadcast(&q->space);
+    }
+
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
@@ -0,0 +1,65 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include "tox.h" // TOX_MSG
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A bounded queue of messages for a worker thread, any thread can post to it.
+ *
+ * Posting only blocks while the queue is full. The worker sleeps in queue_wait() instead of
+ * yieldcpu(), so a posted message wakes it up right away. Define them with UTOX_QUEUE_INIT.
+ *
+ * A queue starts out closed, messages posted to it are dropped until its worker opens it with
+ * queue_open(), and again after the worker closes it with queue_close() on its way out. */
+#define UTOX_QUEUE_SIZE 256
+
+// For queue_wait(), to wait until there's a message however long that takes.
+#define UTOX_QUEUE_FOREVER UINT32_MAX
+
+typedef struct {
+    TOX_MSG  msg;
+    // get_time() when it was posted.
+    uint64_t time;
+} UTOX_QUEUED_MSG;
+
+typedef struct utox_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond, space;
+
+    UTOX_QUEUED_MSG msg[UTOX_QUEUE_SIZE];
+    uint32_t        head, count;
+
+    bool open;
+} UTOX_QUEUE;
+
+#define UTOX_QUEUE_INIT                                                                              \
+    {                                                                                                \
+        .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER,                         \
+        .space = PTHREAD_COND_INITIALIZER,                                                           \
+    }
+
+/* Empties the queue, anything left from before is stale, and starts taking messages. */
+void queue_open(UTOX_QUEUE *q);
+
+/* Stops taking messages, dropping the ones queued. Posters waiting for room give up. */
+void queue_close(UTOX_QUEUE *q);
+
+/* Returns false if the queue is closed, the message is dropped then. */
+bool queue_post(UTOX_QUEUE *q, uint8_t msg, uint32_t param1, uint32_t param2, void *data);
+
+/* Waits up to ms milliseconds for a message to be posted, unless there's one already.
+ * Returns true if there's a message. */
+bool queue_wait(UTOX_QUEUE *q, uint32_t ms);
+
+/* Takes the oldest message into msg without waiting.
+ * Returns false if there's none. */
+bool queue_get(UTOX_QUEUE *q, TOX_MSG *msg);
+
+/* Takes all the messages into msgs, which must hold UTOX_QUEUE_SIZE of them, without waiting.
+ * Returns the number of messages. */
+uint32_t queue_take(UTOX_QUEUE *q, UTOX_QUEUED_MSG *msgs);
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "flist.h"
 #include "groups.h"
+#include "macros.h"
 #include "main.h" // UTOX_VERSION_NUMBER, MAIN_HEIGHT, MAIN_WIDTH, all save things..
 #include "tox.h"
 
@@ -47,6 +48,8 @@ SETTINGS settings = {
     // .inline_video                // included here to match the full struct
     .use_long_time_msg      = true,
     .accept_inline_images   = true,
+    .ft_max_sending         = 2,
+    .ft_send_rate           = 0,
 
     // UX Settings
     .logging_enabled        = true,
@@ -173,6 +176,12 @@ UTOX_SAVE *config_load(void) {
 
     settings.last_version           = save->utox_last_version;
 
+    if (save->ft_max_sending) {
+        settings.ft_max_sending = save->ft_max_sending - 1;
+    }
+    settings.ft_send_rate           = (uint32_t)save->ft_send_rate * 1024;
+    dropdown_ft_select(settings.ft_max_sending, settings.ft_send_rate);
+
     loaded_audio_out_device         = save->audio_device_out;
     loaded_audio_in_device          = save->audio_device_in;
 
@@ -235,6 +244,9 @@ void config_save(UTOX_SAVE *save_in) {
     save->group_notifications  = settings.group_notifications;
     save->status_notifications = settings.status_notifications;
 
+    save->ft_max_sending = settings.ft_max_sending + 1;
+    save->ft_send_rate   = MIN(settings.ft_send_rate / 1024, UINT16_MAX);
+
     memcpy(save->proxy_ip, proxy_address, 256); /* Magic number inside toxcore */
 
     utox_data_save_utox(save, sizeof(UTOX_SAVE) + 256); /* Magic number inside toxcore */
@@ -17,6 +17,8 @@ typedef struct utox_settings {
 
     // Low level settings (network, profile, portable-mode)
     bool portable_mode;
+    // Set by --verbose, not saved.
+    bool verbose;
 
     bool save_encryption;
 
@@ -37,6 +39,11 @@ typedef struct utox_settings {
     bool use_long_time_msg;
     bool accept_inline_images;
 
+    // How many big files we send to a friend at once, the rest wait in line. 0 is no limit.
+    uint8_t  ft_max_sending;
+    // Bytes per second all outgoing files together may use, 0 is no limit.
+    uint32_t ft_send_rate;
+
     // UX Settings
     bool logging_enabled;
     bool close_to_tray;
@@ -106,7 +113,12 @@ typedef struct utox_save {
     uint8_t zero_2              : 5;
     uint8_t zero_3              : 8;
 
-    uint16_t unused[28];
+    // settings.ft_max_sending + 1, so 0 is the default. settings.ft_send_rate in KiB.
+    uint8_t  ft_max_sending;
+    uint8_t  zero_4;
+    uint16_t ft_send_rate;
+
+    uint16_t unused[26];
     uint8_t  proxy_ip[];
 } UTOX_SAVE;
 
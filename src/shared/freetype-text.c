@@ -75,3 +75,7 @@ int textfit_near(const char *str, uint16_t length, int width) {
 void setfont(int id) {
     sfont = &font[id];
 }
+
+int getfont(void) {
+    return sfont ? sfont - font : -1;
+}
@@ -6,6 +6,7 @@
 #include "friend.h"
 #include "groups.h"
 #include "macros.h"
+#include "queue.h"
 #include "self.h"
 #include "settings.h"
 #include "text.h"
@@ -28,6 +29,7 @@
 #include "native/thread.h"
 #include "native/time.h"
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,8 +38,6 @@
 
 #include "main.h" // utox_data_save/load, DEFAULT_NAME, DEFAULT_STATUS
 
-static bool save_needed = true;
-
 enum {
     LOG_FILE_MSG_TYPE_TEXT   = 0,
     LOG_FILE_MSG_TYPE_ACTION = 1,
@@ -54,22 +54,85 @@ typedef struct {
 static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg, uint32_t param1,
                                uint32_t param2, void *data);
 
-void postmessage_toxcore(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
-    while (tox_thread_msg) {
-        yieldcpu(1);
-    }
+static UTOX_QUEUE tox_queue = UTOX_QUEUE_INIT;
 
+static pthread_mutex_t  tox_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static TOX_THREAD_STATS tox_stats;
+
+void postmessage_toxcore(uint8_t msg, uint32_t param1, uint32_t param2, void *data) {
     if (!tox_thread_init) {
         /* Tox is not yet active, drop message (Probably a mistake) */
         return;
     }
 
-    tox_msg.msg    = msg;
-    tox_msg.param1 = param1;
-    tox_msg.param2 = param2;
-    tox_msg.data   = data;
+    queue_post(&tox_queue, msg, param1, param2, data);
+}
+
+void tox_thread_stats(TOX_THREAD_STATS *stats) {
+    pthread_mutex_lock(&tox_stats_lock);
+    *stats = tox_stats;
+    pthread_mutex_unlock(&tox_stats_lock);
+}
+
+/* Waits up to ms milliseconds for a message to be posted, after an iteration that handled count
+ * messages that had been waiting for latency ns all together. */
+static void tox_thread_wait(uint32_t ms, uint32_t count, uint64_t latency, uint64_t latency_max) {
+    const bool woken = queue_wait(&tox_queue, ms);
+
+    pthread_mutex_lock(&tox_stats_lock);
+    tox_stats.iterations++;
+    tox_stats.wakeups       += woken;
+    tox_stats.commands      += count;
+    tox_stats.latency_total += latency;
+    tox_stats.latency_max    = MAX(tox_stats.latency_max, latency_max);
+    pthread_mutex_unlock(&tox_stats_lock);
+}
+
+/* The key derived from the profile password, so saving doesn't run the password KDF every time.
+ * pass_key_hash is the hash of the password it's for, only the toxcore thread touches either. */
+static Tox_Pass_Key *pass_key;
+static uint8_t       pass_key_hash[TOX_HASH_LENGTH];
+
+static void utox_pass_key_free(void) {
+    if (pass_key) {
+        tox_pass_key_free(pass_key);
+        pass_key = NULL;
+    }
+    memset(pass_key_hash, 0, sizeof(pass_key_hash));
+}
+
+/* Returns the key for the current password, deriving it with salt or a new one if salt is NULL,
+ * unless we already have it. Returns NULL on failure. */
+static Tox_Pass_Key *utox_pass_key(const uint8_t *salt) {
+    const size_t passphrase_length = edit_profile_password.length;
+
+    uint8_t passphrase[passphrase_length];
+    memcpy(passphrase, edit_profile_password.data, passphrase_length);
+
+    uint8_t hash[TOX_HASH_LENGTH];
+    tox_hash(hash, passphrase, passphrase_length);
+
+    if (pass_key && !memcmp(hash, pass_key_hash, sizeof(hash))) {
+        memset(passphrase, 0, passphrase_length);
+        return pass_key;
+    }
+
+    utox_pass_key_free();
+
+    TOX_ERR_KEY_DERIVATION err = 0;
+    if (salt) {
+        pass_key = tox_pass_key_derive_with_salt(passphrase, passphrase_length, salt, &err);
+    } else {
+        pass_key = tox_pass_key_derive(passphrase, passphrase_length, &err);
+    }
+    memset(passphrase, 0, passphrase_length);
+
+    if (!pass_key) {
+        return NULL;
+    }
 
-    tox_thread_msg = 1;
+    memcpy(pass_key_hash, hash, sizeof(hash));
+    return pass_key;
 }
 
 static int utox_encrypt_data(void *clear_text, size_t clear_length, uint8_t *cypher_data) {
@@ -79,12 +142,13 @@ static int utox_encrypt_data(void *clear_text, size_t clear_length, uint8_t *cyp
         return UTOX_ENC_ERR_LENGTH;
     }
 
-    uint8_t passphrase[passphrase_length];
-    memcpy(passphrase, edit_profile_password.data, passphrase_length);
-    TOX_ERR_ENCRYPTION err = 0;
+    Tox_Pass_Key *key = utox_pass_key(NULL);
+    if (!key) {
+        return UTOX_ENC_ERR_UNKNOWN;
+    }
 
-    tox_pass_encrypt((uint8_t *)clear_text, clear_length, (uint8_t *)passphrase, passphrase_length,
-                     cypher_data, &err);
+    TOX_ERR_ENCRYPTION err = 0;
+    tox_pass_key_encrypt(key, (uint8_t *)clear_text, clear_length, cypher_data, &err);
 
     if (err) {
         exit(1);
@@ -100,10 +164,25 @@ static int utox_decrypt_data(void *cypher_data, size_t cypher_length, uint8_t *c
         return UTOX_ENC_ERR_LENGTH;
     }
 
-    uint8_t passphrase[passphrase_length];
-    memcpy(passphrase, edit_profile_password.data, passphrase_length);
+    uint8_t salt[TOX_PASS_SALT_LENGTH];
+    if (!tox_get_salt((uint8_t *)cypher_data, salt, NULL)) {
+        return UTOX_ENC_ERR_BAD_DATA;
+    }
+
+    // The save has its own salt, so a key we derived for another one is no good.
+    utox_pass_key_free();
+    Tox_Pass_Key *key = utox_pass_key(salt);
+    if (!key) {
+        return UTOX_ENC_ERR_UNKNOWN;
+    }
+
     TOX_ERR_DECRYPTION err = 0;
-    tox_pass_decrypt((uint8_t *)cypher_data, cypher_length, (uint8_t *)passphrase, passphrase_length, clear_text, &err);
+    tox_pass_key_decrypt(key, (uint8_t *)cypher_data, cypher_length, clear_text, &err);
+
+    if (err) {
+        // Don't keep a key for the wrong password.
+        utox_pass_key_free();
+    }
 
     switch (err) {
         case TOX_ERR_DECRYPTION_OK: {
@@ -174,28 +253,137 @@ static void load_defaults(Tox *tox) {
     tox_self_set_status_message(tox, status, status_len, 0);
 }
 
+/* Profile saves are written by a thread of their own, so the disk never holds up the toxcore thread.
+ * write_save() leaves a snapshot of the save in save_data, replacing one the writer hasn't picked up
+ * yet, so saves in quick succession are only written once. save_lock guards all of it, and
+ * save_needed, which the save thread sets again when a write fails. */
+static pthread_mutex_t save_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  save_ready   = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  save_written = PTHREAD_COND_INITIALIZER;
+
+static bool     save_needed = true;
+static bool     save_thread_running, save_writing;
+static uint8_t *save_data;
+static size_t   save_length;
+static uint64_t save_time;
+
+static void save_thread(void *UNUSED(args)) {
+    pthread_mutex_lock(&save_lock);
+
+    while (1) {
+        while (!save_data) {
+            pthread_cond_wait(&save_ready, &save_lock);
+        }
+
+        uint8_t *data   = save_data;
+        size_t   length = save_length;
+        uint64_t time   = save_time;
+        save_data       = NULL;
+        save_writing    = true;
+
+        pthread_mutex_unlock(&save_lock);
+
+        const bool failed = utox_data_save_tox(data, length);
+        memset(data, 0, length);
+        free(data);
+
+        const uint64_t latency = get_time() - time;
+
+        pthread_mutex_lock(&tox_stats_lock);
+        tox_stats.saves++;
+        tox_stats.save_latency_total += latency;
+        tox_stats.save_latency_max    = MAX(tox_stats.save_latency_max, latency);
+        pthread_mutex_unlock(&tox_stats_lock);
+
+        pthread_mutex_lock(&save_lock);
+        if (failed) {
+            // Have the toxcore thread try again later.
+            save_needed = true;
+        }
+        save_writing = false;
+        pthread_cond_broadcast(&save_written);
+    }
+}
+
+// Has the toxcore thread write a save soon.
+static void save_request(void) {
+    pthread_mutex_lock(&save_lock);
+    save_needed = true;
+    pthread_mutex_unlock(&save_lock);
+}
+
+static bool save_requested(void) {
+    pthread_mutex_lock(&save_lock);
+    const bool needed = save_needed;
+    pthread_mutex_unlock(&save_lock);
+    return needed;
+}
+
+// Hands data over to the save thread, to be written and freed.
+static void save_post(uint8_t *data, size_t length) {
+    pthread_mutex_lock(&save_lock);
+
+    if (save_data) {
+        // Not written yet, and now it doesn't need to be.
+        memset(save_data, 0, save_length);
+        free(save_data);
+    }
+    save_data   = data;
+    save_length = length;
+    save_time   = get_time();
+
+    if (!save_thread_running) {
+        save_thread_running = true;
+        thread(save_thread, NULL);
+    }
+
+    pthread_cond_signal(&save_ready);
+    pthread_mutex_unlock(&save_lock);
+}
+
+// Waits until the save thread has written everything it was given.
+static void save_wait(void) {
+    pthread_mutex_lock(&save_lock);
+    while (save_data || save_writing) {
+        pthread_cond_wait(&save_written, &save_lock);
+    }
+    pthread_mutex_unlock(&save_lock);
+}
+
 static void write_save(Tox *tox) {
     /* Get toxsave info from tox*/
     size_t clear_length     = tox_get_savedata_size(tox);
     size_t encrypted_length = clear_length + TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
 
-    uint8_t clear_data[clear_length];
-    uint8_t encrypted_data[encrypted_length];
+    uint8_t *clear_data = malloc(clear_length);
+    if (!clear_data) {
+        save_request();
+        return;
+    }
 
     tox_get_savedata(tox, clear_data);
+    pthread_mutex_lock(&save_lock);
+    save_needed = false;
+    pthread_mutex_unlock(&save_lock);
 
     if (edit_profile_password.length == 0) {
         // user doesn't use encryption
-        save_needed = utox_data_save_tox(clear_data, clear_length);
-    } else {
-        UTOX_ENC_ERR enc_err = utox_encrypt_data(clear_data, clear_length, encrypted_data);
-        if (enc_err) {
-            /* encryption failed, write clear text data */
-            save_needed = utox_data_save_tox(clear_data, clear_length);
-        } else {
-            save_needed = utox_data_save_tox(encrypted_data, encrypted_length);
-        }
+        utox_pass_key_free();
+        save_post(clear_data, clear_length);
+        return;
     }
+
+    uint8_t *encrypted_data = malloc(encrypted_length);
+    if (!encrypted_data || utox_encrypt_data(clear_data, clear_length, encrypted_data)) {
+        /* encryption failed, write clear text data */
+        free(encrypted_data);
+        save_post(clear_data, clear_length);
+        return;
+    }
+
+    memset(clear_data, 0, clear_length);
+    free(clear_data);
+    save_post(encrypted_data, encrypted_length);
 }
 
 void tox_settingschanged(void) {
@@ -245,6 +433,16 @@ static void utox_thread_work_for_typing_notifications(Tox *tox, uint64_t time) {
     }
 }
 
+// Returns how long until utox_thread_work_for_typing_notifications() has something to do, in ns.
+static uint64_t utox_typing_notification_wait(Tox *tox, uint64_t time) {
+    if (typing_state.tox != tox || !typing_state.sent_value) {
+        return UINT64_MAX;
+    }
+
+    const uint64_t expiry = typing_state.time + UTOX_TYPING_NOTIFICATION_TIMEOUT;
+    return expiry > time ? expiry - time : 0;
+}
+
 static int load_toxcore_save(struct Tox_Options *options) {
     settings.save_encryption = 0;
     size_t   raw_length;
@@ -396,6 +594,12 @@ void toxcore_thread(void *UNUSED(args)) {
     bool   reconfig         = 1;
     int    toxcore_init_err = 0;
 
+    // Messages taken from the queue, anything after a reconfig is left for the next toxcore.
+    UTOX_QUEUED_MSG batch[UTOX_QUEUE_SIZE];
+    uint32_t        batch_count = 0, batch_next = 0;
+
+    queue_open(&tox_queue);
+
     while (reconfig) {
         reconfig = 0;
 
@@ -408,17 +612,20 @@ void toxcore_thread(void *UNUSED(args)) {
             while (!reconfig) {
                 // Waiting for a message triggering the next reconfigure
                 // avoid trying the creation of thousands of tox instances before user changes the settings
-                if (tox_thread_msg) {
-                    TOX_MSG *msg = &tox_msg;
+                if (batch_next == batch_count) {
+                    queue_wait(&tox_queue, 300);
+                    batch_count = queue_take(&tox_queue, batch);
+                    batch_next  = 0;
+                }
+
+                while (batch_next < batch_count && !reconfig) {
+                    TOX_MSG *msg = &batch[batch_next++].msg;
                     // If msg->msg is 0, reconfig
                     if (!msg->msg) {
                         reconfig = (bool) msg->param1;
                         tox_thread_init = UTOX_TOX_THREAD_INIT_NONE;
                     }
                     // tox is not configured at this point ignore all other messages
-                    tox_thread_msg = 0;
-                } else {
-                    yieldcpu(300);
                 }
             }
             continue;
@@ -427,7 +634,8 @@ void toxcore_thread(void *UNUSED(args)) {
             yieldcpu(300);
             tox_thread_init = UTOX_TOX_THREAD_INIT_NONE;
             // ignore all messages in this stage
-            tox_thread_msg = 0;
+            batch_count = queue_take(&tox_queue, batch);
+            batch_next  = batch_count;
             reconfig = 1;
             continue;
         } else {
@@ -466,45 +674,74 @@ void toxcore_thread(void *UNUSED(args)) {
                 }
 
                 // save every 1000.
-                if (save_needed || (time - last_save >= (uint64_t)1000 * 1000 * 1000 * 1000)) {
+                if (save_requested() || (time - last_save >= (uint64_t)1000 * 1000 * 1000 * 1000)) {
                     // Save tox data
                     write_save(tox);
                     last_save = time;
                 }
             }
 
-            // If there's a message, load it, and send to the tox message thread
-            if (tox_thread_msg) {
-                TOX_MSG *msg = &tox_msg;
+            // Handle everything that was posted since the last iteration
+            if (batch_next == batch_count) {
+                batch_count = queue_take(&tox_queue, batch);
+                batch_next  = 0;
+            }
+
+            uint32_t handled = 0;
+            uint64_t latency = 0, latency_max = 0;
+
+            bool stop = false;
+            while (batch_next < batch_count && !stop) {
+                const uint64_t waited = get_time() - batch[batch_next].time;
+                handled++;
+                latency    += waited;
+                latency_max = MAX(latency_max, waited);
+
+                TOX_MSG *msg = &batch[batch_next++].msg;
                 // If msg->msg is 0, reconfig if needed and break from tox_do
                 if (!msg->msg) {
                     reconfig        = msg->param1;
-                    tox_thread_msg  = 0;
                     tox_thread_init = UTOX_TOX_THREAD_INIT_NONE;
+                    stop            = true;
                     break;
                 }
                 tox_thread_message(tox, av, time, msg->msg, msg->param1, msg->param2, msg->data);
-                tox_thread_msg = 0;
                 typing_state.sent = (msg->msg == TOX_SEND_MESSAGE || msg->msg == TOX_SEND_ACTION);
             }
 
+            if (stop) {
+                break;
+            }
+
             if (settings.send_typing_status) {
                 // Thread active transfers and check if friend is typing
                 utox_thread_work_for_typing_notifications(tox, time);
             }
 
-            /* Ask toxcore how many ms to wait, then wait at the most 20ms */
-            uint32_t interval = tox_iteration_interval(tox);
-            yieldcpu((interval > 20) ? 20 : interval);
+            /* Sleep until toxcore wants to iterate again, the next connection check or typing change,
+             * or a message is posted, whichever comes first. */
+            uint64_t wait = (uint64_t)tox_iteration_interval(tox) * 1000 * 1000;
+            wait = MIN(wait, last_connection + (uint64_t)10 * 1000 * 1000 * 1000 - time);
+            if (settings.send_typing_status) {
+                wait = MIN(wait, utox_typing_notification_wait(tox, time));
+            }
+            wait = MIN(wait, ft_send_schedule(tox, time));
+            wait = MIN(wait, ft_write_schedule(tox, time));
+            wait = MIN(wait, ft_progress_schedule(time));
+            // Round up, a wait under a ms would otherwise not sleep at all.
+            tox_thread_wait((wait + 1000 * 1000 - 1) / (1000 * 1000), handled, latency, latency_max);
         }
 
         /* If for anyreason, we exit, write the save, and clear the password */
         write_save(tox);
+        save_wait();
         edit_setstr(&edit_profile_password, (char *)"", 0);
+        utox_pass_key_free();
 
         tox_kill(tox);
     }
 
+    queue_close(&tox_queue);
     tox_thread_init = UTOX_TOX_THREAD_INIT_NONE;
     free_friends();
     raze_groups();
@@ -524,7 +761,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
 {
     switch (msg) {
         case TOX_SAVE: {
-            save_needed = 1;
+            save_request();
             break;
         }
         /* Change Self in core */
@@ -533,7 +770,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
              * data: name
              */
             tox_self_set_name(tox, data, param1, 0);
-            save_needed = 1;
+            save_request();
             break;
         }
         case TOX_SELF_SET_STATUS: {
@@ -541,14 +778,14 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
              * data: status message
              */
             tox_self_set_status_message(tox, data, param1, 0);
-            save_needed = 1;
+            save_request();
             break;
         }
         case TOX_SELF_SET_STATE: {
             /* param1: status
              */
             tox_self_set_status(tox, param1);
-            save_needed = 1;
+            save_request();
             break;
         }
 
@@ -570,7 +807,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
             avatar_move((uint8_t *)old_id, (uint8_t *)self.id_str);
             edit_setstr(&edit_nospam, self.nospam_str, sizeof(uint32_t) * 2);
 
-            save_needed = true;
+            save_request();
             break;
         }
 
@@ -582,12 +819,12 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
              */
 
             avatar_set_self(data, param2);
-            save_needed = 1;
+            save_request();
             break;
         }
         case TOX_AVATAR_UNSET: {
             avatar_unset_self();
-            save_needed = 1;
+            save_request();
             break;
         }
 
@@ -624,7 +861,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
                 utox_friend_init(tox, fid);
                 postmessage_utox(FRIEND_SEND_REQUEST, 0, fid, data);
             }
-            save_needed = 1;
+            save_request();
             break;
         }
 
@@ -641,7 +878,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
                 char hex_id[TOX_ADDRESS_SIZE * 2];
                 id_to_string(hex_id, req->bin_id);
             }
-            save_needed = 1;
+            save_request();
             break;
         }
         case TOX_FRIEND_DELETE: {
@@ -649,7 +886,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
              */
             tox_friend_delete(tox, param1, 0);
             postmessage_utox(FRIEND_REMOVE, 0, 0, data);
-            save_needed = 1;
+            save_request();
             break;
         }
         case TOX_FRIEND_ONLINE: {
@@ -727,16 +964,23 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
 
             if (param2 == 0) {
                 // This is the new default. Where the caller sends an opened file.
-                UTOX_MSG_FT *msg = data;
-                ft_send_file(tox, param1, msg->file, msg->name, strlen((char*)msg->name), NULL);
-                free(msg->name);
-                free(msg);
+                // It's hashed off this thread first, and sent once that's done.
+                ft_hash_file(param1, data);
                 break;
             }
 
             break;
         }
 
+        case TOX_FILE_SEND_HASHED: {
+            /* param1: friend #
+             * data: the UTOX_MSG_FT of TOX_FILE_SEND_NEW, with its hash
+             */
+
+            ft_send_queue(data);
+            break;
+        }
+
         case TOX_FILE_SEND_NEW_INLINE: {
             /* param1: friend id
                data: pointer to a TOX_SEND_INLINE_MSG struct
@@ -937,7 +1181,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
             group_peer_name_change(get_group(g_num), 0, (uint8_t *)self.name, self.name_length);
             postmessage_utox(GROUP_PEER_ADD, g_num, 0, NULL);
 
-            save_needed = true;
+            save_request();
             break;
         }
         case TOX_GROUP_JOIN: {
@@ -950,7 +1194,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
 
             TOX_ERR_CONFERENCE_DELETE error = 0;
             tox_conference_delete(tox, param1, &error);
-            save_needed = true;
+            save_request();
             break;
         }
         case TOX_GROUP_SEND_INVITE: {
@@ -959,7 +1203,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
              */
             TOX_ERR_CONFERENCE_INVITE error = 0;
             tox_conference_invite(tox, param2, param1, &error);
-            save_needed = true;
+            save_request();
             break;
         }
         case TOX_GROUP_SET_TOPIC: {
@@ -971,7 +1215,7 @@ static void tox_thread_message(Tox *tox, ToxAV *av, uint64_t time, uint8_t msg,
 
             tox_conference_set_title(tox, param1, data, param2, &error);
             postmessage_utox(GROUP_TOPIC, param1, param2, data);
-            save_needed = true;
+            save_request();
             break;
         }
         case TOX_GROUP_SEND_MESSAGE:
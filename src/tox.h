@@ -63,6 +63,7 @@ enum {
     TOX_FILE_SEND_NEW,
     TOX_FILE_SEND_NEW_INLINE,
     TOX_FILE_SEND_NEW_SLASH,
+    TOX_FILE_SEND_HASHED,
 
     TOX_FILE_RESUME,
     TOX_FILE_PAUSE,
@@ -115,9 +116,6 @@ typedef enum {
 
 UTOX_TOX_THREAD_INIT tox_thread_init;
 
-/* Inter-thread communication vars. */
-TOX_MSG       tox_msg, audio_msg, toxav_msg;
-volatile bool tox_thread_msg, audio_thread_msg, video_thread_msg;
 
 bool tox_connected;
 char proxy_address[256]; /* Magic Number inside toxcore */
@@ -132,6 +130,20 @@ void toxcore_thread(void *args);
  */
 void postmessage_toxcore(uint8_t msg, uint32_t param1, uint32_t param2, void *data);
 
+/* Counters kept by the toxcore thread, to measure how often it wakes up and how long messages wait. */
+typedef struct {
+    // Times round the loop, each one calling tox_iterate() once.
+    uint64_t iterations;
+    // Times its sleep was cut short, or skipped, because a message had been posted.
+    uint64_t wakeups;
+    // Messages handled, and the ns they waited between being posted and handled, in total and at most.
+    uint64_t commands, latency_total, latency_max;
+    // Profile saves written, and the ns between asking for them and having them on disk.
+    uint64_t saves, save_latency_total, save_latency_max;
+} TOX_THREAD_STATS;
+
+void tox_thread_stats(TOX_THREAD_STATS *stats);
+
 void tox_settingschanged(void);
 
 /* convert tox id to string
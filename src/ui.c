@@ -148,6 +148,9 @@ static void settings_UI(void) {
     CREATE_SWITCH(start_in_tray,     10, 120, _BM_SWITCH_WIDTH, _BM_SWITCH_HEIGHT);
     CREATE_SWITCH(auto_startup,      10, 150, _BM_SWITCH_WIDTH, _BM_SWITCH_HEIGHT);
     CREATE_SWITCH(mini_contacts,     10, 180, _BM_SWITCH_WIDTH, _BM_SWITCH_HEIGHT);
+
+    CREATE_DROPDOWN(ft_max_sending, 10,  235, 24, 120);
+    CREATE_DROPDOWN(ft_send_rate,   220, 235, 24, 120);
 }
 
 static void settings_AV(void) {
@@ -371,7 +374,6 @@ static void panel_update(PANEL *p, int x, int y, int width, int height) {
         case PANEL_MESSAGES: {
             if (p->object) {
                 MESSAGES *m = p->object;
-                m->width = width;
                 messages_updateheight(m, width);
             }
             break;
@@ -37,6 +37,9 @@ void drawvline(int x, int y, int y2, uint32_t color);
 
 void setfont(int id);
 
+// Returns the id of the font set last, -1 before any is.
+int getfont(void);
+
 uint32_t setcolor(uint32_t color);
 
 void pushclip(int x, int y, int width, int height);
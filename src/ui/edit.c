@@ -90,8 +90,8 @@ void edit_draw(EDIT *edit, int x, int y, int width, int height) {
         pushclip(x + 1, y + 1, width - 2, height - 2);
 
         SCROLLABLE *scroll = edit->scroll;
-        scroll->content_height = text_height(width - SCALE(8) - SCALE(SCROLL_WIDTH),
-                                             font_small_lineheight, edit->data, edit->length) + SCALE(8);
+        scroll->content_height = text_layout_height(&edit->layout, width - SCALE(8) - SCALE(SCROLL_WIDTH),
+                                                    font_small_lineheight, edit->data, edit->length) + SCALE(8);
         scroll_draw(scroll, x, y, width, height);
         yy -= scroll_gety(scroll, height);
     }
@@ -121,13 +121,21 @@ void edit_draw(EDIT *edit, int x, int y, int width, int height) {
                                                 is_active ? edit_sel.length : UINT16_MAX,
                                                 is_active ? edit_sel.mark_start : 0,
                                                 is_active ? edit_sel.mark_length : 0, edit->multiline);
+    } else if (edit->multiline) {
+        utox_draw_text_layout_within_box(&edit->layout, x + SCALE(4), yy + SCALE(top_offset * 2),
+                                         x + width - SCALE(4) - SCALE(SCROLL_WIDTH),
+                                         y, y + height, font_small_lineheight, edit->data,
+                                         edit->length, is_active ? edit_sel.start : UINT16_MAX,
+                                         is_active ? edit_sel.length : UINT16_MAX,
+                                         is_active ? edit_sel.mark_start : 0,
+                                         is_active ? edit_sel.mark_length : 0);
     } else {
         utox_draw_text_multiline_within_box(x + SCALE(4), yy + SCALE(top_offset * 2),
-                                    x + width - SCALE(4) - (edit->multiline ? SCALE(SCROLL_WIDTH) : 0),
+                                    x + width - SCALE(4),
                                     y, y + height, font_small_lineheight, edit->data,
                                     edit->length, is_active ? edit_sel.start : UINT16_MAX,
                                     is_active ? edit_sel.length : UINT16_MAX, is_active ? edit_sel.mark_start : 0,
-                                    is_active ? edit_sel.mark_length : 0, edit->multiline);
+                                    is_active ? edit_sel.mark_length : 0, false);
     }
 
     if (edit->multiline) {
@@ -135,6 +143,16 @@ void edit_draw(EDIT *edit, int x, int y, int width, int height) {
     }
 }
 
+static uint16_t edit_hittext(EDIT *edit, int mx, int width, int my) {
+    if (edit->multiline) {
+        return hittext_layout(&edit->layout, mx, width - SCALE(8) - SCALE(SCROLL_WIDTH), my, INT_MAX,
+                              font_small_lineheight, edit->data, edit->length);
+    }
+
+    return hittextmultiline(mx, width - SCALE(8), my, INT_MAX, font_small_lineheight, edit->data, edit->length,
+                            false);
+}
+
 bool edit_mmove(EDIT *edit, int px, int py, int width, int height, int x, int y, int dx, int dy) {
     if (settings.window_baseline && py > (int)settings.window_baseline - font_small_lineheight - SCALE(8)) {
         y += py - (settings.window_baseline - font_small_lineheight - SCALE(8));
@@ -167,9 +185,7 @@ bool edit_mmove(EDIT *edit, int px, int py, int width, int height, int x, int y,
         }
 
         setfont(FONT_TEXT);
-        edit_sel.p2 =
-            hittextmultiline(x - SCALE(4), width - SCALE(8) - (edit->multiline ? SCALE(SCROLL_WIDTH) : 0), y - SCALE(4),
-                             INT_MAX, font_small_lineheight, edit->data, edit->length, edit->multiline);
+        edit_sel.p2 = edit_hittext(edit, x - SCALE(4), width, y - SCALE(4));
 
         uint16_t start, length;
         if (edit_sel.p2 > edit_sel.p1) {
@@ -187,9 +203,7 @@ bool edit_mmove(EDIT *edit, int px, int py, int width, int height, int x, int y,
         }
     } else if (mouseover) {
         setfont(FONT_TEXT);
-        edit->mouseover_char =
-            hittextmultiline(x - SCALE(4), width - SCALE(8) - (edit->multiline ? SCALE(SCROLL_WIDTH) : 0), y - SCALE(4),
-                             INT_MAX, font_small_lineheight, edit->data, edit->length, edit->multiline);
+        edit->mouseover_char = edit_hittext(edit, x - SCALE(4), width, y - SCALE(4));
     }
 
     return need_redraw;
@@ -341,6 +355,8 @@ static void edit_redraw(void) {
 }
 
 static uint16_t edit_change_do(EDIT *edit, EDIT_CHANGE *c) {
+    text_layout_invalidate(&edit->layout);
+
     uint16_t r = c->start;
     if (c->remove) {
         memmove(edit->data + c->start + c->length, edit->data + c->start, edit->length - c->start);
@@ -359,6 +375,9 @@ static uint16_t edit_change_do(EDIT *edit, EDIT_CHANGE *c) {
 void edit_do(EDIT *edit, uint16_t start, uint16_t length, bool remove) {
     EDIT_CHANGE *new, **history;
 
+    // Every change to the text is recorded here.
+    text_layout_invalidate(&edit->layout);
+
     history = realloc(edit->history, (edit->history_cur + 1) * sizeof(void *));
     if (!history) {
         exit(1);
@@ -560,8 +579,8 @@ void edit_char(uint32_t ch, bool control, uint8_t flags) {
                 }
 
                 setfont(FONT_TEXT);
-                edit_sel.p2 = text_lineup(edit->width, edit->height, edit_sel.p2, font_small_lineheight, edit->data,
-                                          edit->length, edit->scroll);
+                edit_sel.p2 = text_lineup(&edit->layout, edit->width, edit->height, edit_sel.p2,
+                                          font_small_lineheight, edit->data, edit->length, edit->scroll);
                 if (!(flags & EMOD_SHIFT)) {
                     edit_sel.p1 = edit_sel.p2;
                 }
@@ -575,8 +594,8 @@ void edit_char(uint32_t ch, bool control, uint8_t flags) {
                 }
 
                 setfont(FONT_TEXT);
-                edit_sel.p2 = text_linedown(edit->width, edit->height, edit_sel.p2, font_small_lineheight, edit->data,
-                                            edit->length, edit->scroll);
+                edit_sel.p2 = text_linedown(&edit->layout, edit->width, edit->height, edit_sel.p2,
+                                            font_small_lineheight, edit->data, edit->length, edit->scroll);
                 if (!(flags & EMOD_SHIFT)) {
                     edit_sel.p1 = edit_sel.p2;
                 }
@@ -877,6 +896,7 @@ void edit_setstr(EDIT *edit, char *str, uint16_t length) {
 
     edit->length = length;
     memcpy(edit->data, str, length);
+    text_layout_invalidate(&edit->layout);
 
     if (edit->onchange) {
         edit->onchange(edit);
@@ -2,6 +2,7 @@
 #define UI_EDIT_H
 
 #include "panel.h"
+#include "text.h"
 
 #include "../ui.h"
 
@@ -33,6 +34,9 @@ struct edit {
     SCROLLABLE *scroll;
     char *      data;
 
+    // Line breaks of data, for multiline edits.
+    TEXT_LAYOUT layout;
+
     MAYBE_I18NAL_STRING empty_str;
     UI_ELEMENT_STYLE    style;
 
@@ -5,8 +5,10 @@
 
 #include "../text.h"
 #include "../theme.h"
+#include "../ui.h"
 
 #include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 static void text_draw_word_hl(int x, int y, const char *str, uint16_t length, int d, int h, int hlen,
@@ -77,17 +79,72 @@ static void drawtextmark(int x, int y, const char *str, uint16_t length, int d,
     drawhline(x + width, y + lineheight - 1, x + width + w, COLOR_MAIN_TEXT);
 }
 
-int utox_draw_text_multiline_within_box(int x, int y, /* x, y of the top left corner of the box */
-                                        int right, int top, int bottom, uint16_t lineheight, const char *data,
-                                        uint16_t length, /* text, and length of the text*/
-                                        uint16_t h, uint16_t hlen, uint16_t mark, uint16_t marklen, bool multiline) {
+static bool text_is_url(const char *str, const char *end) {
+    return (end - str >= 7 && memcmp(str, "http://", 7) == 0) || (end - str >= 8 && memcmp(str, "https://", 8) == 0);
+}
+
+/* Draws data from the line starting at offset start, which has to be a line break of the text. Stops
+ * after the last line above bottom if stop is set, in which case the return value is meaningless. */
+static int text_draw_multiline(int x, int y, int right, int top, int bottom, uint16_t lineheight, const char *data,
+                               uint16_t length, uint16_t start, uint16_t h, uint16_t hlen, uint16_t mark,
+                               uint16_t marklen, bool multiline, bool stop)
+{
     uint32_t c1, c2;
 
     bool greentext = 0, link = 0, draw = y + lineheight >= top;
     int  xc = x;
 
-    const char *a_mark = data, *b_mark = a_mark, *end = a_mark + length;
+    const char *a_mark = data + start, *b_mark = a_mark, *end = data + length;
+
+    if (start && data[start - 1] != '\n') {
+        /* We're starting on a wrapped line, pick up the colors of the line and word it continues. */
+        const char *line = a_mark;
+        while (line != data && *(line - 1) != '\n') {
+            line--;
+        }
+
+        if (*line == '>') {
+            c1        = setcolor(COLOR_MAIN_TEXT_QUOTE);
+            greentext = 1;
+        }
+
+        const char *r = a_mark;
+        while (r != end && *r != '\n') {
+            r++;
+        }
+        if (*(r - 1) == '<') {
+            if (greentext) {
+                setcolor(COLOR_MAIN_TEXT_RED);
+            } else {
+                greentext = 1;
+                c1        = setcolor(COLOR_MAIN_TEXT_RED);
+            }
+        }
+
+        if (data[start - 1] != ' ') {
+            const char *word = a_mark;
+            while (word != data && *(word - 1) != ' ' && *(word - 1) != '\n') {
+                word--;
+            }
+
+            if (text_is_url(word, end)) {
+                c2   = setcolor(COLOR_MAIN_TEXT_URL);
+                link = 1;
+            }
+        }
+    }
+
     while (1) {
+        if (stop && y >= bottom) {
+            if (link) {
+                setcolor(c2);
+            }
+            if (greentext) {
+                setcolor(c1);
+            }
+            return y;
+        }
+
         if (a_mark != end) {
             if (*a_mark == '>' && (a_mark == data || *(a_mark - 1) == '\n')) {
                 c1        = setcolor(COLOR_MAIN_TEXT_QUOTE);
@@ -188,6 +245,14 @@ int utox_draw_text_multiline_within_box(int x, int y, /* x, y of the top left co
     return y + lineheight;
 }
 
+int utox_draw_text_multiline_within_box(int x, int y, /* x, y of the top left corner of the box */
+                                        int right, int top, int bottom, uint16_t lineheight, const char *data,
+                                        uint16_t length, /* text, and length of the text*/
+                                        uint16_t h, uint16_t hlen, uint16_t mark, uint16_t marklen, bool multiline) {
+    return text_draw_multiline(x, y, right, top, bottom, lineheight, data, length, 0, h, hlen, mark, marklen,
+                               multiline, false);
+}
+
 uint16_t hittextmultiline(int mx, int right, int my, int height, uint16_t lineheight, char *str, uint16_t length,
                           bool multiline) {
     if (my < 0) {
@@ -314,6 +379,202 @@ int text_height(int right, uint16_t lineheight, char *str, uint16_t length) {
     return y;
 }
 
+void text_layout_free(TEXT_LAYOUT *layout) {
+    free(layout->start);
+    free(layout->end);
+    free(layout->width);
+    memset(layout, 0, sizeof(*layout));
+}
+
+void text_layout_invalidate(TEXT_LAYOUT *layout) {
+    layout->valid = false;
+}
+
+static bool text_layout_line(TEXT_LAYOUT *layout, uint16_t start, uint16_t end, int width) {
+    if (layout->lines == layout->lines_size) {
+        uint16_t size = layout->lines_size ? layout->lines_size * 2 : 8;
+
+        uint16_t *starts = realloc(layout->start, size * sizeof(uint16_t));
+        if (!starts) {
+            return false;
+        }
+        layout->start = starts;
+
+        uint16_t *ends = realloc(layout->end, size * sizeof(uint16_t));
+        if (!ends) {
+            return false;
+        }
+        layout->end = ends;
+
+        uint16_t *widths = realloc(layout->width, size * sizeof(uint16_t));
+        if (!widths) {
+            return false;
+        }
+        layout->width = widths;
+
+        layout->lines_size = size;
+    }
+
+    layout->start[layout->lines] = start;
+    layout->end[layout->lines]   = end;
+    layout->width[layout->lines] = width;
+    layout->lines++;
+
+    return true;
+}
+
+/* Makes sure layout holds the line breaks of str, wrapped the same way text_height() does.
+ * Returns false if it couldn't. */
+static bool text_layout(TEXT_LAYOUT *layout, int right, uint16_t lineheight, const char *str, uint16_t length) {
+    const int font = getfont();
+
+    if (layout->valid && layout->right == right && layout->font == font && layout->lineheight == lineheight
+        && layout->length == length && layout->scale == ui_scale)
+    {
+        return true;
+    }
+
+    layout->valid      = false;
+    layout->unfit      = false;
+    layout->lines      = 0;
+    layout->right      = right;
+    layout->font       = font;
+    layout->lineheight = lineheight;
+    layout->length     = length;
+    layout->scale      = ui_scale;
+
+    int x = 0;
+    const char *a = str, *b = a, *end = a + length, *line = str;
+    while (1) {
+        if (a == end || *a == ' ' || *a == '\n') {
+            int count = a - b, w = textwidth(b, count);
+            while (x + w > right) {
+                if (x == 0) {
+                    int fit = textfit(b, count, right);
+                    count -= fit;
+                    if (fit == 0 && (count != 0 || *b == '\n')) {
+                        layout->unfit = true;
+                        layout->valid = true;
+                        return true;
+                    }
+                    if (!text_layout_line(layout, line - str, b + fit - str, textwidth(b, fit))) {
+                        return false;
+                    }
+                    b += fit;
+                } else {
+                    if (!text_layout_line(layout, line - str, b - str, x)) {
+                        return false;
+                    }
+                    int l = utf8_len(b);
+                    count -= l;
+                    b += l;
+                }
+                line = b;
+                x    = 0;
+                w    = textwidth(b, count);
+            }
+
+            x += w;
+            b = a;
+
+            if (a == end) {
+                break;
+            }
+
+            if (*a == '\n') {
+                if (!text_layout_line(layout, line - str, a - str, x)) {
+                    return false;
+                }
+                b += utf8_len(b);
+                line = b;
+                x    = 0;
+            }
+        }
+        a += utf8_len(a);
+    }
+
+    if (!text_layout_line(layout, line - str, length, x)) {
+        return false;
+    }
+
+    layout->valid = true;
+    return true;
+}
+
+int text_layout_height(TEXT_LAYOUT *layout, int right, uint16_t lineheight, const char *str, uint16_t length) {
+    if (!text_layout(layout, right, lineheight, str, length)) {
+        return text_height(right, lineheight, (char *)str, length);
+    }
+
+    return layout->unfit ? 0 : layout->lines * lineheight;
+}
+
+int utox_draw_text_layout_within_box(TEXT_LAYOUT *layout, int x, int y, int right, int top, int bottom,
+                                     uint16_t lineheight, const char *data, uint16_t length, uint16_t h,
+                                     uint16_t hlen, uint16_t mark, uint16_t marklen)
+{
+    if (!text_layout(layout, right - x, lineheight, data, length) || layout->unfit) {
+        return utox_draw_text_multiline_within_box(x, y, right, top, bottom, lineheight, data, length, h, hlen,
+                                                   mark, marklen, true);
+    }
+
+    /* Skip the lines above the box, and stop after the last one inside it. */
+    uint16_t first = 0;
+    if (top - y > lineheight) {
+        first = (top - y - 1) / lineheight;
+        first = first < layout->lines ? first : layout->lines - 1;
+    }
+
+    text_draw_multiline(x, y + first * lineheight, right, top, bottom, lineheight, data, length,
+                        layout->start[first], h, hlen, mark, marklen, true, true);
+
+    return y + layout->lines * lineheight;
+}
+
+// Returns the line of layout holding the character at offset p.
+static uint16_t text_layout_find(const TEXT_LAYOUT *layout, uint16_t p) {
+    uint16_t low = 0, high = layout->lines;
+    while (high - low > 1) {
+        uint16_t mid = low + (high - low) / 2;
+        if (layout->start[mid] <= p) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+uint16_t hittext_layout(TEXT_LAYOUT *layout, int mx, int right, int my, int height, uint16_t lineheight,
+                        const char *str, uint16_t length)
+{
+    if (!text_layout(layout, right, lineheight, str, length) || layout->unfit) {
+        return hittextmultiline(mx, right, my, height, lineheight, (char *)str, length, true);
+    }
+
+    if (my < 0) {
+        return 0;
+    }
+
+    if (my >= height || my / lineheight >= layout->lines) {
+        return length;
+    }
+
+    const uint16_t line = my / lineheight;
+    const uint16_t start = layout->start[line], end = layout->end[line];
+
+    if (mx <= 0) {
+        return start;
+    }
+
+    if (mx >= layout->width[line]) {
+        return end;
+    }
+
+    return start + textfit_near(str + start, end - start, mx);
+}
+
 static void textxy(int width, uint16_t pp, uint16_t lineheight, char *str, uint16_t length, int *outx, int *outy) {
     int   x = 0, y = 0;
     char *a = str, *b = str, *end = str + length, *p = str + pp;
@@ -366,11 +627,28 @@ static void textxy(int width, uint16_t pp, uint16_t lineheight, char *str, uint1
     *outy = y;
 }
 
-uint16_t text_lineup(int width, int height, uint16_t p, uint16_t lineheight, char *str, uint16_t length,
-                     SCROLLABLE *scroll) {
+// Finds the position of the character at offset pp, using layout if it can.
+static void text_layout_xy(TEXT_LAYOUT *layout, int width, uint16_t pp, uint16_t lineheight, char *str,
+                           uint16_t length, int *outx, int *outy)
+{
+    if (!layout || !text_layout(layout, width, lineheight, str, length) || layout->unfit) {
+        textxy(width, pp, lineheight, str, length, outx, outy);
+        return;
+    }
+
+    const uint16_t line = text_layout_find(layout, pp);
+    const uint16_t start = layout->start[line];
+    const uint16_t end   = layout->end[line];
+
+    *outx = textwidth(str + start, (pp < end ? pp : end) - start);
+    *outy = line * lineheight;
+}
+
+uint16_t text_lineup(TEXT_LAYOUT *layout, int width, int height, uint16_t p, uint16_t lineheight, char *str,
+                     uint16_t length, SCROLLABLE *scroll) {
     // lazy
     int x, y;
-    textxy(width, p, lineheight, str, length, &x, &y);
+    text_layout_xy(layout, width, p, lineheight, str, length, &x, &y);
     if (y == 0) {
         scroll->d = 0.0;
         return p;
@@ -388,14 +666,18 @@ uint16_t text_lineup(int width, int height, uint16_t p, uint16_t lineheight, cha
         }
     }
 
+    if (layout) {
+        return hittext_layout(layout, x, width, y, INT_MAX, lineheight, str, length);
+    }
+
     return hittextmultiline(x, width, y, INT_MAX, lineheight, str, length, 1);
 }
 
-uint16_t text_linedown(int width, int height, uint16_t p, uint16_t lineheight, char *str, uint16_t length,
-                       SCROLLABLE *scroll) {
+uint16_t text_linedown(TEXT_LAYOUT *layout, int width, int height, uint16_t p, uint16_t lineheight, char *str,
+                       uint16_t length, SCROLLABLE *scroll) {
     // lazy
     int x, y;
-    textxy(width, p, lineheight, str, length, &x, &y);
+    text_layout_xy(layout, width, p, lineheight, str, length, &x, &y);
 
     y += lineheight;
 
@@ -409,5 +691,9 @@ uint16_t text_linedown(int width, int height, uint16_t p, uint16_t lineheight, c
         }
     }
 
+    if (layout) {
+        return hittext_layout(layout, x, width, y, INT_MAX, lineheight, str, length);
+    }
+
     return hittextmultiline(x, width, y, INT_MAX, lineheight, str, length, 1);
 }
@@ -6,6 +6,30 @@
 
 typedef struct scrollable SCROLLABLE;
 
+/* Where a piece of multiline text wraps, so it only has to be measured once.
+ *
+ * A layout is remade whenever it's used with a different wrap width, font, line height, scale or
+ * text length. The text itself isn't checked, whoever changes it calls text_layout_invalidate().
+ * Zero initialize it and free it with text_layout_free(). */
+typedef struct text_layout {
+    int      right, font;
+    uint16_t lineheight, length;
+    double   scale;
+    bool     valid;
+
+    // The text doesn't fit the width at all, text_height() is 0 for it.
+    bool unfit;
+
+    // Offset of the first character and the end of every line, and the width of every line.
+    uint16_t  lines, lines_size;
+    uint16_t *start, *end, *width;
+} TEXT_LAYOUT;
+
+void text_layout_free(TEXT_LAYOUT *layout);
+
+// Has the layout remade the next time it's used.
+void text_layout_invalidate(TEXT_LAYOUT *layout);
+
 
 /** Used to draw text within a specified box, starting with the x, y, of the first line of the text.
     Followed by right, top, then bottom borders of the box we're allowed to draw within.
@@ -19,9 +43,19 @@ uint16_t hittextmultiline(int mx, int right, int my, int height, uint16_t linehe
 
 int text_height(int right, uint16_t lineheight, char *str, uint16_t length);
 
-uint16_t text_lineup(int width, int height, uint16_t p, uint16_t lineheight, char *str, uint16_t length,
-                     SCROLLABLE *scroll);
-uint16_t text_linedown(int width, int height, uint16_t p, uint16_t lineheight, char *str, uint16_t length,
-                       SCROLLABLE *scroll);
+/* Same as the functions above for multiline text, but measure the text only when layout doesn't
+ * already hold its line breaks. */
+int utox_draw_text_layout_within_box(TEXT_LAYOUT *layout, int x, int y, int right, int top, int bottom,
+                                     uint16_t lineheight, const char *data, uint16_t length, uint16_t h,
+                                     uint16_t hlen, uint16_t mark, uint16_t marklen);
+uint16_t hittext_layout(TEXT_LAYOUT *layout, int mx, int right, int my, int height, uint16_t lineheight,
+                        const char *str, uint16_t length);
+int text_layout_height(TEXT_LAYOUT *layout, int right, uint16_t lineheight, const char *str, uint16_t length);
+
+// layout may be NULL.
+uint16_t text_lineup(TEXT_LAYOUT *layout, int width, int height, uint16_t p, uint16_t lineheight, char *str,
+                     uint16_t length, SCROLLABLE *scroll);
+uint16_t text_linedown(TEXT_LAYOUT *layout, int width, int height, uint16_t p, uint16_t lineheight, char *str,
+                       uint16_t length, SCROLLABLE *scroll);
 
 #endif
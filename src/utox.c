@@ -10,6 +10,7 @@
 #include "settings.h"
 #include "tox.h"
 
+#include "av/mixer.h"
 #include "av/utox_av.h"
 #include "av/video.h"
 #include "ui/dropdown.h"
@@ -293,19 +294,7 @@ void utox_message_dispatch(UTOX_MSG utox_msg_id, uint16_t param1, uint16_t param
         }
 
         case FILE_STATUS_UPDATE: {
-            if (!data) {
-                break;
-            }
-
-            FILE_TRANSFER *file = data;
-
-            if (file->ui_data) {
-                file->ui_data->via.ft.progress    = file->current_size;
-                file->ui_data->via.ft.speed       = file->speed;
-                file->ui_data->via.ft.file_status = param1;
-            }
-
-            free(data);
+            ft_progress_update();
             redraw();
             break;
         }
@@ -422,6 +411,13 @@ void utox_message_dispatch(UTOX_MSG utox_msg_id, uint16_t param1, uint16_t param
             redraw();
             break;
         }
+        case FRIEND_HISTORY_PAGE: {
+            /* data: the page of history the loader thread read
+             */
+            messages_history_page(data);
+            redraw();
+            break;
+        }
         /* Adding and deleting */
         case FRIEND_INCOMING_REQUEST: {
             /* data: pointer to FREQUEST structure
@@ -529,8 +525,7 @@ void utox_message_dispatch(UTOX_MSG utox_msg_id, uint16_t param1, uint16_t param
             // TODO: Don't try to start a new video session every frame.
             video_begin(param1, s->str, s->length, frame->w, frame->h);
             video_frame(param1, frame->img, frame->w, frame->h, 0);
-            free(frame->img);
-            free(data);
+            frame_unref(frame);
             // Intentional fall through
         }
         case AV_INLINE_FRAME: {
@@ -571,7 +566,9 @@ void utox_message_dispatch(UTOX_MSG utox_msg_id, uint16_t param1, uint16_t param
                 g->last_recv_audio[param2]        = g->last_recv_audio[g->peer_count];
                 g->last_recv_audio[g->peer_count] = 0;
                 group_av_peer_remove(g, param2);
-                g->source[param2] = g->source[g->peer_count];
+                pthread_mutex_lock(&group_mixer_lock);
+                mixer_peer_move(g->mixer, g->peer_count, param2);
+                pthread_mutex_unlock(&group_mixer_lock);
             }
 
             g->topic_length = snprintf((char *)g->topic, sizeof(g->topic),
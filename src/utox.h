@@ -42,6 +42,7 @@ typedef enum utox_msg_id {
     FRIEND_TYPING,
     FRIEND_MESSAGE,
     FRIEND_MESSAGE_UPDATE,
+    FRIEND_HISTORY_PAGE,
     /* Adding and deleting */
     FRIEND_INCOMING_REQUEST,
     FRIEND_ACCEPT_REQUEST,
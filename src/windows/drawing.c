@@ -256,8 +256,15 @@ void drawvline(int x, int y, int y2, uint32_t color) {
     FillRect(curr->draw_DC, &r, hdc_brush);
 }
 
+static int font_id = -1;
+
 void setfont(int id) {
     SelectObject(curr->draw_DC, font[id]);
+    font_id = id;
+}
+
+int getfont(void) {
+    return font_id;
 }
 
 uint32_t setcolor(uint32_t color) {
@@ -2,6 +2,7 @@
 #include "utf8.h"
 
 #include "../filesys.h"
+#include "../macros.h"
 #include "../settings.h"
 
 #include <io.h>
@@ -204,3 +205,78 @@ bool native_move_file(const uint8_t *current_name, const uint8_t *new_name) {
 
     return MoveFile((char *)current_name, (char *)new_name);
 }
+
+bool native_replace_file(const char *name, const char *new_name, bool portable_mode) {
+    char path[UTOX_FILE_NAME_LENGTH] = { 0 }, new_path[UTOX_FILE_NAME_LENGTH] = { 0 };
+
+    if (portable_mode) {
+        strcpy(path, portable_mode_save_path);
+    } else {
+        bool have_path = false;
+        have_path      = SUCCEEDED(SHGetFolderPath(NULL, CSIDL_APPDATA, NULL, 0, path));
+
+        if (!have_path) {
+            have_path = SUCCEEDED(SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA, NULL, 0, path));
+        }
+
+        if (!have_path) {
+            strcpy(path, portable_mode_save_path);
+            have_path = true;
+        }
+    }
+
+    const size_t length = strlen(path);
+    if (length + strlen("\\Tox\\") + MAX(strlen(name), strlen(new_name)) >= UTOX_FILE_NAME_LENGTH) {
+        return false;
+    }
+
+    strcpy(new_path, path);
+    snprintf(path + length, UTOX_FILE_NAME_LENGTH - length, "\\Tox\\%s", name);
+    snprintf(new_path + length, UTOX_FILE_NAME_LENGTH - length, "\\Tox\\%s", new_name);
+
+    // Unlike MoveFile(), this replaces new_path, and doesn't return until it's on disk.
+    return MoveFileEx(path, new_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+}
+
+// MapViewOfFile() wants an offset that's a multiple of the allocation granularity.
+static uint64_t map_offset_delta(uint64_t offset) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return offset % info.dwAllocationGranularity;
+}
+
+void *native_map_file(FILE *file, uint64_t offset, size_t length) {
+    if (!file || !length) {
+        return NULL;
+    }
+
+    HANDLE winFile = (HANDLE)_get_osfhandle(_fileno(file));
+    if (winFile == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+
+    HANDLE mapping = CreateFileMapping(winFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        return NULL;
+    }
+
+    const uint64_t delta   = map_offset_delta(offset);
+    const uint64_t aligned = offset - delta;
+
+    uint8_t *map = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(aligned >> 32), (DWORD)aligned, length + delta);
+    // The view keeps the mapping alive on its own.
+    CloseHandle(mapping);
+    if (!map) {
+        return NULL;
+    }
+
+    return map + delta;
+}
+
+void native_unmap_file(void *data, uint64_t offset, size_t UNUSED(length)) {
+    if (!data) {
+        return;
+    }
+
+    UnmapViewOfFile((uint8_t *)data - map_offset_delta(offset));
+}
@@ -10,7 +10,9 @@
 #include "../file_transfers.h"
 #include "../filesys.h"
 #include "../friend.h"
+#include "../macros.h"
 #include "../main.h"
+#include "../messages.h"
 #include "../settings.h"
 #include "../tox.h"
 
@@ -50,13 +52,21 @@ void native_export_chatlog_init(uint32_t friend_number) {
     free(path);
 }
 
-void native_select_dir_ft(uint32_t fid, uint32_t num, FILE_TRANSFER *file) {
-    if (!sanitize_filename(file->name)) {
+void native_select_dir_ft(uint32_t fid, MSG_HEADER *msg) {
+    // The dialog runs the message loop, msg can go away before it returns.
+    const uint32_t num = msg->via.ft.file_number;
+
+    uint8_t name[UTOX_FILE_NAME_LENGTH];
+    const size_t name_length = MIN(msg->via.ft.name_length, sizeof(name) - 1);
+    memcpy(name, msg->via.ft.name, name_length);
+    name[name_length] = 0;
+
+    if (!sanitize_filename(name)) {
         return;
     }
 
     wchar_t filepath[UTOX_FILE_NAME_LENGTH] = { 0 };
-    utf8_to_nativestr((char *)file->name, filepath, file->name_length * 2);
+    utf8_to_nativestr((char *)name, filepath, name_length * 2);
 
     OPENFILENAMEW ofn = {
         .lStructSize = sizeof(OPENFILENAMEW),
@@ -4,9 +4,12 @@
 #include "main.h"
 #include "window.h"
 
+#include "../macros.h"
 #include "../text.h"
 #include "../ui.h"
 
+#include "../av/video.h"
+
 #include <stdlib.h>
 
 static uint32_t scolor;
@@ -43,11 +46,16 @@ void draw_image(const NATIVE_IMAGE *image, int x, int y, uint32_t width, uint32_
 void draw_inline_image(uint8_t *img_data, size_t size, uint16_t w, uint16_t h, int x, int y) {
     const uint8_t *rgba_data = img_data;
 
-    // we don't need to free this, that's done by XDestroyImage()
-    uint8_t *out = malloc(size);
+    // Converted into a pooled frame, as this runs for every frame of inline video.
+    UTOX_FRAME_PKG *converted = frame_get(w, h);
+    if (!converted) {
+        return;
+    }
 
+    uint8_t *out = converted->img;
     uint32_t *target;
 
+    size = MIN(size, converted->size);
     for (uint32_t i = 0; i < size; i += 4) {
         // colors are read into red, blue and green and written into the target pointer
         const uint8_t red   = (rgba_data + i)[0] & 0xFF;
@@ -62,18 +70,18 @@ void draw_inline_image(uint8_t *img_data, size_t size, uint16_t w, uint16_t h, i
 
     XImage *img = XCreateImage(display, curr->visual, default_depth, ZPixmap, 0, (char *)out, w, h, 32, w * 4);
 
-    Picture rgb = ximage_to_picture(img, NULL);
-    // 4 bpp -> RGBA
-    Picture alpha = None;
-
-    NATIVE_IMAGE *image = malloc(sizeof(NATIVE_IMAGE));
-    image->rgb          = rgb;
-    image->alpha        = alpha;
+    const NATIVE_IMAGE image = {
+        .rgb   = ximage_to_picture(img, NULL),
+        .alpha = None,
+    };
 
+    // The data is the frame's, keep XDestroyImage() from freeing it.
+    img->data = NULL;
     XDestroyImage(img);
+    frame_unref(converted);
 
-    draw_image(image, x, y, w, h, 0, 0);
-    free(image);
+    draw_image(&image, x, y, w, h, 0, 0);
+    XRenderFreePicture(display, image.rgb);
 }
 
 void drawalpha(int bm, int x, int y, int width, int height, uint32_t color) {
@@ -6,6 +6,7 @@
 #include "../file_transfers.h"
 #include "../filesys.h"
 #include "../friend.h"
+#include "../messages.h"
 #include "../settings.h"
 #include "../tox.h"
 
@@ -101,16 +102,16 @@ bool native_remove_file(const uint8_t *name, size_t length, bool portable_mode)
     return true;
 }
 
-void native_select_dir_ft(uint32_t fid, uint32_t file_number, FILE_TRANSFER *file) {
+void native_select_dir_ft(uint32_t fid, MSG_HEADER *msg) {
     if (libgtk) {
-        ugtk_native_select_dir_ft(fid, file);
+        ugtk_native_select_dir_ft(fid, msg);
     } else {
         // fall back to working dir
-        char *path = malloc(file->name_length + 1);
-        memcpy(path, file->name, file->name_length);
-        path[file->name_length] = 0;
+        char *path = malloc(msg->via.ft.name_length + 1);
+        memcpy(path, msg->via.ft.name, msg->via.ft.name_length);
+        path[msg->via.ft.name_length] = 0;
 
-        postmessage_toxcore(TOX_FILE_ACCEPT, fid, file_number, path);
+        postmessage_toxcore(TOX_FILE_ACCEPT, fid, msg->via.ft.file_number, path);
     }
 }
 
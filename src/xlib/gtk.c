@@ -200,8 +200,15 @@ static void ugtk_openavatarthread(void *UNUSED(args)) {
     utoxGTK_open = false;
 }
 
+// What ugtk_savethread() needs of an incoming file, the message it came from can go away meanwhile.
+typedef struct {
+    uint32_t friend_number, file_number;
+    size_t   name_length;
+    char     name[];
+} UGTK_SAVE_FILE;
+
 static void ugtk_savethread(void *args) {
-    FILE_TRANSFER *file = args;
+    UGTK_SAVE_FILE *file = args;
 
     while (1) { // TODO, save current dir, and filename and preload them to gtk dialog if save fails.
         /* Create a GTK save window */
@@ -254,6 +261,8 @@ static void ugtk_savethread(void *args) {
         break;
     }
 
+    free(file);
+
     while (utoxGTK_events_pending()) {
         utoxGTK_main_iteration();
     }
@@ -348,10 +357,20 @@ void ugtk_openfileavatar(void) {
     thread(ugtk_openavatarthread, NULL);
 }
 
-void ugtk_native_select_dir_ft(uint32_t UNUSED(fid), FILE_TRANSFER *file) {
+void ugtk_native_select_dir_ft(uint32_t fid, MSG_HEADER *msg) {
     if (utoxGTK_open) {
         return;
     }
+
+    UGTK_SAVE_FILE *file = malloc(sizeof(UGTK_SAVE_FILE) + msg->via.ft.name_length);
+    if (!file) {
+        return;
+    }
+    file->friend_number = fid;
+    file->file_number   = msg->via.ft.file_number;
+    file->name_length   = msg->via.ft.name_length;
+    memcpy(file->name, msg->via.ft.name, msg->via.ft.name_length);
+
     utoxGTK_open   = true;
     thread(ugtk_savethread, file);
 }
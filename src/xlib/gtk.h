@@ -12,7 +12,7 @@ void ugtk_openfilesend(void);
 
 void ugtk_openfileavatar(void);
 
-void ugtk_native_select_dir_ft(uint32_t fid, FILE_TRANSFER *file);
+void ugtk_native_select_dir_ft(uint32_t fid, MSG_HEADER *msg);
 
 void ugtk_file_save_inline(MSG_HEADER *msg);
 
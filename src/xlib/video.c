@@ -17,6 +17,10 @@
 #include <sys/shm.h>
 #include <sys/stat.h>
 
+#ifdef HAVE_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+#endif
+
 #define MAX_VID_WINDOWS 32 // TODO drop this for dynamic allocation
 static Window video_win[MAX_VID_WINDOWS]; // TODO we should allocate this dynamically but this'll work for now
 static Window preview;        // Video preview
@@ -73,18 +77,19 @@ void video_frame(uint16_t id, uint8_t *img_data, uint16_t width, uint16_t height
     };
 
     /* scale image if needed */
-    uint8_t *new_data = malloc(attrs.width * attrs.height * 4);
-    if (new_data && (attrs.width != width || attrs.height != height)) {
-        scale_rgbx_image(img_data, width, height, new_data, attrs.width, attrs.height);
-        image.data = (char *)new_data;
+    UTOX_FRAME_PKG *scaled = NULL;
+    if (attrs.width != width || attrs.height != height) {
+        scaled = frame_get(attrs.width, attrs.height);
+        if (!scaled) {
+            return;
+        }
+
+        scale_rgbx_image(img_data, width, height, scaled->img, attrs.width, attrs.height);
+        image.data = scaled->img;
     }
 
-    GC     default_gc = DefaultGC(display, def_screen_num);
-    Pixmap pixmap     = XCreatePixmap(display, main_window.window, attrs.width, attrs.height, default_depth);
-    XPutImage(display, pixmap, default_gc, &image, 0, 0, 0, 0, attrs.width, attrs.height);
-    XCopyArea(display, pixmap, *win, default_gc, 0, 0, attrs.width, attrs.height, 0, 0);
-    XFreePixmap(display, pixmap);
-    free(new_data);
+    XPutImage(display, *win, DefaultGC(display, def_screen_num), &image, 0, 0, 0, 0, attrs.width, attrs.height);
+    frame_unref(scaled);
 }
 
 void video_begin(uint16_t id, char *name, uint16_t name_length, uint16_t width, uint16_t height) {
@@ -178,6 +183,144 @@ uint16_t native_video_detect(void) {
 
 static uint16_t video_x, video_y;
 
+/* Desktop capture only grabs and converts the parts of the screen that changed.
+ *
+ * The capture area is cut into CAPTURE_TILE square tiles. With XDamage the X server tells us what
+ * was drawn on, and only the rows of tiles it touched are grabbed again. Without it every frame is
+ * grabbed whole, and a tile is dirty when its hash changes. Either way only the dirty rows of tiles
+ * are converted, and a frame with nothing dirty isn't sent at all. Once every CAPTURE_REFRESH the
+ * whole frame is grabbed and sent regardless, to make up for missed damage and for anyone who lost
+ * a frame. */
+#define CAPTURE_TILE 64
+#define CAPTURE_REFRESH ((uint64_t)2 * 1000 * 1000 * 1000)
+
+static uint16_t  tile_columns, tile_rows;
+static uint64_t *tile_hash;
+static bool     *tile_row_dirty;
+static uint64_t  capture_refresh_time;
+
+#ifdef HAVE_XDAMAGE
+static Damage damage;
+static int    damage_event;
+
+// Marks the rows of tiles drawn on since the last frame dirty.
+static void capture_damage(void) {
+    while (XPending(deskdisplay)) {
+        XEvent event;
+        XNextEvent(deskdisplay, &event);
+        if (event.type != damage_event + XDamageNotify) {
+            continue;
+        }
+
+        const XRectangle *area = &((XDamageNotifyEvent *)&event)->area;
+
+        const int left = area->x - video_x, right = left + area->width;
+        const int top = area->y - video_y, bottom = top + area->height;
+        if (right <= 0 || left >= video_width || bottom <= 0 || top >= video_height) {
+            continue;
+        }
+
+        for (int row = MAX(top, 0) / CAPTURE_TILE; row <= (MIN(bottom, video_height) - 1) / CAPTURE_TILE; ++row) {
+            tile_row_dirty[row] = true;
+        }
+    }
+}
+#endif
+
+static uint64_t capture_tile_hash(uint16_t column, uint16_t row) {
+    const unsigned int x = column * CAPTURE_TILE, y = row * CAPTURE_TILE;
+    const unsigned int width  = MIN(CAPTURE_TILE, video_width - x);
+    const unsigned int height = MIN(CAPTURE_TILE, video_height - y);
+
+    // FNV-1a a word at a time, widths are even so the rows are whole words.
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned int i = 0; i < height; ++i) {
+        const uint8_t *pixels = (uint8_t *)screen_image->data + (size_t)(y + i) * screen_image->bytes_per_line + x * 4;
+
+        for (unsigned int j = 0; j < width * 4; j += 8) {
+            uint64_t word;
+            memcpy(&word, pixels + j, 8);
+            hash = (hash ^ word) * 1099511628211ULL;
+        }
+    }
+
+    return hash;
+}
+
+// Marks the rows of tiles that changed since the last frame dirty, the whole frame having been grabbed.
+static void capture_hash_tiles(void) {
+    for (uint16_t row = 0; row < tile_rows; ++row) {
+        for (uint16_t column = 0; column < tile_columns; ++column) {
+            const uint64_t hash = capture_tile_hash(column, row);
+            if (tile_hash[row * tile_columns + column] != hash) {
+                tile_hash[row * tile_columns + column] = hash;
+                tile_row_dirty[row] = true;
+            }
+        }
+    }
+}
+
+// Grabs rows top to top + height of the capture area into their place in screen_image.
+static bool capture_grab_rows(unsigned int top, unsigned int height) {
+    XImage rows = *screen_image;
+    rows.height = height;
+    rows.data   = screen_image->data + (size_t)top * screen_image->bytes_per_line;
+
+    return XShmGetImage(deskdisplay, RootWindow(deskdisplay, deskscreen), &rows, video_x, video_y + top, AllPlanes);
+}
+
+// Returns 1 if y, u and v have a new frame to send, 0 if it's the same as the last one.
+static int capture_desktop_frame(uint8_t *y, uint8_t *u, uint8_t *v, uint64_t time) {
+    const bool refresh = time - capture_refresh_time >= CAPTURE_REFRESH;
+    if (refresh) {
+        capture_refresh_time = time;
+        memset(tile_row_dirty, true, tile_rows * sizeof(bool));
+    }
+
+    bool grab_rows = false;
+#ifdef HAVE_XDAMAGE
+    if (damage) {
+        capture_damage();
+        grab_rows = true;
+    }
+#endif
+
+    if (!grab_rows) {
+        XShmGetImage(deskdisplay, RootWindow(deskdisplay, deskscreen), screen_image, video_x, video_y, AllPlanes);
+        capture_hash_tiles();
+    }
+
+    bool changed = false;
+    for (uint16_t row = 0; row < tile_rows; ++row) {
+        if (!tile_row_dirty[row]) {
+            continue;
+        }
+
+        // Every run of dirty rows in one go.
+        uint16_t end = row;
+        while (end < tile_rows && tile_row_dirty[end]) {
+            tile_row_dirty[end++] = false;
+        }
+
+        const unsigned int top    = row * CAPTURE_TILE;
+        const unsigned int height = MIN(end * CAPTURE_TILE, video_height) - top;
+
+        if (grab_rows && !capture_grab_rows(top, height)) {
+            row = end;
+            continue;
+        }
+
+        bgrxtoyuv420(y + (size_t)top * video_width, u + (size_t)(top / 2) * (video_width / 2),
+                     v + (size_t)(top / 2) * (video_width / 2),
+                     (uint8_t *)screen_image->data + (size_t)top * screen_image->bytes_per_line, video_width, height);
+
+        changed = true;
+        row     = end;
+    }
+
+    return changed || refresh;
+}
+
 bool native_video_init(void *handle) {
     if (isdesktop(handle)) {
         utox_v4l_fd = -1;
@@ -222,6 +365,27 @@ bool native_video_init(void *handle) {
             return false;
         }
 
+        tile_columns = (video_width + CAPTURE_TILE - 1) / CAPTURE_TILE;
+        tile_rows    = (video_height + CAPTURE_TILE - 1) / CAPTURE_TILE;
+
+        free(tile_hash);
+        free(tile_row_dirty);
+        tile_hash      = calloc((size_t)tile_columns * tile_rows, sizeof(uint64_t));
+        tile_row_dirty = calloc(tile_rows, sizeof(bool));
+        if (!tile_hash || !tile_row_dirty) {
+            return false;
+        }
+
+        // The first frame is grabbed and sent whole.
+        capture_refresh_time = 0;
+
+#ifdef HAVE_XDAMAGE
+        int damage_error;
+        if (!damage && XDamageQueryExtension(deskdisplay, &damage_event, &damage_error)) {
+            damage = XDamageCreate(deskdisplay, RootWindow(deskdisplay, deskscreen), XDamageReportRawRectangles);
+        }
+#endif
+
         return true;
     }
 
@@ -230,6 +394,13 @@ bool native_video_init(void *handle) {
 
 void native_video_close(void *handle) {
     if (isdesktop(handle)) {
+#ifdef HAVE_XDAMAGE
+        if (damage) {
+            XDamageDestroy(deskdisplay, damage);
+            damage = None;
+        }
+#endif
+
         XShmDetach(deskdisplay, &shminfo);
         return;
     }
@@ -258,14 +429,12 @@ int native_video_getframe(uint8_t *y, uint8_t *u, uint8_t *v, uint16_t width, ui
         static uint64_t lasttime;
         uint64_t t = get_time();
         if (t - lasttime >= (uint64_t)1000 * 1000 * 1000 / 24) {
-            XShmGetImage(deskdisplay, RootWindow(deskdisplay, deskscreen), screen_image, video_x, video_y, AllPlanes);
             if (width != video_width || height != video_height) {
                 return 0;
             }
 
-            bgrxtoyuv420(y, u, v, (uint8_t *)screen_image->data, screen_image->width, screen_image->height);
             lasttime = t;
-            return 1;
+            return capture_desktop_frame(y, u, v, t);
         }
         return 0;
     }
@@ -0,0 +1,116 @@
+/* Times the video conversion kernels on full HD frames, printing how many MB of input each gets
+ * through a second. Not a test, run it by hand:
+ *
+ *     ./bench_video_convert [frames]
+ */
+
+#include "../src/av/video_convert.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_WIDTH 1920
+#define BENCH_HEIGHT 1080
+#define BENCH_PIXELS ((size_t)BENCH_WIDTH * BENCH_HEIGHT)
+
+static uint8_t *y, *u, *v, *bgrx, *bgr, *yuv422;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *conversion, const char *kernel, size_t bytes, int frames, double start) {
+    const double seconds = now() - start;
+    printf("%-14s %-5s %8.1f MB/s %8.1f fps\n", conversion, kernel, bytes * frames / seconds / 1e6, frames / seconds);
+}
+
+static void bench(const char *kernel, YUV420_ROWS *yuv420, BGRX_ROWS *bgrx_rows, YUV422_ROWS *yuv422_rows,
+                  int frames)
+{
+    double start;
+
+    if (yuv420) {
+        start = now();
+        for (int i = 0; i < frames; ++i) {
+            yuv420tobgr_rows(yuv420, BENCH_WIDTH, BENCH_HEIGHT, y, u, v, BENCH_WIDTH, BENCH_WIDTH / 2,
+                             BENCH_WIDTH / 2, bgrx);
+        }
+        report("yuv420tobgr", kernel, BENCH_PIXELS * 3 / 2, frames, start);
+    }
+
+    if (bgrx_rows) {
+        start = now();
+        for (int i = 0; i < frames; ++i) {
+            bgrxtoyuv420_rows(bgrx_rows, y, u, v, bgrx, BENCH_WIDTH, BENCH_HEIGHT);
+        }
+        report("bgrxtoyuv420", kernel, BENCH_PIXELS * 4, frames, start);
+
+        start = now();
+        for (int i = 0; i < frames; ++i) {
+            bgrtoyuv420_rows(bgrx_rows, y, u, v, bgr, BENCH_WIDTH, BENCH_HEIGHT);
+        }
+        report("bgrtoyuv420", kernel, BENCH_PIXELS * 3, frames, start);
+    }
+
+    if (yuv422_rows) {
+        start = now();
+        for (int i = 0; i < frames; ++i) {
+            yuv422to420_rows(yuv422_rows, y, u, v, yuv422, BENCH_WIDTH, BENCH_HEIGHT);
+        }
+        report("yuv422to420", kernel, BENCH_PIXELS * 2, frames, start);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const int frames = argc > 1 ? atoi(argv[1]) : 200;
+
+    y      = malloc(BENCH_PIXELS);
+    u      = malloc(BENCH_PIXELS / 4);
+    v      = malloc(BENCH_PIXELS / 4);
+    bgrx   = malloc(BENCH_PIXELS * 4);
+    bgr    = malloc(BENCH_PIXELS * 3);
+    yuv422 = malloc(BENCH_PIXELS * 2);
+
+    for (size_t i = 0; i < BENCH_PIXELS; ++i) {
+        y[i] = rand();
+    }
+    for (size_t i = 0; i < BENCH_PIXELS / 4; ++i) {
+        u[i] = rand();
+        v[i] = rand();
+    }
+    for (size_t i = 0; i < BENCH_PIXELS * 4; ++i) {
+        bgrx[i] = rand();
+    }
+    for (size_t i = 0; i < BENCH_PIXELS * 3; ++i) {
+        bgr[i] = rand();
+    }
+    for (size_t i = 0; i < BENCH_PIXELS * 2; ++i) {
+        yuv422[i] = rand();
+    }
+
+    bench("C", yuv420_rows_c, bgrx_rows_c, yuv422_rows_c, frames);
+
+#ifdef VIDEO_CONVERT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2")) {
+        bench("SSE2", yuv420_rows_sse2, bgrx_rows_sse2, yuv422_rows_sse2, frames);
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        bench("AVX2", yuv420_rows_avx2, bgrx_rows_avx2, NULL, frames);
+    }
+#endif
+
+    free(y);
+    free(u);
+    free(v);
+    free(bgrx);
+    free(bgr);
+    free(yuv422);
+
+    return 0;
+}
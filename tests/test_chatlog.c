@@ -1,5 +1,6 @@
 #include "test.h"
 
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,11 +24,17 @@ void native_export_chatlog_init(uint32_t friend_number) {
 
 bool test_write_chatlog();
 bool test_read_chatlog();
+bool test_truncated_chatlog();
+bool test_stale_index_header();
+bool test_flush_chatlogs();
 
 int main() {
     int result = 0;
     RUN_TEST(test_write_chatlog)
     RUN_TEST(test_read_chatlog)
+    RUN_TEST(test_truncated_chatlog)
+    RUN_TEST(test_stale_index_header)
+    RUN_TEST(test_flush_chatlogs)
 
     return result;
 }
@@ -54,7 +61,7 @@ uint8_t* create_mock_message(size_t *length) {
 
     uint8_t *data = calloc(1, *length);
     if (!data) {
-        FAIL_FATAL("Can't calloc for chat logging data. size: %lu", *length);
+        FAIL_FATAL("Can't calloc for chat logging data. size: %zu", *length);
     }
     memcpy(data, &header, sizeof(header));
     memcpy(data + sizeof(header), author, author_length);
@@ -78,14 +85,14 @@ bool test_write_chatlog() {
     uint8_t *data1 = create_mock_message(&length1);
 
     uint64_t disk_offset1 = utox_save_chatlog(id_str, data1, length1);
-    LOG("disk offset 1: %lu", disk_offset1);
+    LOG("disk offset 1: %" PRIu64, disk_offset1);
     assert(disk_offset1 == 0);
 
     size_t length2;
     uint8_t *data2 = create_mock_message(&length2);
 
     uint64_t disk_offset2 = utox_save_chatlog(id_str, data2, length2);
-    LOG("disk offset 2: %lu", disk_offset2);
+    LOG("disk offset 2: %" PRIu64, disk_offset2);
     assert(disk_offset2 == length1);
 
     free(data1);
@@ -94,8 +101,196 @@ bool test_write_chatlog() {
     return true;
 }
 
+static bool check_loaded_record(size_t skip, uint64_t expected_offset) {
+    char id_str[TOX_PUBLIC_KEY_SIZE * 2] = MOCK_FRIEND_ID;
+
+    size_t count = 0;
+    MSG_HEADER **data = utox_load_chatlog(id_str, &count, 1, skip);
+    if (!data) {
+        FAIL("unable to load the chat log, skip: %zu", skip);
+    }
+
+    bool result = count == 1 && data[0]->disk_offset == expected_offset
+                  && data[0]->via.txt.length == strlen("This is a test message.")
+                  && memcmp(data[0]->via.txt.msg, "This is a test message.", data[0]->via.txt.length) == 0;
+
+    LOG("skip %zu: loaded %zu record(s) from offset %" PRIu64, skip, count, count ? data[0]->disk_offset : 0);
+
+    for (size_t i = 0; i < count; ++i) {
+        chatlog_slab_release(data[i]->slab);
+    }
+    free(data);
+
+    return result;
+}
+
+/**
+ * @covers utox_load_chatlog()
+ */
 bool test_read_chatlog() {
-    // TODO implement
+    size_t length;
+    free(create_mock_message(&length));
+
+    // records written by test_write_chatlog()
+    if (!check_loaded_record(0, length) || !check_loaded_record(1, 0)) {
+        FAIL("loaded the wrong records using the index");
+    }
+
+    // The index is a cache, make sure it's rebuilt from the log when it goes missing.
+    char index_name[] = MOCK_FRIEND_ID ".new.idx";
+    utox_get_file(index_name, NULL, UTOX_FILE_OPTS_DELETE);
+
+    if (!check_loaded_record(0, length) || !check_loaded_record(1, 0)) {
+        FAIL("loaded the wrong records after rebuilding the index");
+    }
+
+    // Both records come back from a single slab.
+    char id_str[TOX_PUBLIC_KEY_SIZE * 2] = MOCK_FRIEND_ID;
+    size_t count = 0;
+    MSG_HEADER **data = utox_load_chatlog(id_str, &count, 10, 0);
+    if (!data || count != 2 || data[0]->disk_offset != 0 || data[1]->disk_offset != length
+        || data[0]->slab != data[1]->slab)
+    {
+        FAIL("unable to load the whole chat log");
+    }
+    chatlog_slab_release(data[0]->slab);
+    chatlog_slab_release(data[1]->slab);
+    free(data);
+
+    size_t index_size = 0;
+    FILE *index = utox_get_file(index_name, &index_size, UTOX_FILE_OPTS_READ);
+    if (!index) {
+        FAIL("the index wasn't rebuilt");
+    }
+    fclose(index);
+
+    if (index_size != sizeof(LOG_FILE_INDEX_HEADER) + 2 * sizeof(LOG_FILE_INDEX_ENTRY)) {
+        FAIL("rebuilt index has the wrong size: %zu", index_size);
+    }
+
+    return true;
+}
+
+/**
+ * @covers utox_load_chatlog()
+ */
+bool test_truncated_chatlog() {
+    size_t length;
+    free(create_mock_message(&length));
+
+    // A record cut short by a crash, after the two from test_write_chatlog().
+    char log_name[] = MOCK_FRIEND_ID ".new.txt";
+    FILE *log = utox_get_file(log_name, NULL, UTOX_FILE_OPTS_APPEND);
+    if (!log) {
+        FAIL("unable to open the chat log");
+    }
+    LOG_FILE_MSG_HEADER partial = { .log_version = LOGFILE_SAVE_VERSION, .msg_length = 100 };
+    fwrite(&partial, sizeof(partial), 1, log);
+    fwrite("cut short", strlen("cut short"), 1, log);
+    fclose(log);
+
+    char index_name[] = MOCK_FRIEND_ID ".new.idx";
+    utox_get_file(index_name, NULL, UTOX_FILE_OPTS_DELETE);
+
+    char id_str[TOX_PUBLIC_KEY_SIZE * 2] = MOCK_FRIEND_ID;
+    size_t count = 0;
+    MSG_HEADER **data = utox_load_chatlog(id_str, &count, 10, 0);
+    if (!data || count != 2) {
+        FAIL("the partial record was loaded, count: %zu", count);
+    }
+    chatlog_slab_release(data[0]->slab);
+    chatlog_slab_release(data[1]->slab);
+    free(data);
+
+    // Only the complete records are indexed.
+    size_t index_size = 0;
+    FILE *index = utox_get_file(index_name, &index_size, UTOX_FILE_OPTS_READ);
+    LOG_FILE_INDEX_HEADER header;
+    if (!index || fread(&header, sizeof(header), 1, index) != 1) {
+        FAIL("the index wasn't rebuilt");
+    }
+    fclose(index);
+
+    if (index_size != sizeof(header) + 2 * sizeof(LOG_FILE_INDEX_ENTRY) || header.log_size != 2 * length) {
+        FAIL("the partial record was indexed, index size: %zu, log size: %" PRIu64, index_size, header.log_size);
+    }
+
+    return true;
+}
+
+/**
+ * @covers utox_load_chatlog()
+ */
+bool test_stale_index_header() {
+    size_t length;
+    free(create_mock_message(&length));
+
+    // The entries reached the disk but the header didn't, it only covers the first record.
+    char index_name[] = MOCK_FRIEND_ID ".new.idx";
+    FILE *index = utox_get_file(index_name, NULL, UTOX_FILE_OPTS_READ | UTOX_FILE_OPTS_WRITE);
+    if (!index || !chatlog_index_write_header(index, length)) {
+        FAIL("unable to write the index header");
+    }
+    fclose(index);
+
+    char id_str[TOX_PUBLIC_KEY_SIZE * 2] = MOCK_FRIEND_ID;
+    size_t count = 0;
+    MSG_HEADER **data = utox_load_chatlog(id_str, &count, 10, 0);
+    if (!data || count != 2 || data[1]->disk_offset != length) {
+        FAIL("loaded the wrong records, count: %zu", count);
+    }
+    chatlog_slab_release(data[0]->slab);
+    chatlog_slab_release(data[1]->slab);
+    free(data);
+
+    // Catching up rewrote the second entry rather than adding it again.
+    size_t index_size = 0;
+    index = utox_get_file(index_name, &index_size, UTOX_FILE_OPTS_READ);
+    if (index) {
+        fclose(index);
+    }
+
+    if (index_size != sizeof(LOG_FILE_INDEX_HEADER) + 2 * sizeof(LOG_FILE_INDEX_ENTRY)) {
+        FAIL("the index has duplicate entries, size: %zu", index_size);
+    }
+
+    return true;
+}
+
+/**
+ * @covers utox_flush_chatlogs()
+ */
+bool test_flush_chatlogs() {
+    // A log that was never loaded, the writer has to measure it before it can hand out an offset.
+    char id_str[TOX_PUBLIC_KEY_SIZE * 2 + 1] = "0000000000000000000000000000000000000000000000000000000000000001";
+
+    size_t length;
+    uint8_t *data = create_mock_message(&length);
+    uint64_t disk_offset = utox_save_chatlog(id_str, data, length);
+    free(data);
+
+    if (disk_offset != 0) {
+        FAIL("the new log was measured wrong, offset: %" PRIu64, disk_offset);
+    }
+
+    utox_flush_chatlogs();
+
+    if (writer.running) {
+        FAIL("the writer thread is still running");
+    }
+
+    char log_name[] = "0000000000000000000000000000000000000000000000000000000000000001.new.txt";
+    size_t log_size = 0;
+    FILE *log = utox_get_file(log_name, &log_size, UTOX_FILE_OPTS_READ);
+    if (log) {
+        fclose(log);
+    }
+
+    utox_remove_friend_chatlog(id_str);
+
+    if (log_size != length) {
+        FAIL("the queued record wasn't written, log size: %zu", log_size);
+    }
 
     return true;
 }
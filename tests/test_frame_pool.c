@@ -0,0 +1,73 @@
+#include "../src/av/frame_pool.c"
+
+#include "test.h"
+
+START_TEST(test_reuse)
+{
+    UTOX_FRAME_PKG *frame = frame_get(64, 48);
+    ck_assert(frame);
+    ck_assert_int_eq(frame->size, 64 * 48 * 4);
+    void *img = frame->img;
+
+    // Only the last reference hands it back.
+    frame_ref(frame);
+    frame_unref(frame);
+    UTOX_FRAME_PKG *fresh = frame_get(64, 48);
+    ck_assert(fresh != frame);
+    frame_unref(fresh);
+
+    frame_unref(frame);
+    ck_assert(frame_get(64, 48) == frame);
+    ck_assert(frame->img == img);
+    ck_assert_int_eq(frame->refs, 1);
+
+    // Other resolutions don't share.
+    UTOX_FRAME_PKG *other = frame_get(32, 48);
+    ck_assert(other != frame);
+    ck_assert_int_eq(other->size, 32 * 48 * 4);
+
+    frame_unref(frame);
+    frame_unref(other);
+    frame_unref(NULL);
+}
+END_TEST
+
+START_TEST(test_eviction)
+{
+    UTOX_FRAME_PKG *frame = frame_get(640, 480);
+    frame_unref(frame);
+
+    // Going through more resolutions than are kept drops the frames of the oldest.
+    for (uint16_t i = 1; i <= FRAME_POOL_SIZES; ++i) {
+        frame_unref(frame_get(i, i));
+    }
+
+    for (int i = 0; i < FRAME_POOL_SIZES; ++i) {
+        ck_assert(frame_pool[i].w != 640 || frame_pool[i].h != 480);
+    }
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Frame pool");
+
+    MK_TEST_CASE(reuse);
+    MK_TEST_CASE(eviction);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
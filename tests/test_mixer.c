@@ -0,0 +1,136 @@
+#include "../src/av/mixer.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+static void push_constant(MIXER *mixer, uint32_t peer, int16_t value, unsigned int samples) {
+    int16_t *pcm = malloc(samples * sizeof(int16_t));
+    for (unsigned int i = 0; i < samples; ++i) {
+        pcm[i] = value;
+    }
+
+    ck_assert(mixer_push(mixer, peer, pcm, samples, 1, MIXER_SAMPLE_RATE));
+    free(pcm);
+}
+
+static bool frame_is(const int16_t *frame, int16_t value) {
+    for (int i = 0; i < MIXER_FRAME; ++i) {
+        if (frame[i] != value) {
+            return false;
+        }
+    }
+    return true;
+}
+
+START_TEST(test_jitter_buffer)
+{
+    MIXER *mixer = mixer_new(8);
+    int16_t frame[MIXER_FRAME];
+
+    // Nothing plays until there's a jitter buffer's worth.
+    push_constant(mixer, 3, 100, MIXER_JITTER_TARGET - 1);
+    ck_assert(!mixer_mix(mixer, frame));
+    ck_assert(frame_is(frame, 0));
+
+    push_constant(mixer, 3, 100, 1);
+    for (int i = 0; i < MIXER_JITTER_TARGET / MIXER_FRAME; ++i) {
+        ck_assert(mixer_mix(mixer, frame));
+        ck_assert(frame_is(frame, 100));
+    }
+
+    // Ran dry, so it's buffering again.
+    ck_assert(!mixer_mix(mixer, frame));
+    push_constant(mixer, 3, 100, MIXER_FRAME);
+    ck_assert(!mixer_mix(mixer, frame));
+
+    mixer_free(mixer);
+}
+END_TEST
+
+START_TEST(test_speaker_limit)
+{
+    MIXER *mixer = mixer_new(8);
+    int16_t frame[MIXER_FRAME];
+
+    // Only the MIXER_MAX_SPEAKERS loudest are mixed, whatever order they're in.
+    const int16_t values[] = { 1, 300, 2, 200, 400, 3, 100 };
+    for (uint32_t i = 0; i < sizeof(values) / sizeof(*values); ++i) {
+        push_constant(mixer, i, values[i], MIXER_JITTER_TARGET);
+    }
+
+    ck_assert(mixer_mix(mixer, frame));
+    ck_assert(frame_is(frame, 1000));
+
+    // A quiet one turned up gets in.
+    mixer_set_gain(mixer, 6, 5);
+    ck_assert(mixer_mix(mixer, frame));
+    ck_assert(frame_is(frame, 500 + 400 + 300 + 200));
+
+    mixer_free(mixer);
+}
+END_TEST
+
+START_TEST(test_clipping)
+{
+    MIXER *mixer = mixer_new(2);
+    int16_t frame[MIXER_FRAME];
+
+    push_constant(mixer, 0, INT16_MAX, MIXER_JITTER_TARGET);
+    push_constant(mixer, 1, INT16_MAX, MIXER_JITTER_TARGET);
+    ck_assert(mixer_mix(mixer, frame));
+    ck_assert(frame_is(frame, INT16_MAX));
+
+    mixer_free(mixer);
+}
+END_TEST
+
+START_TEST(test_flush)
+{
+    MIXER *mixer = mixer_new(8);
+    int16_t frame[MIXER_FRAME];
+
+    mixer_set_gain(mixer, 2, 2.0);
+    push_constant(mixer, 2, 100, MIXER_JITTER_SIZE);
+    mixer_flush(mixer);
+
+    // What was buffered is gone, and the peer has to buffer up again.
+    ck_assert(!mixer_mix(mixer, frame));
+    push_constant(mixer, 2, 100, MIXER_JITTER_TARGET - 1);
+    ck_assert(!mixer_mix(mixer, frame));
+
+    // The gain stays.
+    push_constant(mixer, 2, 100, 1);
+    ck_assert(mixer_mix(mixer, frame));
+    ck_assert(frame_is(frame, 200));
+
+    mixer_free(mixer);
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Group call mixer");
+
+    MK_TEST_CASE(jitter_buffer);
+    MK_TEST_CASE(speaker_limit);
+    MK_TEST_CASE(clipping);
+    MK_TEST_CASE(flush);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}
@@ -0,0 +1,292 @@
+#include "../src/av/video_convert.c"
+
+#include "test.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* The per pixel conversion the kernels replaced, which they have to match exactly. */
+static void yuv420tobgr_reference(uint16_t width, uint16_t height, const uint8_t *y, const uint8_t *u,
+                                  const uint8_t *v, unsigned int ystride, unsigned int ustride,
+                                  unsigned int vstride, uint8_t *out)
+{
+    for (unsigned long int i = 0; i < height; ++i) {
+        for (unsigned long int j = 0; j < width; ++j) {
+            uint8_t *point = out + 4 * ((i * width) + j);
+            int       t_y   = y[((i * ystride) + j)];
+            const int t_u   = u[(((i / 2) * ustride) + (j / 2))];
+            const int t_v   = v[(((i / 2) * vstride) + (j / 2))];
+            t_y            = t_y < 16 ? 16 : t_y;
+
+            const int r = (298 * (t_y - 16) + 409 * (t_v - 128) + 128) >> 8;
+            const int g = (298 * (t_y - 16) - 100 * (t_u - 128) - 208 * (t_v - 128) + 128) >> 8;
+            const int b = (298 * (t_y - 16) + 516 * (t_u - 128) + 128) >> 8;
+
+            point[2] = r > 255 ? 255 : r < 0 ? 0 : r;
+            point[1] = g > 255 ? 255 : g < 0 ? 0 : g;
+            point[0] = b > 255 ? 255 : b < 0 ? 0 : b;
+            point[3] = ~0;
+        }
+    }
+}
+
+/* The per pixel encoder side conversions the kernels replaced. */
+static void bgrxtoyuv420_reference(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, const uint8_t *rgb,
+                                   uint16_t width, uint16_t height, unsigned int bytes)
+{
+    for (uint16_t y = 0; y != height; y += 2) {
+        const uint8_t *p = rgb;
+        for (uint16_t x = 0; x != width; x++) {
+            *plane_y++ = rgb_to_y(rgb[2], rgb[1], rgb[0]);
+            rgb += bytes;
+        }
+
+        for (uint16_t x = 0; x != width / 2; x++) {
+            const uint8_t *a = rgb, *b = rgb + bytes;
+            *plane_y++ = rgb_to_y(a[2], a[1], a[0]);
+            *plane_y++ = rgb_to_y(b[2], b[1], b[0]);
+
+            const int blue  = (a[0] + b[0] + p[0] + p[bytes] + 2) / 4;
+            const int green = (a[1] + b[1] + p[1] + p[bytes + 1] + 2) / 4;
+            const int red   = (a[2] + b[2] + p[2] + p[bytes + 2] + 2) / 4;
+
+            *plane_u++ = rgb_to_u(red, green, blue);
+            *plane_v++ = rgb_to_v(red, green, blue);
+
+            rgb += bytes * 2;
+            p += bytes * 2;
+        }
+    }
+}
+
+static void yuv422to420_reference(uint8_t *plane_y, uint8_t *plane_u, uint8_t *plane_v, const uint8_t *input,
+                                  uint16_t width, uint16_t height)
+{
+    const uint8_t *end = input + width * height * 2;
+    while (input != end) {
+        const uint8_t *line_end = input + width * 2;
+        while (input != line_end) {
+            *plane_y++ = *input++;
+            *plane_v++ = *input++;
+            *plane_y++ = *input++;
+            *plane_u++ = *input++;
+        }
+
+        line_end = input + width * 2;
+        while (input != line_end) {
+            *plane_y++ = *input++;
+            input++; // u
+            *plane_y++ = *input++;
+            input++; // v
+        }
+    }
+}
+
+static uint8_t *random_plane(size_t size) {
+    uint8_t *plane = malloc(size);
+    for (size_t i = 0; i < size; ++i) {
+        plane[i] = rand();
+    }
+    return plane;
+}
+
+// Converts random frames of all sorts of sizes and strides with rows, comparing to the reference.
+static void check_yuv420_rows(YUV420_ROWS *rows, const char *name) {
+    for (int i = 0; i < 200; ++i) {
+        const uint16_t width  = 1 + rand() % 100;
+        const uint16_t height = 1 + rand() % 20;
+
+        const unsigned int ystride = width + rand() % 40;
+        const unsigned int ustride = (width + 1) / 2 + rand() % 20;
+        const unsigned int vstride = (width + 1) / 2 + rand() % 20;
+
+        uint8_t *y = random_plane((size_t)ystride * height);
+        uint8_t *u = random_plane((size_t)ustride * ((height + 1) / 2));
+        uint8_t *v = random_plane((size_t)vstride * ((height + 1) / 2));
+
+        uint8_t *expected = malloc((size_t)width * height * 4);
+        uint8_t *actual   = malloc((size_t)width * height * 4);
+
+        yuv420tobgr_reference(width, height, y, u, v, ystride, ustride, vstride, expected);
+        yuv420tobgr_rows(rows, width, height, y, u, v, ystride, ustride, vstride, actual);
+
+        ck_assert_msg(!memcmp(expected, actual, (size_t)width * height * 4),
+                      "%s differs from the reference for a %ux%u frame", name, width, height);
+
+        free(y);
+        free(u);
+        free(v);
+        free(expected);
+        free(actual);
+    }
+}
+
+START_TEST(test_yuv420_c)
+{
+    check_yuv420_rows(yuv420_rows_c, "C");
+}
+END_TEST
+
+START_TEST(test_yuv420_simd)
+{
+#ifdef VIDEO_CONVERT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2")) {
+        check_yuv420_rows(yuv420_rows_sse2, "SSE2");
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        check_yuv420_rows(yuv420_rows_avx2, "AVX2");
+    }
+#endif
+}
+END_TEST
+
+START_TEST(test_yuv420_extremes)
+{
+    // Every combination of the extreme values, which is where the clamping happens.
+    const uint8_t values[] = { 0, 15, 16, 17, 127, 128, 129, 235, 240, 255 };
+    const int     count    = sizeof(values);
+
+    const uint16_t width = count * count * 2, height = count * 2;
+
+    uint8_t *y = malloc((size_t)width * height);
+    uint8_t *u = malloc((size_t)width / 2 * height / 2);
+    uint8_t *v = malloc((size_t)width / 2 * height / 2);
+
+    for (int i = 0; i < height; ++i) {
+        for (int j = 0; j < width; ++j) {
+            y[i * width + j] = values[i / 2];
+        }
+    }
+
+    for (int i = 0; i < height / 2; ++i) {
+        for (int j = 0; j < width / 2; ++j) {
+            u[i * (width / 2) + j] = values[j / count];
+            v[i * (width / 2) + j] = values[j % count];
+        }
+    }
+
+    uint8_t *expected = malloc((size_t)width * height * 4);
+    uint8_t *actual   = malloc((size_t)width * height * 4);
+
+    yuv420tobgr_reference(width, height, y, u, v, width, width / 2, width / 2, expected);
+    yuv420tobgr(width, height, y, u, v, width, width / 2, width / 2, actual);
+
+    ck_assert_msg(!memcmp(expected, actual, (size_t)width * height * 4),
+                  "yuv420tobgr differs from the reference at the extremes");
+
+    free(y);
+    free(u);
+    free(v);
+    free(expected);
+    free(actual);
+}
+END_TEST
+
+// Converts a frame of bytes per pixel input with bgrx or yuv422, whichever is for it.
+static void encoder_convert(BGRX_ROWS *bgrx, YUV422_ROWS *yuv422, unsigned int bytes, uint8_t *out,
+                            const uint8_t *input, uint16_t width, uint16_t height)
+{
+    const size_t pixels = (size_t)width * height;
+
+    if (bytes == 4) {
+        bgrxtoyuv420_rows(bgrx, out, out + pixels, out + pixels * 5 / 4, input, width, height);
+    } else if (bytes == 3) {
+        bgrtoyuv420_rows(bgrx, out, out + pixels, out + pixels * 5 / 4, input, width, height);
+    } else {
+        yuv422to420_rows(yuv422, out, out + pixels, out + pixels * 5 / 4, input, width, height);
+    }
+}
+
+// Converts random frames of all sorts of even sizes, comparing to the reference.
+static void check_encoder_rows(BGRX_ROWS *bgrx, YUV422_ROWS *yuv422, unsigned int bytes, const char *name) {
+    for (int i = 0; i < 200; ++i) {
+        const uint16_t width  = 2 + 2 * (rand() % 100);
+        const uint16_t height = 2 + 2 * (rand() % 10);
+        const size_t   pixels = (size_t)width * height;
+
+        uint8_t *input    = random_plane(pixels * bytes);
+        uint8_t *expected = malloc(pixels * 3 / 2);
+        uint8_t *actual   = malloc(pixels * 3 / 2);
+
+        if (bytes == 2) {
+            yuv422to420_reference(expected, expected + pixels, expected + pixels * 5 / 4, input, width, height);
+        } else {
+            bgrxtoyuv420_reference(expected, expected + pixels, expected + pixels * 5 / 4, input, width, height,
+                                   bytes);
+        }
+        encoder_convert(bgrx, yuv422, bytes, actual, input, width, height);
+
+        ck_assert_msg(!memcmp(expected, actual, pixels * 3 / 2), "%s differs from the reference for a %ux%u frame",
+                      name, width, height);
+
+        free(input);
+        free(expected);
+        free(actual);
+    }
+}
+
+static void check_encoder_kernels(BGRX_ROWS *bgrx, YUV422_ROWS *yuv422, const char *name) {
+    if (bgrx) {
+        check_encoder_rows(bgrx, NULL, 4, name);
+        check_encoder_rows(bgrx, NULL, 3, name);
+    }
+
+    if (yuv422) {
+        check_encoder_rows(NULL, yuv422, 2, name);
+    }
+}
+
+START_TEST(test_encoder_c)
+{
+    check_encoder_kernels(bgrx_rows_c, yuv422_rows_c, "C");
+}
+END_TEST
+
+START_TEST(test_encoder_simd)
+{
+#ifdef VIDEO_CONVERT_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2")) {
+        check_encoder_kernels(bgrx_rows_sse2, yuv422_rows_sse2, "SSE2");
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        check_encoder_kernels(bgrx_rows_avx2, NULL, "AVX2");
+    }
+#endif
+}
+END_TEST
+
+static Suite *suite(void)
+{
+    Suite *s = suite_create("Video conversion");
+
+    MK_TEST_CASE(yuv420_c);
+    MK_TEST_CASE(yuv420_simd);
+    MK_TEST_CASE(yuv420_extremes);
+    MK_TEST_CASE(encoder_c);
+    MK_TEST_CASE(encoder_simd);
+
+    return s;
+}
+
+int main(int argc, char *argv[])
+{
+    srand((unsigned int) time(NULL));
+
+    Suite *run = suite();
+    SRunner *test_runner = srunner_create(run);
+
+    int number_failed = 0;
+    srunner_run_all(test_runner, CK_NORMAL);
+    number_failed = srunner_ntests_failed(test_runner);
+
+    srunner_free(test_runner);
+
+    return number_failed;
+}